@@ -0,0 +1,350 @@
+#include "SyntheticPackage.h"
+#include "Catalog.h"
+#include "FileIO.h"
+#include "PatchBatch.h"
+#include "Scanner.h"
+#include "Wav.h"
+#include "XXX.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <new>
+#ifdef _WIN32
+#include <direct.h>
+#define chdir _chdir
+#else
+#include <unistd.h>
+#endif
+
+// Every allocation of the process goes through here so each phase can
+// report how many it made.
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace {
+
+// Read and write system calls of the process so far, from /proc/self/io.
+// Unavailable (-1) outside Linux.
+struct SyscallCounts {
+    int64_t reads;
+    int64_t writes;
+};
+
+SyscallCounts ReadSyscallCounts() {
+    SyscallCounts c = { -1, -1 };
+    FILE* f = fopen("/proc/self/io", "r");
+    if (!f) return c;
+    char key[32];
+    long long value;
+    while (fscanf(f, "%31s %lld", key, &value) == 2) {
+        if (strcmp(key, "syscr:") == 0) c.reads = value;
+        if (strcmp(key, "syscw:") == 0) c.writes = value;
+    }
+    fclose(f);
+    return c;
+}
+
+struct PhaseResult {
+    std::string package;
+    std::string phase;
+    int iterations;
+    double bestSeconds;
+    uint64_t bytes; // Bytes processed by one iteration
+    uint64_t allocations;
+    int64_t reads;
+    int64_t writes;
+};
+
+std::vector<PhaseResult> results;
+
+// Runs fn iterations times and records the best time and the per-iteration
+// allocation and syscall counts.
+void RunPhase(const std::string& package, const std::string& phase, int iterations, uint64_t bytes, const std::function<bool()>& fn) {
+    PhaseResult r = { package, phase, iterations, 1e30, bytes, 0, 0, 0 };
+#ifndef _WIN32
+    // Writeback of earlier phases' output is not billed to this one
+    sync();
+#endif
+    uint64_t allocBefore = allocations.load();
+    SyscallCounts before = ReadSyscallCounts();
+    for (int i = 0; i < iterations; ++i) {
+        auto begin = std::chrono::steady_clock::now();
+        if (!fn()) {
+            std::cout << "  " << phase << " failed on " << package << std::endl;
+            return;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (seconds < r.bestSeconds) r.bestSeconds = seconds;
+    }
+    SyscallCounts after = ReadSyscallCounts();
+    r.allocations = (allocations.load() - allocBefore) / iterations;
+    r.reads = before.reads < 0 ? -1 : (after.reads - before.reads) / iterations;
+    r.writes = before.writes < 0 ? -1 : (after.writes - before.writes) / iterations;
+    results.push_back(r);
+}
+
+void PrintResults() {
+    printf("%-28s %-15s %5s %10s %10s %9s %10s %9s %9s\n", "package", "phase", "iters", "ms/op", "MB/s", "ns/byte", "allocs/op", "reads/op",
+           "writes/op");
+    for (const auto& r : results) {
+        double mbps = r.bestSeconds > 0 ? r.bytes / r.bestSeconds / (1024.0 * 1024.0) : 0;
+        double nsPerByte = r.bytes ? r.bestSeconds * 1e9 / r.bytes : 0;
+        std::string name = r.package.size() > 28 ? r.package.substr(r.package.size() - 28) : r.package;
+        printf("%-28s %-15s %5d %10.3f %10.1f %9.3f %10llu %9lld %9lld\n", name.c_str(), r.phase.c_str(), r.iterations, r.bestSeconds * 1000.0, mbps,
+               nsPerByte, (unsigned long long)r.allocations, (long long)r.reads, (long long)r.writes);
+    }
+}
+
+bool CopyPackage(const std::string& from, const std::string& to) {
+    RandomAccessFile src, dst;
+    return src.Open(from, RandomAccessFile::ReadOnly) && dst.Open(to, RandomAccessFile::CreateTruncate) && dst.CopyFrom(src, 0, 0, src.Size());
+}
+
+// Times every hot path on a private copy of path inside workDir.
+void BenchPackage(const std::string& path, const std::string& workDir, int iterations) {
+    std::string name = path.substr(path.find_last_of("/\\") + 1);
+    std::string work = workDir + "/" + name;
+    if (!CopyPackage(path, work)) {
+        std::cout << "Failed to copy " << path << " to " << work << std::endl;
+        return;
+    }
+    std::ostream nullLog(nullptr);
+
+    XXXPackage package;
+    uint64_t fileSize = (uint64_t)GetFileLength(work);
+    RunPhase(name, "open", iterations, fileSize, [&]() {
+        package.Close();
+        return package.Open(work, nullLog);
+    });
+    if (!package.Data()) return;
+    uint64_t size = package.Size();
+
+    RunPhase(name, "scan", iterations, size, [&]() {
+        ScanFSBBanks(package.Data(), package.Size());
+        return true;
+    });
+
+    // A false signature in the data can claim any header size, so only banks
+    // whose header region fits in the package are timed.
+    std::vector<FSBBank> banks = ScanAndParseFSBBanks(package.Data(), package.Size());
+    std::vector<const FSBBank*> headers;
+    uint64_t headerBytes = 0;
+    for (const auto& bank : banks) {
+        if (!bank.parsed || bank.index.headerRegionSize > size - bank.info.offset) continue;
+        headers.push_back(&bank);
+        headerBytes += bank.index.headerRegionSize;
+    }
+    RunPhase(name, "parse", iterations, headerBytes, [&]() {
+        for (const FSBBank* bank : headers) {
+            FSBIndex index;
+            ParseFSBIndex(package.Data() + bank->info.offset, package.Size() - bank->info.offset, index);
+        }
+        return true;
+    });
+
+    ExtractOptions options;
+    ExtractOptions wavOptions;
+    wavOptions.writeWav = true;
+    // Both extract phases overwrite a previous extraction; writing into an
+    // empty folder is cheaper and would favour whichever phase ran first.
+    {
+        ExtractTotals totals;
+        std::string outDir = PrepareXXXExtraction(package, nullLog, totals);
+        for (size_t b = 0; b < banks.size() && !outDir.empty(); ++b) ExtractXXXBank(package, banks[b], (int)b, outDir, wavOptions, nullLog, totals);
+    }
+    RunPhase(name, "extract", iterations, size, [&]() {
+        ExtractTotals totals;
+        std::string outDir = PrepareXXXExtraction(package, nullLog, totals);
+        if (outDir.empty()) return false;
+        for (size_t b = 0; b < banks.size(); ++b) ExtractXXXBank(package, banks[b], (int)b, outDir, options, nullLog, totals);
+        return true;
+    });
+    RunPhase(name, "extract wav", iterations, size, [&]() {
+        ExtractTotals totals;
+        std::string outDir = PrepareXXXExtraction(package, nullLog, totals);
+        if (outDir.empty()) return false;
+        for (size_t b = 0; b < banks.size(); ++b) ExtractXXXBank(package, banks[b], (int)b, outDir, wavOptions, nullLog, totals);
+        return true;
+    });
+
+    // Patch the samples back with their own extracted bytes, so every
+    // iteration starts from the same package.
+    std::vector<PatchWrite> writes;
+    std::string samplesDir = XXXOutputDir(work);
+    for (size_t b = 0; b < banks.size(); ++b) {
+        if (!banks[b].parsed) continue;
+        for (const auto& s : banks[b].index.samples) {
+            std::string source = samplesDir + "/audio_" + std::to_string(b) + "_samples/" + s.name + ".bin";
+            if ((size_t)banks[b].info.offset + s.offset + s.size > size || GetFileLength(source) != (int64_t)s.size) continue;
+            PatchWrite w = { (uint32_t)(banks[b].info.offset + s.offset), s.size, s.size, source, 0, s.name, std::vector<char>(), std::vector<char>() };
+            writes.push_back(w);
+        }
+    }
+    package.Close();
+    if (writes.empty()) return;
+
+    auto patch = [&work](const std::vector<PatchWrite>& batchWrites) {
+        XXXPackage target;
+        if (!target.Open(work, std::cout)) return false;
+        PatchBatch batch;
+        for (const auto& w : batchWrites) batch.Add(w);
+        PatchStats stats;
+        return batch.Apply(target, stats);
+    };
+    std::vector<PatchWrite> single(1, writes[0]);
+    RunPhase(name, "patch single", iterations, writes[0].slotSize, [&]() { return patch(single); });
+    uint64_t batchBytes = 0;
+    for (const auto& w : writes) batchBytes += w.slotSize;
+    RunPhase(name, "patch batch", iterations, batchBytes, [&]() { return patch(writes); });
+
+    // VAG samples are patched back from the WAVs extract wav decoded; they
+    // encode to their own size, so the package keeps its layout.
+    std::vector<WavEncodeJob> wavJobs;
+    std::vector<PatchWrite> wavWrites;
+    uint64_t wavBytes = 0;
+    for (size_t b = 0; b < banks.size(); ++b) {
+        for (const auto& s : banks[b].index.samples) {
+            std::string source = samplesDir + "/audio_" + std::to_string(b) + "_samples/" + s.name + (HasExtension(s.name, ".wav") ? "" : ".wav");
+            int64_t wavSize = GetFileLength(source);
+            if (s.codec != FSB_CODEC_VAG || wavSize < 0) continue;
+            WavEncodeJob job;
+            job.path = source;
+            job.frequency = (uint32_t)s.frequency;
+            job.channels = s.channels;
+            wavJobs.push_back(job);
+            PatchWrite w = { (uint32_t)(banks[b].info.offset + s.offset), s.size, 0, source, 0, s.name, std::vector<char>(), std::vector<char>() };
+            wavWrites.push_back(w);
+            wavBytes += (uint64_t)wavSize;
+        }
+    }
+    if (!wavJobs.empty()) {
+        RunPhase(name, "patch wav", iterations, wavBytes, [&]() {
+            std::vector<WavEncodeJob> jobs = wavJobs;
+            EncodeWavFiles(jobs);
+            std::vector<PatchWrite> encoded;
+            for (size_t k = 0; k < jobs.size(); ++k) {
+                if (!jobs[k].error.empty() || jobs[k].vag.size() > wavWrites[k].slotSize) continue;
+                encoded.push_back(wavWrites[k]);
+                encoded.back().dataSize = (uint32_t)jobs[k].vag.size();
+                encoded.back().data.swap(jobs[k].vag);
+            }
+            return patch(encoded);
+        });
+    }
+
+    // One grown sample rebuilds the whole package. This runs last and once,
+    // as it leaves the package changed.
+    XXXPackage probe;
+    if (!probe.Open(work, nullLog) || probe.IsCompressed()) return;
+    probe.Close();
+    std::string grown = workDir + "/grown.bin";
+    {
+        std::vector<char> bytes(writes[0].slotSize + 4096, 0x11);
+        std::ofstream out(grown, std::ios::binary);
+        out.write(bytes.data(), bytes.size());
+    }
+    std::vector<PatchWrite> grow(1, writes[0]);
+    grow[0].sourcePath = grown;
+    grow[0].dataSize = writes[0].slotSize + 4096;
+    RunPhase(name, "patch relocate", 1, size, [&]() { return patch(grow); });
+}
+
+void PrintUsage() {
+    std::cout << "Usage: mk9bench [options] [package.xxx]..." << std::endl;
+    std::cout << "  --work <dir>         Scratch folder for package copies and extractions (default mk9bench_work)" << std::endl;
+    std::cout << "  --iterations <n>     Runs per phase; the best time is reported (default 5)" << std::endl;
+    std::cout << "  --banks <n>          Banks in the synthetic package (default 4)" << std::endl;
+    std::cout << "  --samples <n>        Samples per synthetic bank (default 64)" << std::endl;
+    std::cout << "  --sample-size <n>    Average synthetic sample size in bytes (default 16384)" << std::endl;
+    std::cout << "  --filler <n>         Filler bytes before each synthetic export (default 262144)" << std::endl;
+    std::cout << "  --false-f <ratio>    Fraction of filler bytes that are 'F' (default 0.01)" << std::endl;
+    std::cout << "  --seed <n>           Seed of the synthetic contents (default 1)" << std::endl;
+    std::cout << "  --vag                Synthetic samples are VAG, so the extract wav phase decodes them" << std::endl;
+    std::cout << "  --no-synthetic       Only benchmark the packages given" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    SyntheticOptions synthetic;
+    std::string workDir = "mk9bench_work";
+    int iterations = 5;
+    bool useSynthetic = true;
+    std::vector<std::string> packages;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--work" && hasValue) {
+            workDir = argv[++i];
+        } else if (arg == "--iterations" && hasValue) {
+            iterations = atoi(argv[++i]);
+        } else if (arg == "--banks" && hasValue) {
+            synthetic.banks = atoi(argv[++i]);
+        } else if (arg == "--samples" && hasValue) {
+            synthetic.samplesPerBank = atoi(argv[++i]);
+        } else if (arg == "--sample-size" && hasValue) {
+            synthetic.sampleSize = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--filler" && hasValue) {
+            synthetic.fillerSize = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--false-f" && hasValue) {
+            synthetic.falseFRatio = atof(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            synthetic.seed = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--vag") {
+            synthetic.vag = true;
+        } else if (arg == "--no-synthetic") {
+            useSynthetic = false;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            PrintUsage();
+            return 1;
+        } else {
+            packages.push_back(arg);
+        }
+    }
+    if (iterations < 1 || synthetic.banks < 1 || synthetic.samplesPerBank < 1) {
+        PrintUsage();
+        return 1;
+    }
+
+    CreateDirectoryIfNotExists(workDir);
+    if (useSynthetic) {
+        CreateDirectoryIfNotExists(workDir + "/generated");
+        std::string path = workDir + "/generated/SYNTHETIC.XXX";
+        if (!WriteSyntheticPackage(path, synthetic)) {
+            std::cout << "Failed to write " << path << std::endl;
+            return 1;
+        }
+        packages.insert(packages.begin(), path);
+    }
+
+    // Extraction writes next to the working directory, so run inside workDir.
+    for (auto& p : packages) p = GetAbsolutePath(p);
+    if (chdir(workDir.c_str()) != 0) {
+        std::cout << "Failed to enter " << workDir << std::endl;
+        return 1;
+    }
+    for (const auto& p : packages) {
+        std::cout << "Benchmarking " << p << std::endl;
+        BenchPackage(p, ".", iterations);
+    }
+    PrintResults();
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "SyntheticPackage.h"
+#include "FSB.h"
+#include "Package.h"
+#include "Vag.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace {
+
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+    uint64_t Next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    uint32_t Below(uint32_t n) { return n ? (uint32_t)(Next() % n) : 0; }
+
+private:
+    uint64_t state;
+};
+
+class Writer {
+public:
+    void U32(uint32_t v) {
+        char b[4];
+        WriteBE32(b, v);
+        bytes.insert(bytes.end(), b, b + 4);
+    }
+
+    void String(const char* s) {
+        U32((uint32_t)strlen(s) + 1);
+        bytes.insert(bytes.end(), s, s + strlen(s) + 1);
+    }
+
+    void Zero(size_t n) { bytes.resize(bytes.size() + n, 0); }
+    size_t Pos() const { return bytes.size(); }
+    char* At(size_t pos) { return bytes.data() + pos; }
+
+    std::vector<char> bytes;
+};
+
+void WriteFiller(Writer& w, Random& rng, const SyntheticOptions& options) {
+    static const char* NEAR_MISSES[] = { "FSB3", "FSB\0", "FSBF", "FFSB" };
+    size_t start = w.Pos();
+    w.Zero(options.fillerSize);
+    char* p = w.At(start);
+    uint32_t falseF = (uint32_t)(options.falseFRatio * 1000000);
+    for (uint32_t i = 0; i < options.fillerSize; ++i) {
+        char c = (char)(rng.Next() & 0xFF);
+        p[i] = rng.Below(1000000) < falseF ? 'F' : (c == 'F' ? 'G' : c);
+    }
+    // A few signatures that only fail on the version byte or the header.
+    for (uint32_t i = 0; i + 4 <= options.fillerSize && i < 64 * 1024; i += 4096) {
+        memcpy(p + i, NEAR_MISSES[rng.Below(4)], 4);
+    }
+}
+
+void WriteBank(Writer& w, Random& rng, const SyntheticOptions& options, int bankIndex) {
+    std::vector<uint32_t> sizes(options.samplesPerBank);
+    uint32_t dataSize = 0;
+    for (auto& size : sizes) {
+        uint32_t spread = options.sampleSize / 2;
+        size = options.sampleSize - spread + rng.Below(2 * spread + 1);
+        if (options.vag) size = Align(size, VAG_FRAME_SIZE);
+        if (size == 0) size = options.vag ? VAG_FRAME_SIZE : 1;
+        dataSize += Align(size, 32);
+    }
+
+    size_t start = w.Pos();
+    uint32_t shdrSize = (uint32_t)(options.samplesPerBank * sizeof(FSB4_SAMPLE_HEADER));
+    w.Zero(sizeof(FSB4_HEADER) + shdrSize);
+    FSB4_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "FSB4", 4);
+    header.numsamples = LE32((uint32_t)options.samplesPerBank);
+    header.shdr_size = LE32(shdrSize);
+    header.data_size = LE32(dataSize);
+    header.version = LE32(0x00040000);
+    memcpy(w.At(start), &header, sizeof(header));
+
+    for (int i = 0; i < options.samplesPerBank; ++i) {
+        FSB4_SAMPLE_HEADER sh;
+        memset(&sh, 0, sizeof(sh));
+        sh.size = LE16((uint16_t)sizeof(sh));
+        // Cut to the field, keeping its terminating zero
+        std::string name = "bench_" + std::to_string(bankIndex) + "_" + std::to_string(i) + ".wav";
+        memcpy(sh.name, name.data(), std::min(name.size(), sizeof(sh.name) - 1));
+        uint32_t lengthSamples = options.vag ? sizes[i] / VAG_FRAME_SIZE * VAG_FRAME_SAMPLES : sizes[i] / 2;
+        sh.lengthsamples = LE32(lengthSamples);
+        sh.lengthcompressedbytes = LE32(sizes[i]);
+        sh.loopend = LE32(lengthSamples ? lengthSamples - 1 : 0);
+        sh.mode = LE32(options.vag ? 0x00800020 : 0x20); // Mono VAG or 16-bit PCM
+        sh.deffreq = (int32_t)LE32(48000);
+        sh.defvol = LE16(255);
+        sh.defpan = (int16_t)LE16(128);
+        sh.defpri = LE16(128);
+        sh.numchannels = LE16(1);
+        memcpy(w.At(start + sizeof(FSB4_HEADER) + i * sizeof(sh)), &sh, sizeof(sh));
+    }
+
+    for (uint32_t size : sizes) {
+        size_t pos = w.Pos();
+        w.Zero(Align(size, 32));
+        char* p = w.At(pos);
+        for (uint32_t i = 0; i + 8 <= size; i += 8) {
+            uint64_t v = rng.Next();
+            memcpy(p + i, &v, 8);
+        }
+    }
+}
+
+} // namespace
+
+bool WriteSyntheticPackage(const std::string& path, const SyntheticOptions& options) {
+    Random rng(options.seed);
+    Writer w;
+
+    // Summary; the offsets are patched in once the tables are laid out.
+    w.U32(PACKAGE_FILE_TAG);
+    w.U32((101u << 16) | 0x240);
+    size_t headerSizePos = w.Pos();
+    w.U32(0);
+    w.bytes.insert(w.bytes.end(), "  KM", "  KM" + 4);
+    w.U32(0);
+    w.String("None");
+    w.U32(0); // packageFlags
+    size_t tablesPos = w.Pos();
+    w.Zero(7 * 4); // name, export, import counts/offsets, depends offset
+    w.Zero(4 + 16);
+    w.U32(0); // engineVersion
+    w.U32(0); // cookerVersion
+    w.U32(COMPRESS_None);
+    w.U32(0); // No chunks
+
+    size_t nameOffset = w.Pos();
+    w.String("SoundNodeWave");
+    w.Zero(8);
+
+    size_t exportOffset = w.Pos();
+    const size_t EXPORT_ENTRY_SIZE = 64;
+    w.Zero(EXPORT_ENTRY_SIZE * options.banks);
+    size_t headerEnd = w.Pos();
+
+    uint32_t tables[7] = { 1, (uint32_t)nameOffset, (uint32_t)options.banks, (uint32_t)exportOffset, 0, (uint32_t)headerEnd, (uint32_t)headerEnd };
+    for (int i = 0; i < 7; ++i) WriteBE32(w.At(tablesPos + i * 4), tables[i]);
+    WriteBE32(w.At(headerSizePos), (uint32_t)headerEnd);
+
+    for (int b = 0; b < options.banks; ++b) {
+        WriteFiller(w, rng, options);
+
+        size_t serialOffset = w.Pos();
+        w.Zero(16); // Properties
+        size_t bulkPos = w.Pos();
+        w.Zero(16);
+        size_t bankStart = w.Pos();
+        WriteBank(w, rng, options, b);
+        uint32_t bankSize = (uint32_t)(w.Pos() - bankStart);
+        WriteBE32(w.At(bulkPos + 4), bankSize);
+        WriteBE32(w.At(bulkPos + 8), bankSize);
+        WriteBE32(w.At(bulkPos + 12), (uint32_t)bankStart);
+        w.Zero(8); // Trailing properties
+
+        char* e = w.At(exportOffset + b * EXPORT_ENTRY_SIZE);
+        WriteBE32(e, (uint32_t)-1); // Class: an import
+        WriteBE32(e + 12, 0);       // Name
+        WriteBE32(e + 16, (uint32_t)b);
+        WriteBE32(e + EXPORT_SERIAL_SIZE_FIELD, (uint32_t)(w.Pos() - serialOffset));
+        WriteBE32(e + EXPORT_SERIAL_OFFSET_FIELD, (uint32_t)serialOffset);
+    }
+    WriteFiller(w, rng, options);
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(w.bytes.data(), w.bytes.size());
+    return out.good();
+}
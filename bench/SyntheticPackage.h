@@ -0,0 +1,25 @@
+#ifndef SYNTHETIC_PACKAGE_H
+#define SYNTHETIC_PACKAGE_H
+
+#include "Utils.h"
+
+// Shape of a generated package. Every bank sits in its own export behind an
+// inline bulk data header, the way MK9 cooks SoundNodeWave exports, and the
+// exports are separated by filler sprinkled with stray 'F' bytes and "FSB"
+// near misses for the scanner to reject.
+struct SyntheticOptions {
+    int banks;
+    int samplesPerBank;
+    uint32_t sampleSize;  // Average; actual sizes vary by up to +-50% and are rarely 32-byte multiples
+    uint32_t fillerSize;  // Bytes of filler before each export
+    double falseFRatio;   // Fraction of filler bytes that are 'F'
+    uint64_t seed;
+    bool vag;             // Samples are mono VAG frames instead of 16-bit PCM
+
+    SyntheticOptions() : banks(4), samplesPerBank(64), sampleSize(16384), fillerSize(256 << 10), falseFRatio(0.01), seed(1), vag(false) {}
+};
+
+// Writes an uncompressed big-endian UE3 package to path; false on I/O errors.
+bool WriteSyntheticPackage(const std::string& path, const SyntheticOptions& options);
+
+#endif
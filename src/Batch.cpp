@@ -0,0 +1,154 @@
+#include "Batch.h"
+#include "Catalog.h"
+#include "FileIO.h"
+#include "Incremental.h"
+#include "Stats.h"
+#include "Store.h"
+#include "TaskPool.h"
+#include "XXX.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+namespace {
+
+std::mutex consoleLock;
+
+// Prints the buffered output of one unit of work without interleaving it
+// with other units.
+void PrintUnit(const std::string& label, const std::ostringstream& log) {
+    std::lock_guard<std::mutex> guard(consoleLock);
+    std::cout << "[" << label << "]" << std::endl << log.str();
+    std::cout.flush();
+}
+
+bool IsAudioInput(const std::string& path) {
+    return HasExtension(path, ".xxx") || HasExtension(path, ".fsb");
+}
+
+std::string FileNameOf(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+void ExtractPackageUnit(TaskPool& pool, ExtractTotals& totals, const ExtractOptions& options, const std::string& path) {
+    ScopedPhase phase("extract", path);
+    std::string label = FileNameOf(path);
+    std::ostringstream log;
+
+    // The state is saved once the last bank task lets go of it.
+    std::shared_ptr<ExtractState> state;
+    if (options.incremental) {
+        std::unique_ptr<ExtractState> loaded(new ExtractState(XXXOutputDir(path)));
+        if (loaded->Begin(path, options)) {
+            log << "Unchanged since the last extraction" << std::endl;
+            PrintUnit(label, log);
+            return;
+        }
+        state.reset(loaded.release(), [](ExtractState* s) {
+            s->End();
+            delete s;
+        });
+    }
+
+    std::shared_ptr<XXXPackage> package = std::make_shared<XXXPackage>();
+    if (!package->Open(path, log)) {
+        if (state) state->MarkIncomplete();
+        log << "Failed to open " << path << std::endl;
+        PrintUnit(label, log);
+        return;
+    }
+
+    std::string outDir = PrepareXXXExtraction(*package, log, totals, state.get());
+    if (!outDir.empty()) {
+        // Bank tasks hold the package open; it is unmapped when the last one finishes.
+        std::vector<FSBBank> banks = FindPackageBanks(*package);
+        log << "Queued " << banks.size() << " FSB bank(s)" << std::endl;
+        PrintUnit(label, log);
+        for (size_t i = 0; i < banks.size(); ++i) {
+            auto bank = std::make_shared<FSBBank>(banks[i]);
+            pool.Submit([package, state, bank, i, outDir, label, &options, &totals]() {
+                ScopedPhase phase("extract bank", label);
+                std::ostringstream bankLog;
+                ExtractXXXBank(*package, *bank, (int)i, outDir, options, bankLog, totals, state.get());
+                PrintUnit(label + " bank " + std::to_string(i), bankLog);
+            });
+        }
+        return;
+    }
+    if (state) state->MarkIncomplete();
+    PrintUnit(label, log);
+}
+
+} // namespace
+
+std::vector<std::string> ExpandAudioInputs(const std::vector<std::string>& inputs) {
+    std::vector<std::string> files;
+    for (const auto& input : inputs) {
+        if (IsDirectory(input)) {
+            for (const auto& name : GetFilesInDirectory(input)) {
+                if (IsAudioInput(name)) files.push_back(input + "/" + name);
+            }
+        } else if (input.find_first_of("*?") != std::string::npos) {
+            size_t slash = input.find_last_of("/\\");
+            std::string dir = slash == std::string::npos ? "." : input.substr(0, slash);
+            std::string pattern = slash == std::string::npos ? input : input.substr(slash + 1);
+            for (const auto& name : GetFilesInDirectory(dir)) {
+                if (!WildcardMatch(pattern.c_str(), name.c_str())) continue;
+                files.push_back(slash == std::string::npos ? name : dir + "/" + name);
+            }
+        } else {
+            files.push_back(input);
+        }
+    }
+
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+
+    // Starting the biggest packages first keeps the tail of the run short.
+    std::vector<std::pair<int64_t, std::string> > bySize;
+    for (const auto& f : files) bySize.push_back(std::make_pair(-GetFileLength(f), f));
+    std::stable_sort(bySize.begin(), bySize.end());
+    for (size_t i = 0; i < files.size(); ++i) files[i] = bySize[i].second;
+    return files;
+}
+
+void ExtractBatch(const std::vector<std::string>& inputs, const ExtractOptions& options) {
+    std::vector<std::string> files = ExpandAudioInputs(inputs);
+    if (files.empty()) {
+        std::cout << "No .xxx or .fsb files found" << std::endl;
+        return;
+    }
+
+    ExtractTotals totals;
+    auto begin = std::chrono::steady_clock::now();
+    {
+        TaskPool pool;
+        std::cout << "Extracting " << files.size() << " file(s) on " << pool.ThreadCount() << " thread(s)" << std::endl;
+        for (const auto& path : files) {
+            if (HasExtension(path, ".fsb")) {
+                pool.Submit([path, &options, &totals]() {
+                    std::ostringstream log;
+                    ExtractFSB(path, options, log, totals);
+                    PrintUnit(FileNameOf(path), log);
+                });
+            } else {
+                pool.Submit([path, &pool, &options, &totals]() { ExtractPackageUnit(pool, totals, options, path); });
+            }
+        }
+        pool.Wait();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (seconds <= 0) seconds = 1e-9;
+
+    double mbRead = totals.bytesRead / (1024.0 * 1024.0);
+    double mbWritten = totals.bytesWritten / (1024.0 * 1024.0);
+    std::cout << "Finished " << files.size() << " file(s) in " << (uint64_t)(seconds * 1000.0 + 0.5) << " ms: "
+              << mbRead << " MB read (" << mbRead / seconds << " MB/s), "
+              << mbWritten << " MB written (" << mbWritten / seconds << " MB/s), "
+              << totals.samples << " samples (" << (uint64_t)(totals.samples / seconds) << " samples/s)" << std::endl;
+    if (options.incremental) std::cout << totals.outputsSkipped << " unchanged output(s) left as they were" << std::endl;
+    if (options.store) PrintStoreTotals(totals, std::cout);
+}
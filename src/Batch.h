@@ -0,0 +1,15 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "FSB.h"
+
+// Expands files, directories and wildcard patterns ("dir/*.XXX") into the
+// .xxx/.fsb files they name, largest first.
+std::vector<std::string> ExpandAudioInputs(const std::vector<std::string>& inputs);
+
+// Extracts every package and FSB file named by inputs on a work-stealing
+// pool. Each package and each bank inside a package is a separate unit of
+// work; a unit's console output is printed in one piece when it finishes.
+void ExtractBatch(const std::vector<std::string>& inputs, const ExtractOptions& options = ExtractOptions());
+
+#endif
@@ -0,0 +1,390 @@
+#include "Catalog.h"
+#include "Batch.h"
+#include "Cues.h"
+#include "Hash.h"
+#include "Stats.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+namespace {
+
+Catalog activeCatalog;
+
+bool PathLess(const CatalogEntry& a, const CatalogEntry& b) {
+    return a.path < b.path;
+}
+
+bool NameLess(const CatalogName& a, const CatalogName& b) {
+    return LE64(a.hash) < LE64(b.hash);
+}
+
+} // namespace
+
+Catalog::Catalog()
+    : header(nullptr), packages(nullptr), banks(nullptr), samples(nullptr), names(nullptr), strings(nullptr) {
+}
+
+bool Catalog::Open(const std::string& path) {
+    header = nullptr;
+    if (!file.Open(path) || file.Size() < sizeof(CatalogHeader)) return false;
+    const CatalogHeader* h = (const CatalogHeader*)file.Data();
+    if (memcmp(h->magic, "MK9C", 4) != 0 || LE32(h->version) != CATALOG_VERSION) return false;
+
+    uint64_t expected = sizeof(CatalogHeader) + (uint64_t)LE32(h->packageCount) * sizeof(CatalogPackage) +
+                        (uint64_t)LE32(h->bankCount) * sizeof(CatalogBank) +
+                        (uint64_t)LE32(h->sampleCount) * (sizeof(CatalogSample) + sizeof(CatalogName)) + LE32(h->stringsSize);
+    if (expected != file.Size()) return false;
+
+    const char* p = file.Data() + sizeof(CatalogHeader);
+    packages = (const CatalogPackage*)p;
+    p += LE32(h->packageCount) * sizeof(CatalogPackage);
+    banks = (const CatalogBank*)p;
+    p += LE32(h->bankCount) * sizeof(CatalogBank);
+    samples = (const CatalogSample*)p;
+    p += LE32(h->sampleCount) * sizeof(CatalogSample);
+    names = (const CatalogName*)p;
+    p += LE32(h->sampleCount) * sizeof(CatalogName);
+    strings = p;
+    header = h;
+    return true;
+}
+
+std::string Catalog::String(uint32_t offset, uint32_t length) const {
+    uint32_t poolSize = LE32(header->stringsSize);
+    if (offset > poolSize || length > poolSize - offset) return std::string();
+    return std::string(strings + offset, length);
+}
+
+FSBSample Catalog::Sample(uint32_t i) const {
+    const CatalogSample& c = samples[i];
+    FSBSample s;
+    s.name = String(LE32(c.name), LE32(c.nameLength));
+    s.offset = LE32(c.offset);
+    s.size = LE32(c.size);
+    s.headerOffset = LE32(c.headerOffset);
+    s.headerSize = LE32(c.headerSize);
+    s.numSamples = LE32(c.numSamples);
+    s.loopStart = LE32(c.loopStart);
+    s.loopEnd = LE32(c.loopEnd);
+    s.mode = LE32(c.mode);
+    s.codec = LE32(c.codec);
+    s.frequency = (int32_t)LE32((uint32_t)c.frequency);
+    s.channels = LE16(c.channels);
+    return s;
+}
+
+int64_t Catalog::FindPackage(const std::string& absolutePath) const {
+    if (!header) return -1;
+    size_t lo = 0;
+    size_t hi = LE32(header->packageCount);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        std::string path = String(LE32(packages[mid].path), LE32(packages[mid].pathLength));
+        int cmp = path.compare(absolutePath);
+        if (cmp == 0) return (int64_t)mid;
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+void Catalog::ReadEntry(size_t i, CatalogEntry& entry) const {
+    const CatalogPackage& p = packages[i];
+    entry.path = String(LE32(p.path), LE32(p.pathLength));
+    entry.size = LE64(p.size);
+    entry.mtime = LE64(p.mtime);
+    entry.hash = LE64(p.hash);
+    entry.banks.clear();
+
+    uint32_t bankCount = LE32(header->bankCount);
+    uint32_t sampleCount = LE32(header->sampleCount);
+    for (uint32_t b = LE32(p.firstBank); b < LE32(p.firstBank) + LE32(p.bankCount) && b < bankCount; ++b) {
+        const CatalogBank& cb = banks[b];
+        FSBBank bank;
+        memset(&bank.info, 0, sizeof(bank.info));
+        memset(&bank.index.header, 0, sizeof(bank.index.header));
+        bank.info.offset = (size_t)LE64(cb.offset);
+        bank.info.version = (char)cb.version;
+        bank.info.headerComplete = cb.parsed != 0;
+        bank.parsed = cb.parsed != 0;
+        bank.index.version = (char)cb.version;
+        bank.index.headerRegionSize = LE32(cb.headerRegionSize);
+        bank.index.dataSize = LE32(cb.dataSize);
+        for (uint32_t s = LE32(cb.firstSample); s < LE32(cb.firstSample) + LE32(cb.sampleCount) && s < sampleCount; ++s) {
+            bank.index.samples.push_back(Sample(s));
+        }
+        entry.banks.push_back(bank);
+    }
+}
+
+int64_t Catalog::FindCurrent(const CatalogEntry& fingerprint) const {
+    int64_t i = FindPackage(fingerprint.path);
+    if (i < 0) return -1;
+    const CatalogPackage& p = packages[i];
+    if (fingerprint.size != LE64(p.size) || fingerprint.mtime != LE64(p.mtime) || fingerprint.hash != LE64(p.hash)) return -1;
+    return i;
+}
+
+bool Catalog::LookupPackage(const XXXPackage& package, std::vector<FSBBank>& result) const {
+    CatalogEntry fingerprint;
+    if (!header || !FingerprintFile(package.Path(), fingerprint)) return false;
+    int64_t i = FindCurrent(fingerprint);
+    if (i < 0) return false;
+
+    CatalogEntry entry;
+    ReadEntry((size_t)i, entry);
+    // The fixed FSB4 header is not stored; it is copied back from the package.
+    for (auto& bank : entry.banks) {
+        if (bank.info.version == '4' && bank.info.offset + sizeof(FSB4_HEADER) <= package.Size()) {
+            memcpy(&bank.info.header, package.Data() + bank.info.offset, sizeof(FSB4_HEADER));
+            bank.index.header = bank.info.header;
+        }
+    }
+    result.swap(entry.banks);
+    return true;
+}
+
+std::vector<CatalogHit> Catalog::FindSample(const std::string& name) const {
+    std::vector<CatalogHit> hits;
+    if (!header) return hits;
+    CatalogName key;
+    key.hash = LE64(XXH64(name.data(), name.size()));
+    const CatalogName* end = names + LE32(header->sampleCount);
+    for (const CatalogName* n = std::lower_bound(names, end, key, NameLess); n != end && n->hash == key.hash; ++n) {
+        // Indices come from the file; a damaged catalog must not send them
+        // past the tables, as ReadEntry guards too.
+        uint32_t s = LE32(n->sample);
+        if (s >= LE32(header->sampleCount)) continue;
+        const CatalogSample& cs = samples[s];
+        if (String(LE32(cs.name), LE32(cs.nameLength)) != name) continue;
+        if (LE32(cs.bank) >= LE32(header->bankCount)) continue;
+        const CatalogBank& cb = banks[LE32(cs.bank)];
+        if (LE32(cb.package) >= LE32(header->packageCount)) continue;
+        const CatalogPackage& cp = packages[LE32(cb.package)];
+        CatalogHit hit;
+        hit.package = String(LE32(cp.path), LE32(cp.pathLength));
+        hit.bankIndex = LE32(cs.bank) - LE32(cp.firstBank);
+        hit.bankOffset = LE64(cb.offset);
+        hit.sample = Sample(s);
+        hits.push_back(hit);
+    }
+    return hits;
+}
+
+bool FingerprintFile(const std::string& path, CatalogEntry& entry) {
+    entry.path = GetAbsolutePath(path);
+    if (!GetFileStamp(path, entry.size, entry.mtime)) return false;
+    RandomAccessFile file;
+    if (!file.Open(path, RandomAccessFile::ReadOnly)) return false;
+    std::vector<char> head((size_t)(entry.size < CATALOG_FINGERPRINT_BYTES ? entry.size : CATALOG_FINGERPRINT_BYTES));
+    if (!file.ReadAt(0, head.data(), head.size())) return false;
+    entry.hash = XXH64(head.data(), head.size());
+    return true;
+}
+
+bool WriteCatalog(const std::string& path, std::vector<CatalogEntry>& entries) {
+    std::sort(entries.begin(), entries.end(), PathLess);
+
+    std::vector<CatalogPackage> packageRecords;
+    std::vector<CatalogBank> bankRecords;
+    std::vector<CatalogSample> sampleRecords;
+    std::vector<CatalogName> nameRecords;
+    std::string pool;
+
+    for (size_t p = 0; p < entries.size(); ++p) {
+        const CatalogEntry& e = entries[p];
+        CatalogPackage cp;
+        cp.path = LE32((uint32_t)pool.size());
+        cp.pathLength = LE32((uint32_t)e.path.size());
+        pool += e.path;
+        cp.size = LE64(e.size);
+        cp.mtime = LE64(e.mtime);
+        cp.hash = LE64(e.hash);
+        cp.firstBank = LE32((uint32_t)bankRecords.size());
+        cp.bankCount = LE32((uint32_t)e.banks.size());
+        packageRecords.push_back(cp);
+
+        for (const auto& bank : e.banks) {
+            CatalogBank cb;
+            memset(&cb, 0, sizeof(cb));
+            cb.offset = LE64(bank.info.offset);
+            cb.package = LE32((uint32_t)p);
+            cb.version = (uint8_t)bank.info.version;
+            cb.parsed = bank.parsed ? 1 : 0;
+            cb.headerRegionSize = LE32(bank.index.headerRegionSize);
+            cb.dataSize = LE32(bank.index.dataSize);
+            cb.firstSample = LE32((uint32_t)sampleRecords.size());
+            cb.sampleCount = LE32((uint32_t)bank.index.samples.size());
+            uint32_t bankIndex = (uint32_t)bankRecords.size();
+            bankRecords.push_back(cb);
+
+            for (const auto& s : bank.index.samples) {
+                CatalogSample cs;
+                cs.name = LE32((uint32_t)pool.size());
+                cs.nameLength = LE32((uint32_t)s.name.size());
+                pool += s.name;
+                cs.bank = LE32(bankIndex);
+                cs.offset = LE32(s.offset);
+                cs.size = LE32(s.size);
+                cs.headerOffset = LE32(s.headerOffset);
+                cs.headerSize = LE32(s.headerSize);
+                cs.numSamples = LE32(s.numSamples);
+                cs.loopStart = LE32(s.loopStart);
+                cs.loopEnd = LE32(s.loopEnd);
+                cs.mode = LE32(s.mode);
+                cs.codec = LE32(s.codec);
+                cs.frequency = (int32_t)LE32((uint32_t)s.frequency);
+                cs.channels = LE16(s.channels);
+                cs.reserved = 0;
+
+                CatalogName cn;
+                cn.hash = LE64(XXH64(s.name.data(), s.name.size()));
+                cn.sample = LE32((uint32_t)sampleRecords.size());
+                cn.reserved = 0;
+                sampleRecords.push_back(cs);
+                nameRecords.push_back(cn);
+            }
+        }
+    }
+    std::stable_sort(nameRecords.begin(), nameRecords.end(), NameLess);
+
+    CatalogHeader h;
+    memcpy(h.magic, "MK9C", 4);
+    h.version = LE32(CATALOG_VERSION);
+    h.packageCount = LE32((uint32_t)packageRecords.size());
+    h.bankCount = LE32((uint32_t)bankRecords.size());
+    h.sampleCount = LE32((uint32_t)sampleRecords.size());
+    h.stringsSize = LE32((uint32_t)pool.size());
+
+    // Written under a temporary name and swapped in, so a running lookup
+    // never maps a half-written catalog.
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary);
+    if (!out.is_open()) return false;
+    out.write((const char*)&h, sizeof(h));
+    out.write((const char*)packageRecords.data(), packageRecords.size() * sizeof(CatalogPackage));
+    out.write((const char*)bankRecords.data(), bankRecords.size() * sizeof(CatalogBank));
+    out.write((const char*)sampleRecords.data(), sampleRecords.size() * sizeof(CatalogSample));
+    out.write((const char*)nameRecords.data(), nameRecords.size() * sizeof(CatalogName));
+    out.write(pool.data(), pool.size());
+    out.close();
+    if (!out.good()) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return ReplaceFileWith(tmpPath, path);
+}
+
+void BuildCatalog(const std::vector<std::string>& inputs, const std::string& catalogPath) {
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::string> files = ExpandAudioInputs(inputs);
+
+    std::vector<CatalogEntry> entries;
+    std::vector<CatalogEntry> scanned(files.size());
+    std::vector<char> ok(files.size(), 0);
+    std::vector<char> reused(files.size(), 0);
+    {
+        Catalog old;
+        if (old.Open(catalogPath)) {
+            // Entries for packages outside this run are kept as long as the file exists.
+            std::vector<std::string> absolute;
+            for (const auto& f : files) absolute.push_back(GetAbsolutePath(f));
+            std::sort(absolute.begin(), absolute.end());
+            for (size_t i = 0; i < old.PackageCount(); ++i) {
+                CatalogEntry entry;
+                old.ReadEntry(i, entry);
+                if (!std::binary_search(absolute.begin(), absolute.end(), entry.path) && FileExists(entry.path)) {
+                    entries.push_back(entry);
+                }
+            }
+        }
+
+        // Unchanged packages are taken from the old catalog without being
+        // opened, which for compressed ones would mean decompressing them.
+        ParallelFor(files.size(), [&](size_t i) {
+            if (!FingerprintFile(files[i], scanned[i])) return;
+            int64_t current = old.FindCurrent(scanned[i]);
+            if (current >= 0) {
+                old.ReadEntry((size_t)current, scanned[i]);
+                reused[i] = 1;
+            } else {
+                XXXPackage package;
+                std::ostringstream ignored;
+                if (!package.Open(files[i], ignored)) return;
+                scanned[i].banks = LocatePackageBanks(package);
+            }
+            ok[i] = 1;
+        });
+    }
+
+    size_t bankCount = 0;
+    size_t sampleCount = 0;
+    size_t reusedCount = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!ok[i]) {
+            std::cout << "Failed to open " << files[i] << std::endl;
+            continue;
+        }
+        reusedCount += reused[i];
+        for (const auto& bank : scanned[i].banks) sampleCount += bank.index.samples.size();
+        bankCount += scanned[i].banks.size();
+        entries.push_back(scanned[i]);
+    }
+
+    if (!WriteCatalog(catalogPath, entries)) {
+        std::cout << "Failed to write catalog " << catalogPath << std::endl;
+        return;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "Cataloged " << files.size() << " file(s) (" << reusedCount << " unchanged), " << bankCount << " bank(s), "
+              << sampleCount << " sample(s) in " << (uint64_t)(ms + 0.5) << " ms. Catalog " << catalogPath << " holds "
+              << entries.size() << " package(s)." << std::endl;
+}
+
+void LookupCatalogSample(const std::string& name, const std::string& catalogPath) {
+    auto begin = std::chrono::steady_clock::now();
+    Catalog catalog;
+    if (!catalog.Open(catalogPath)) {
+        std::cout << "Failed to open catalog " << catalogPath << ". Run 'catalog' first." << std::endl;
+        return;
+    }
+    std::vector<CatalogHit> hits = catalog.FindSample(name);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+
+    for (const auto& hit : hits) {
+        const FSBSample& s = hit.sample;
+        std::cout << hit.package << " [Bank " << hit.bankIndex << " at 0x" << std::hex << hit.bankOffset << "] Offset: 0x"
+                  << hit.bankOffset + s.offset << std::dec << " | Size: " << s.size << " bytes | Format: " << GetFormatString(s.codec)
+                  << " | Channels: " << s.channels << " | Freq: " << s.frequency << "Hz" << std::endl;
+    }
+    std::cout << hits.size() << " match(es) in " << catalog.PackageCount() << " package(s), " << (uint64_t)(us + 0.5) << " us" << std::endl;
+}
+
+void SetActiveCatalog(const std::string& path) {
+    activeCatalog.Open(path);
+}
+
+const Catalog* ActiveCatalog() {
+    return activeCatalog.IsOpen() ? &activeCatalog : nullptr;
+}
+
+std::vector<FSBBank> LocatePackageBanks(const XXXPackage& package) {
+    // Sound banks are bulk data of exports; the export table leads straight
+    // to them without a scan of the whole package.
+    std::vector<FSBBank> banks;
+    PackageTables tables(package);
+    if (LocateExportBanks(package, tables, banks)) return banks;
+    return ScanAndParseFSBBanks(package.Data(), package.Size());
+}
+
+std::vector<FSBBank> FindPackageBanks(const XXXPackage& package) {
+    ScopedPhase phase("find banks");
+    std::vector<FSBBank> banks;
+    const Catalog* catalog = ActiveCatalog();
+    if (catalog && catalog->LookupPackage(package, banks)) return banks;
+    return LocatePackageBanks(package);
+}
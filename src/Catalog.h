@@ -0,0 +1,149 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "Package.h"
+#include "Scanner.h"
+
+#define CATALOG_VERSION 2
+#define DEFAULT_CATALOG_PATH "MK9Tool.catalog"
+
+// Bytes at the start of a package that are hashed into its fingerprint,
+// next to the size and last-write time.
+#define CATALOG_FINGERPRINT_BYTES (64 * 1024)
+
+// On-disk layout, all little-endian: header, packages sorted by path, banks,
+// samples, sample names sorted by hash, then a pool of UTF-8 strings.
+#pragma pack(push, 1)
+struct CatalogHeader {
+    char magic[4]; // "MK9C"
+    uint32_t version;
+    uint32_t packageCount;
+    uint32_t bankCount;
+    uint32_t sampleCount;
+    uint32_t stringsSize;
+};
+
+struct CatalogPackage {
+    uint32_t path; // Offset into the string pool
+    uint32_t pathLength;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t hash;
+    uint32_t firstBank;
+    uint32_t bankCount;
+};
+
+struct CatalogBank {
+    uint64_t offset; // In the uncompressed view of the package
+    uint32_t package;
+    uint8_t version;
+    uint8_t parsed;
+    uint16_t reserved;
+    uint32_t headerRegionSize;
+    uint32_t dataSize;
+    uint32_t firstSample;
+    uint32_t sampleCount;
+};
+
+struct CatalogSample {
+    uint32_t name;
+    uint32_t nameLength;
+    uint32_t bank;
+    uint32_t offset; // Relative to the start of the bank
+    uint32_t size;
+    uint32_t headerOffset;
+    uint32_t headerSize;
+    uint32_t numSamples;
+    uint32_t loopStart;
+    uint32_t loopEnd;
+    uint32_t mode;
+    uint32_t codec;
+    int32_t frequency;
+    uint16_t channels;
+    uint16_t reserved;
+};
+
+struct CatalogName {
+    uint64_t hash; // XXH64 of the sample name
+    uint32_t sample;
+    uint32_t reserved;
+};
+#pragma pack(pop)
+
+// One package as recorded in a catalog.
+struct CatalogEntry {
+    std::string path; // Absolute
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t hash;
+    std::vector<FSBBank> banks;
+};
+
+struct CatalogHit {
+    std::string package;
+    uint32_t bankIndex;
+    uint64_t bankOffset;
+    FSBSample sample;
+};
+
+// Read-only, memory-mapped view of a catalog file.
+class Catalog {
+public:
+    Catalog();
+
+    bool Open(const std::string& path);
+    bool IsOpen() const { return header != nullptr; }
+    size_t PackageCount() const { return header ? LE32(header->packageCount) : 0; }
+
+    // Rebuilds the banks of an opened package if the catalog holds an entry
+    // for its path whose fingerprint still matches the file.
+    bool LookupPackage(const XXXPackage& package, std::vector<FSBBank>& banks) const;
+    // Every sample with this exact name, across all cataloged packages.
+    std::vector<CatalogHit> FindSample(const std::string& name) const;
+    // Decodes entry i (in path order) completely, e.g. to carry it into a rebuilt catalog.
+    void ReadEntry(size_t i, CatalogEntry& entry) const;
+    // Index of the entry for an absolute path, or -1.
+    int64_t FindPackage(const std::string& absolutePath) const;
+    // Index of the entry for fingerprint.path if it still matches, or -1.
+    int64_t FindCurrent(const CatalogEntry& fingerprint) const;
+
+private:
+    Catalog(const Catalog&);
+    Catalog& operator=(const Catalog&);
+
+    std::string String(uint32_t offset, uint32_t length) const;
+    FSBSample Sample(uint32_t i) const;
+
+    MappedFile file;
+    const CatalogHeader* header;
+    const CatalogPackage* packages;
+    const CatalogBank* banks;
+    const CatalogSample* samples;
+    const CatalogName* names;
+    const char* strings;
+};
+
+// Fills path, size, mtime and hash of a package file without opening it as a package.
+bool FingerprintFile(const std::string& path, CatalogEntry& entry);
+bool WriteCatalog(const std::string& path, std::vector<CatalogEntry>& entries);
+
+// Scans the packages named by inputs (files, folders or patterns) in parallel
+// and merges them into the catalog at catalogPath. Packages whose
+// fingerprint still matches their existing entry are not rescanned.
+void BuildCatalog(const std::vector<std::string>& inputs, const std::string& catalogPath);
+// Prints every cataloged sample with this name and how long the lookup took.
+void LookupCatalogSample(const std::string& name, const std::string& catalogPath);
+
+// Catalog consulted by extraction and patching; opened once by main.
+void SetActiveCatalog(const std::string& path);
+const Catalog* ActiveCatalog();
+
+// Banks of an opened package, found through its exports or, failing that, a
+// scan. Catalogs are built with this, so a package lists the same banks, in
+// the same audio_N order, with or without a catalog.
+std::vector<FSBBank> LocatePackageBanks(const XXXPackage& package);
+// Banks of an opened package, from the active catalog when it is current for
+// the package and from LocatePackageBanks otherwise.
+std::vector<FSBBank> FindPackageBanks(const XXXPackage& package);
+
+#endif
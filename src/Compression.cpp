@@ -0,0 +1,632 @@
+#include "Compression.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const int MAX_BITS = 15;
+const int FAST_BITS = 9;
+
+const uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const uint8_t LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const uint16_t DIST_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const uint8_t DIST_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+const uint8_t CODELEN_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+struct Huffman {
+    uint16_t count[MAX_BITS + 1];
+    uint16_t symbol[288];
+    uint16_t fast[1 << FAST_BITS]; // (symbol << 4) | length, 0 when the code is longer
+};
+
+struct BitReader {
+    const uint8_t* src;
+    size_t size;
+    size_t pos;
+    uint64_t bits;
+    int count;
+    bool overrun;
+
+    void Refill() {
+        while (count <= 56) {
+            uint64_t b = 0;
+            if (pos < size) {
+                b = src[pos];
+            } else if (pos > size + 8) {
+                overrun = true;
+            }
+            pos++;
+            bits |= b << count;
+            count += 8;
+        }
+    }
+
+    uint32_t Peek(int n) {
+        if (count < n) Refill();
+        return (uint32_t)(bits & ((1ull << n) - 1));
+    }
+
+    void Consume(int n) {
+        bits >>= n;
+        count -= n;
+    }
+
+    uint32_t Get(int n) {
+        if (n == 0) return 0;
+        uint32_t v = Peek(n);
+        Consume(n);
+        return v;
+    }
+
+    void AlignToByte() {
+        Consume(count & 7);
+    }
+};
+
+uint32_t ReverseBits(uint32_t code, int len) {
+    uint32_t r = 0;
+    for (int i = 0; i < len; ++i) {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+bool BuildHuffman(Huffman& h, const uint8_t* lengths, int n) {
+    memset(h.count, 0, sizeof(h.count));
+    memset(h.fast, 0, sizeof(h.fast));
+    for (int i = 0; i < n; ++i) h.count[lengths[i]]++;
+    h.count[0] = 0;
+
+    // Reject over-subscribed codes; incomplete ones are legal (e.g. one distance code).
+    int left = 1;
+    for (int len = 1; len <= MAX_BITS; ++len) {
+        left <<= 1;
+        left -= h.count[len];
+        if (left < 0) return false;
+    }
+
+    uint16_t offs[MAX_BITS + 2];
+    uint32_t nextCode[MAX_BITS + 1];
+    offs[1] = 0;
+    for (int len = 1; len <= MAX_BITS; ++len) offs[len + 1] = offs[len] + h.count[len];
+    uint32_t code = 0;
+    nextCode[0] = 0;
+    for (int len = 1; len <= MAX_BITS; ++len) {
+        code = (code + h.count[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+
+    for (int sym = 0; sym < n; ++sym) {
+        int len = lengths[sym];
+        if (len == 0) continue;
+        h.symbol[offs[len]++] = (uint16_t)sym;
+        uint32_t c = nextCode[len]++;
+        if (len <= FAST_BITS) {
+            uint16_t entry = (uint16_t)((sym << 4) | len);
+            for (uint32_t k = ReverseBits(c, len); k < (1u << FAST_BITS); k += (1u << len)) {
+                h.fast[k] = entry;
+            }
+        }
+    }
+    return true;
+}
+
+int DecodeSymbol(BitReader& br, const Huffman& h) {
+    uint32_t peek = br.Peek(MAX_BITS);
+    uint16_t entry = h.fast[peek & ((1 << FAST_BITS) - 1)];
+    if (entry) {
+        br.Consume(entry & 15);
+        return entry >> 4;
+    }
+
+    // Canonical decode one bit at a time for codes longer than FAST_BITS.
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= MAX_BITS; ++len) {
+        code |= (peek >> (len - 1)) & 1;
+        int count = h.count[len];
+        if (code - count < first) {
+            br.Consume(len);
+            return h.symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+bool InflateCodes(BitReader& br, const Huffman& lit, const Huffman& dist, uint8_t* dst, size_t dstSize, size_t& out) {
+    for (;;) {
+        int sym = DecodeSymbol(br, lit);
+        if (sym < 0 || br.overrun) return false;
+        if (sym < 256) {
+            if (out >= dstSize) return false;
+            dst[out++] = (uint8_t)sym;
+        } else if (sym == 256) {
+            return true;
+        } else {
+            sym -= 257;
+            if (sym >= 29) return false;
+            size_t len = LENGTH_BASE[sym] + br.Get(LENGTH_EXTRA[sym]);
+            int dsym = DecodeSymbol(br, dist);
+            if (dsym < 0 || dsym >= 30) return false;
+            size_t d = DIST_BASE[dsym] + br.Get(DIST_EXTRA[dsym]);
+            if (d > out || len > dstSize - out) return false;
+            uint8_t* p = dst + out;
+            const uint8_t* q = p - d;
+            if (d >= len) {
+                memcpy(p, q, len);
+            } else {
+                for (size_t i = 0; i < len; ++i) p[i] = q[i];
+            }
+            out += len;
+        }
+    }
+}
+
+bool BuildFixedTables(Huffman& lit, Huffman& dist) {
+    uint8_t lengths[288];
+    int i = 0;
+    for (; i < 144; ++i) lengths[i] = 8;
+    for (; i < 256; ++i) lengths[i] = 9;
+    for (; i < 280; ++i) lengths[i] = 7;
+    for (; i < 288; ++i) lengths[i] = 8;
+    if (!BuildHuffman(lit, lengths, 288)) return false;
+    for (i = 0; i < 30; ++i) lengths[i] = 5;
+    return BuildHuffman(dist, lengths, 30);
+}
+
+bool BuildDynamicTables(BitReader& br, Huffman& lit, Huffman& dist) {
+    int nlen = br.Get(5) + 257;
+    int ndist = br.Get(5) + 1;
+    int ncode = br.Get(4) + 4;
+    if (nlen > 286 || ndist > 30) return false;
+
+    uint8_t lengths[320];
+    memset(lengths, 0, sizeof(lengths));
+    for (int i = 0; i < ncode; ++i) lengths[CODELEN_ORDER[i]] = (uint8_t)br.Get(3);
+
+    Huffman lencode;
+    if (!BuildHuffman(lencode, lengths, 19)) return false;
+
+    int index = 0;
+    while (index < nlen + ndist) {
+        int sym = DecodeSymbol(br, lencode);
+        if (sym < 0) return false;
+        if (sym < 16) {
+            lengths[index++] = (uint8_t)sym;
+            continue;
+        }
+        uint8_t len = 0;
+        int repeat;
+        if (sym == 16) {
+            if (index == 0) return false;
+            len = lengths[index - 1];
+            repeat = 3 + br.Get(2);
+        } else if (sym == 17) {
+            repeat = 3 + br.Get(3);
+        } else {
+            repeat = 11 + br.Get(7);
+        }
+        if (index + repeat > nlen + ndist) return false;
+        while (repeat--) lengths[index++] = len;
+    }
+
+    if (lengths[256] == 0) return false;
+    if (!BuildHuffman(lit, lengths, nlen)) return false;
+    return BuildHuffman(dist, lengths + nlen, ndist);
+}
+
+} // namespace
+
+bool ZlibInflate(const char* src, size_t srcSize, char* dst, size_t dstSize) {
+    const uint8_t* in = (const uint8_t*)src;
+    if (srcSize < 2) return false;
+    uint8_t cmf = in[0], flg = in[1];
+    if ((cmf & 0x0F) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20)) return false;
+
+    BitReader br;
+    br.src = in + 2;
+    br.size = srcSize - 2;
+    br.pos = 0;
+    br.bits = 0;
+    br.count = 0;
+    br.overrun = false;
+
+    uint8_t* outBuf = (uint8_t*)dst;
+    size_t out = 0;
+    Huffman lit, dist;
+    int last;
+    do {
+        last = br.Get(1);
+        int type = br.Get(2);
+        if (type == 0) {
+            br.AlignToByte();
+            uint32_t len = br.Get(16);
+            uint32_t nlen = br.Get(16);
+            if ((len ^ 0xFFFF) != nlen) return false;
+            // Drain whole bytes still held in the bit buffer before copying from the source.
+            while (len > 0 && br.count >= 8) {
+                if (out >= dstSize) return false;
+                outBuf[out++] = (uint8_t)br.Get(8);
+                len--;
+            }
+            if (br.pos > br.size || len > br.size - br.pos || len > dstSize - out) return false;
+            memcpy(outBuf + out, br.src + br.pos, len);
+            br.pos += len;
+            out += len;
+        } else if (type == 1) {
+            if (!BuildFixedTables(lit, dist)) return false;
+            if (!InflateCodes(br, lit, dist, outBuf, dstSize, out)) return false;
+        } else if (type == 2) {
+            if (!BuildDynamicTables(br, lit, dist)) return false;
+            if (!InflateCodes(br, lit, dist, outBuf, dstSize, out)) return false;
+        } else {
+            return false;
+        }
+        if (br.overrun) return false;
+    } while (!last);
+
+    return out == dstSize;
+}
+
+namespace {
+
+const int WINDOW_SIZE = 32768;
+const int HASH_BITS = 15;
+const int MAX_CHAIN = 128;
+const int MIN_MATCH = 3;
+const int MAX_MATCH = 258;
+
+struct Token {
+    uint16_t litLen; // Literal byte, or match length when dist != 0
+    uint16_t dist;
+};
+
+struct BitWriter {
+    std::vector<char>& out;
+    uint64_t bits;
+    int count;
+
+    explicit BitWriter(std::vector<char>& o) : out(o), bits(0), count(0) {}
+
+    void Put(uint32_t value, int n) {
+        bits |= (uint64_t)value << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back((char)(bits & 0xFF));
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    void Flush() {
+        if (count > 0) out.push_back((char)(bits & 0xFF));
+        bits = 0;
+        count = 0;
+    }
+};
+
+int LengthCode(int len) {
+    int code = 28;
+    while (LENGTH_BASE[code] > len) code--;
+    return code;
+}
+
+int DistCode(int dist) {
+    int code = 29;
+    while (DIST_BASE[code] > dist) code--;
+    return code;
+}
+
+void BuildCodeLengths(const uint32_t* freq, int n, int maxBits, uint8_t* lengths) {
+    std::vector<uint32_t> f(freq, freq + n);
+    int used = 0;
+    for (int i = 0; i < n; ++i) used += f[i] ? 1 : 0;
+    // A single-symbol tree still needs a complete code, so add a dummy leaf.
+    for (int i = 0; used < 2 && i < n; ++i) {
+        if (!f[i]) {
+            f[i] = 1;
+            used++;
+        }
+    }
+
+    for (;;) {
+        // Plain Huffman construction over (weight, node) pairs; n is at most 288.
+        std::vector<uint64_t> heap;
+        std::vector<int> parent(2 * n, -1);
+        for (int i = 0; i < n; ++i) {
+            if (f[i]) heap.push_back(((uint64_t)f[i] << 32) | (uint32_t)i);
+        }
+        std::make_heap(heap.begin(), heap.end(), std::greater<uint64_t>());
+        int next = n;
+        while (heap.size() > 1) {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<uint64_t>());
+            uint64_t a = heap.back();
+            heap.pop_back();
+            std::pop_heap(heap.begin(), heap.end(), std::greater<uint64_t>());
+            uint64_t b = heap.back();
+            heap.pop_back();
+            parent[(uint32_t)a] = next;
+            parent[(uint32_t)b] = next;
+            heap.push_back((((a >> 32) + (b >> 32)) << 32) | (uint32_t)next);
+            std::push_heap(heap.begin(), heap.end(), std::greater<uint64_t>());
+            next++;
+        }
+
+        int maxLen = 0;
+        for (int i = 0; i < n; ++i) {
+            lengths[i] = 0;
+            if (!f[i]) continue;
+            int depth = 0;
+            for (int p = parent[i]; p != -1; p = parent[p]) depth++;
+            lengths[i] = (uint8_t)depth;
+            if (depth > maxLen) maxLen = depth;
+        }
+        if (maxLen <= maxBits) return;
+
+        // Flatten the distribution and retry until the tree fits the bit limit.
+        for (int i = 0; i < n; ++i) {
+            if (f[i]) f[i] = (f[i] >> 1) | 1;
+        }
+    }
+}
+
+void BuildCodes(const uint8_t* lengths, int n, uint16_t* codes) {
+    uint16_t count[MAX_BITS + 1] = { 0 };
+    uint32_t nextCode[MAX_BITS + 1];
+    for (int i = 0; i < n; ++i) count[lengths[i]]++;
+    count[0] = 0;
+    uint32_t code = 0;
+    nextCode[0] = 0;
+    for (int len = 1; len <= MAX_BITS; ++len) {
+        code = (code + count[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+    for (int i = 0; i < n; ++i) {
+        // Huffman codes go out MSB first, the bit writer is LSB first.
+        codes[i] = lengths[i] ? (uint16_t)ReverseBits(nextCode[lengths[i]]++, lengths[i]) : 0;
+    }
+}
+
+void FindMatches(const uint8_t* src, size_t size, std::vector<Token>& tokens) {
+    std::vector<int32_t> head(1 << HASH_BITS, -1);
+    std::vector<int32_t> prev(WINDOW_SIZE, -1);
+    auto hash = [&](size_t i) {
+        uint32_t v = src[i] | (src[i + 1] << 8) | (src[i + 2] << 16);
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    };
+    auto insert = [&](size_t i) {
+        if (i + MIN_MATCH > size) return;
+        uint32_t h = hash(i);
+        prev[i & (WINDOW_SIZE - 1)] = head[h];
+        head[h] = (int32_t)i;
+    };
+    auto longest = [&](size_t i, int& bestDist) {
+        int bestLen = 0;
+        if (i + MIN_MATCH > size) return 0;
+        size_t maxLen = size - i < (size_t)MAX_MATCH ? size - i : (size_t)MAX_MATCH;
+        int32_t cand = head[hash(i)];
+        for (int chain = 0; cand >= 0 && chain < MAX_CHAIN; ++chain) {
+            size_t dist = i - cand;
+            if (dist == 0 || dist > (size_t)WINDOW_SIZE - 1) break;
+            if (src[cand + bestLen] == src[i + bestLen]) {
+                size_t len = 0;
+                while (len < maxLen && src[cand + len] == src[i + len]) len++;
+                if ((int)len > bestLen) {
+                    bestLen = (int)len;
+                    bestDist = (int)dist;
+                    if (len == maxLen) break;
+                }
+            }
+            int32_t p = prev[cand & (WINDOW_SIZE - 1)];
+            if (p >= cand) break;
+            cand = p;
+        }
+        return bestLen >= MIN_MATCH ? bestLen : 0;
+    };
+
+    size_t i = 0;
+    while (i < size) {
+        int dist = 0;
+        int len = longest(i, dist);
+        if (len) {
+            // One step of lazy matching: prefer a longer match starting at the next byte.
+            insert(i);
+            int nextDist = 0;
+            int nextLen = (i + 1 < size) ? longest(i + 1, nextDist) : 0;
+            if (nextLen > len) {
+                Token t = { src[i], 0 };
+                tokens.push_back(t);
+                i++;
+                len = nextLen;
+                dist = nextDist;
+            } else {
+                Token t = { (uint16_t)len, (uint16_t)dist };
+                tokens.push_back(t);
+                for (size_t k = i + 1; k < i + len; ++k) insert(k);
+                i += len;
+                continue;
+            }
+            Token t = { (uint16_t)len, (uint16_t)dist };
+            tokens.push_back(t);
+            for (size_t k = i; k < i + len; ++k) insert(k);
+            i += len;
+        } else {
+            insert(i);
+            Token t = { src[i], 0 };
+            tokens.push_back(t);
+            i++;
+        }
+    }
+}
+
+void WriteDynamicBlock(BitWriter& bw, const std::vector<Token>& tokens) {
+    uint32_t litFreq[286] = { 0 };
+    uint32_t distFreq[30] = { 0 };
+    for (const auto& t : tokens) {
+        if (t.dist) {
+            litFreq[257 + LengthCode(t.litLen)]++;
+            distFreq[DistCode(t.dist)]++;
+        } else {
+            litFreq[t.litLen]++;
+        }
+    }
+    litFreq[256] = 1;
+
+    uint8_t lengths[286 + 30];
+    uint8_t* litLengths = lengths;
+    uint8_t distLengths[30];
+    BuildCodeLengths(litFreq, 286, MAX_BITS, litLengths);
+    BuildCodeLengths(distFreq, 30, MAX_BITS, distLengths);
+
+    int nlen = 286;
+    while (nlen > 257 && litLengths[nlen - 1] == 0) nlen--;
+    int ndist = 30;
+    while (ndist > 1 && distLengths[ndist - 1] == 0) ndist--;
+    memcpy(lengths + nlen, distLengths, ndist);
+
+    // Run-length encode the combined code lengths with symbols 16/17/18.
+    std::vector<uint8_t> clSyms, clExtra;
+    int total = nlen + ndist;
+    for (int i = 0; i < total;) {
+        uint8_t len = lengths[i];
+        int run = 1;
+        while (i + run < total && lengths[i + run] == len) run++;
+        if (len == 0 && run >= 3) {
+            int r = run > 138 ? 138 : run;
+            if (r >= 11) {
+                clSyms.push_back(18);
+                clExtra.push_back((uint8_t)(r - 11));
+            } else {
+                clSyms.push_back(17);
+                clExtra.push_back((uint8_t)(r - 3));
+            }
+            i += r;
+        } else if (len != 0 && run >= 4) {
+            clSyms.push_back(len);
+            clExtra.push_back(0);
+            int r = run - 1 > 6 ? 6 : run - 1;
+            clSyms.push_back(16);
+            clExtra.push_back((uint8_t)(r - 3));
+            i += 1 + r;
+        } else {
+            clSyms.push_back(len);
+            clExtra.push_back(0);
+            i++;
+        }
+    }
+
+    uint32_t clFreq[19] = { 0 };
+    for (uint8_t s : clSyms) clFreq[s]++;
+    uint8_t clLengths[19];
+    BuildCodeLengths(clFreq, 19, 7, clLengths);
+    int ncode = 19;
+    while (ncode > 4 && clLengths[CODELEN_ORDER[ncode - 1]] == 0) ncode--;
+
+    uint16_t litCodes[286], distCodes[30], clCodes[19];
+    BuildCodes(litLengths, nlen, litCodes);
+    BuildCodes(distLengths, ndist, distCodes);
+    BuildCodes(clLengths, 19, clCodes);
+
+    bw.Put(2, 2);
+    bw.Put(nlen - 257, 5);
+    bw.Put(ndist - 1, 5);
+    bw.Put(ncode - 4, 4);
+    for (int i = 0; i < ncode; ++i) bw.Put(clLengths[CODELEN_ORDER[i]], 3);
+    for (size_t i = 0; i < clSyms.size(); ++i) {
+        uint8_t s = clSyms[i];
+        bw.Put(clCodes[s], clLengths[s]);
+        if (s == 16) bw.Put(clExtra[i], 2);
+        else if (s == 17) bw.Put(clExtra[i], 3);
+        else if (s == 18) bw.Put(clExtra[i], 7);
+    }
+
+    for (const auto& t : tokens) {
+        if (t.dist) {
+            int lc = LengthCode(t.litLen);
+            bw.Put(litCodes[257 + lc], litLengths[257 + lc]);
+            bw.Put(t.litLen - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+            int dc = DistCode(t.dist);
+            bw.Put(distCodes[dc], distLengths[dc]);
+            bw.Put(t.dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+        } else {
+            bw.Put(litCodes[t.litLen], litLengths[t.litLen]);
+        }
+    }
+    bw.Put(litCodes[256], litLengths[256]);
+}
+
+uint32_t Adler32(const uint8_t* p, size_t n) {
+    uint32_t a = 1, b = 0;
+    while (n > 0) {
+        size_t chunk = n < 5552 ? n : 5552;
+        n -= chunk;
+        while (chunk--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+} // namespace
+
+bool ZlibDeflate(const char* src, size_t srcSize, std::vector<char>& out) {
+    const uint8_t* in = (const uint8_t*)src;
+    out.clear();
+    out.reserve(srcSize / 2 + 64);
+    out.push_back((char)0x78);
+    out.push_back((char)0xDA);
+
+    std::vector<Token> tokens;
+    tokens.reserve(srcSize);
+    FindMatches(in, srcSize, tokens);
+
+    BitWriter bw(out);
+    bw.Put(1, 1); // Single final block
+    WriteDynamicBlock(bw, tokens);
+    bw.Flush();
+
+    // Incompressible input: fall back to stored blocks.
+    if (out.size() > srcSize + srcSize / 1000 + 16) {
+        out.resize(2);
+        size_t pos = 0;
+        do {
+            size_t len = srcSize - pos > 65535 ? 65535 : srcSize - pos;
+            bool last = pos + len == srcSize;
+            out.push_back((char)(last ? 1 : 0));
+            out.push_back((char)(len & 0xFF));
+            out.push_back((char)(len >> 8));
+            out.push_back((char)(~len & 0xFF));
+            out.push_back((char)((~len >> 8) & 0xFF));
+            out.insert(out.end(), src + pos, src + pos + len);
+            pos += len;
+        } while (pos < srcSize);
+    }
+
+    uint32_t adler = Adler32(in, srcSize);
+    out.push_back((char)(adler >> 24));
+    out.push_back((char)(adler >> 16));
+    out.push_back((char)(adler >> 8));
+    out.push_back((char)adler);
+    return true;
+}
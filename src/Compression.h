@@ -0,0 +1,12 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "Utils.h"
+
+// Self-contained zlib (RFC 1950/1951) support for UE3 compressed package blocks.
+// Inflates exactly dstSize bytes; returns false on corrupt or short input.
+bool ZlibInflate(const char* src, size_t srcSize, char* dst, size_t dstSize);
+// Compresses src as a single zlib stream (dynamic Huffman, stored if incompressible).
+bool ZlibDeflate(const char* src, size_t srcSize, std::vector<char>& out);
+
+#endif
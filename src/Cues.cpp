@@ -0,0 +1,335 @@
+#include "Cues.h"
+#include "Catalog.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+
+namespace {
+
+// Inline bulk data starts with flags, element count, size on disk and the
+// absolute offset of the payload, which follows the header directly. Between
+// two payloads of an export there are only a few properties and strings.
+const size_t BULK_HEADER_WINDOW = 4096;
+
+// Longest sample name an FSB4 header keeps.
+const size_t FSB4_NAME_CHARS = sizeof(((FSB4_SAMPLE_HEADER*)0)->name) - 1;
+
+struct BulkPayload {
+    uint32_t exportIndex;
+    size_t offset;
+    size_t size;
+};
+
+void FindBulkPayloads(const XXXPackage& package, const PackageExport& e, uint32_t exportIndex, std::vector<BulkPayload>& payloads) {
+    const char* data = package.Data();
+    size_t end = (size_t)e.serialOffset + e.serialSize;
+    if (e.serialSize < 16 || end > package.Size()) return;
+
+    size_t pos = e.serialOffset;
+    while (pos + 16 <= end) {
+        size_t last = std::min(end - 16, pos + BULK_HEADER_WINDOW);
+        size_t header = pos;
+        while (header <= last && (ReadBE32(data + header + 12) != header + 16 || ReadBE32(data + header + 8) > end - header - 16)) ++header;
+        if (header > last) break;
+        BulkPayload payload = { exportIndex, header + 16, ReadBE32(data + header + 8) };
+        payloads.push_back(payload);
+        pos = payload.offset + payload.size;
+    }
+}
+
+std::vector<BulkPayload> FindAllBulkPayloads(const XXXPackage& package, const std::vector<PackageExport>& exports) {
+    std::vector<BulkPayload> payloads;
+    for (size_t i = 0; i < exports.size(); ++i) FindBulkPayloads(package, exports[i], (uint32_t)i, payloads);
+    return payloads;
+}
+
+bool HasMagic(const XXXPackage& package, const BulkPayload& payload, const char* magic, size_t length) {
+    return payload.size >= length && memcmp(package.Data() + payload.offset, magic, length) == 0;
+}
+
+bool IsBankPayload(const XXXPackage& package, const BulkPayload& payload) {
+    return HasMagic(package, payload, "FSB4", 4) || HasMagic(package, payload, "FSB5", 4);
+}
+
+// Position and size of the value of a tagged property of an export. Tags are
+// name, type, size and array index; struct values are preceded by the
+// struct name and bool values are a single byte outside the size.
+bool FindProperty(const XXXPackage& package, PackageTables& tables, const PackageExport& e, const std::string& name, size_t& valuePos, uint32_t& valueSize) {
+    const char* data = package.Data();
+    size_t end = (size_t)e.serialOffset + e.serialSize;
+    if (end > package.Size()) return false;
+
+    size_t pos = e.serialOffset;
+    while (pos + 24 <= end) {
+        std::string property = tables.Name((int32_t)ReadBE32(data + pos));
+        if (property.empty() || property == "None") return false;
+        std::string type = tables.Name((int32_t)ReadBE32(data + pos + 8));
+        uint32_t size = ReadBE32(data + pos + 16);
+        pos += 24;
+        if (type == "StructProperty") pos += 8;
+        if (type == "BoolProperty") size = 1;
+        if (pos > end || size > end - pos) return false;
+        if (property == name) {
+            valuePos = pos;
+            valueSize = size;
+            return true;
+        }
+        pos += size;
+    }
+    return false;
+}
+
+// Object reference held by an ObjectProperty, 0 if the export has none.
+int32_t ObjectProperty(const XXXPackage& package, PackageTables& tables, const PackageExport& e, const std::string& name) {
+    size_t pos;
+    uint32_t size;
+    if (!FindProperty(package, tables, e, name, pos, size) || size != 4) return 0;
+    return (int32_t)ReadBE32(package.Data() + pos);
+}
+
+// Length-prefixed, NUL-terminated string of an FEV project; pos is the
+// offset of the little-endian length within the project.
+struct FEVString {
+    size_t pos;
+    std::string text;
+};
+
+// The parts of an FMOD Designer project a cue needs: every string, and the
+// wave files of each sound definition in index order.
+struct FEVProject {
+    const char* data;
+    std::vector<FEVString> strings;
+    std::vector<std::vector<std::string> > soundDefFiles;
+};
+
+bool IsAudioFileName(const std::string& s) {
+    static const char* const extensions[] = { ".wav", ".aif", ".aiff", ".ogg", ".mp2", ".mp3" };
+    for (const char* ext : extensions) {
+        size_t n = strlen(ext);
+        if (s.size() <= n) continue;
+        bool match = true;
+        for (size_t i = 0; match && i < n; ++i) match = tolower((unsigned char)s[s.size() - n + i]) == ext[i];
+        if (match) return true;
+    }
+    return false;
+}
+
+// Picks the strings out of the binary records instead of decoding every
+// record type; the strings keep their order, which is all that is needed.
+void ReadFEVProject(const char* fev, size_t size, FEVProject& project) {
+    project.data = fev;
+    size_t pos = 0;
+    while (pos + 4 < size) {
+        uint32_t length = ReadLE32(fev + pos);
+        bool isString = length >= 2 && length <= 256 && length <= size - pos - 4 && fev[pos + 4 + length - 1] == 0;
+        for (uint32_t i = 0; isString && i + 1 < length; ++i) isString = fev[pos + 4 + i] >= 0x20 && fev[pos + 4 + i] < 0x7F;
+        if (!isString) {
+            pos++;
+            continue;
+        }
+        FEVString s = { pos, std::string(fev + pos + 4, length - 1) };
+        project.strings.push_back(s);
+        pos += 4 + length;
+    }
+
+    // A sound definition is "/name" followed by a file and bank name per wave
+    for (const auto& s : project.strings) {
+        if (s.text[0] == '/') {
+            project.soundDefFiles.push_back(std::vector<std::string>());
+        } else if (!project.soundDefFiles.empty() && IsAudioFileName(s.text)) {
+            size_t slash = s.text.find_last_of("/\\");
+            project.soundDefFiles.back().push_back(slash == std::string::npos ? s.text : s.text.substr(slash + 1));
+        }
+    }
+}
+
+// Sound definitions an event plays. An event record runs from its name to its
+// category name. Multi-layer events hold one 16-bit index per layer sound,
+// after an ff ff 00 00 01 00 marker and one more field; simple events hold
+// a single 32-bit index 62 bytes before the end of the record.
+std::vector<uint32_t> EventSoundDefs(const FEVProject& project, const std::string& event) {
+    static const char LAYER_SOUND[6] = { '\xFF', '\xFF', 0, 0, 1, 0 };
+    std::vector<uint32_t> defs;
+    for (size_t i = 0; i + 1 < project.strings.size(); ++i) {
+        const FEVString& s = project.strings[i];
+        if (s.text != event) continue;
+        size_t begin = s.pos + 4 + s.text.size() + 1;
+        size_t end = project.strings[i + 1].pos;
+        if (end < begin + 64) continue;
+
+        const char* record = project.data + begin;
+        size_t size = end - begin;
+        for (size_t p = 0; p + 10 <= size; ++p) {
+            if (memcmp(record + p, LAYER_SOUND, sizeof(LAYER_SOUND)) == 0) defs.push_back(ReadLE16(record + p + 8));
+        }
+        if (defs.empty()) defs.push_back(ReadLE32(record + size - 62));
+        defs.erase(std::remove_if(defs.begin(), defs.end(), [&project](uint32_t d) { return d >= project.soundDefFiles.size(); }), defs.end());
+        break;
+    }
+    return defs;
+}
+
+bool SampleNameMatches(const std::string& sample, const std::string& file) {
+    return sample == file || (sample.size() == FSB4_NAME_CHARS && file.compare(0, FSB4_NAME_CHARS, sample) == 0);
+}
+
+// Samples of bank named by files, in the order of files.
+std::vector<uint32_t> MatchSamples(const FSBBank& bank, const std::vector<std::string>& files) {
+    std::vector<uint32_t> samples;
+    for (const auto& file : files) {
+        for (size_t i = 0; i < bank.index.samples.size(); ++i) {
+            if (!SampleNameMatches(bank.index.samples[i].name, file)) continue;
+            if (std::find(samples.begin(), samples.end(), (uint32_t)i) == samples.end()) samples.push_back((uint32_t)i);
+            break;
+        }
+    }
+    return samples;
+}
+
+} // namespace
+
+bool LocateExportBanks(const XXXPackage& package, PackageTables& tables, std::vector<FSBBank>& banks) {
+    banks.clear();
+    const std::vector<PackageExport>* exports = tables.Exports();
+    if (!exports) return false;
+
+    for (const auto& payload : FindAllBulkPayloads(package, *exports)) {
+        if (!IsBankPayload(package, payload)) continue;
+        FSBBank bank;
+        bank.info = ReadFSBBankInfo(package.Data(), package.Size(), payload.offset);
+        bank.parsed = bank.info.headerComplete &&
+                      ParseFSBIndex(package.Data() + payload.offset, package.Size() - payload.offset, bank.index);
+        banks.push_back(bank);
+    }
+    std::sort(banks.begin(), banks.end(), [](const FSBBank& a, const FSBBank& b) { return a.info.offset < b.info.offset; });
+    return !banks.empty();
+}
+
+void MapPackageCues(const XXXPackage& package, PackageTables& tables, const std::vector<FSBBank>& banks, std::vector<PackageCue>& cues) {
+    cues.clear();
+    const std::vector<PackageExport>* exports = tables.Exports();
+    if (!exports) return;
+
+    // Banks and FEV projects by the export holding them
+    std::map<uint32_t, std::vector<int> > exportBanks;
+    std::map<uint32_t, BulkPayload> exportProjects;
+    for (const auto& payload : FindAllBulkPayloads(package, *exports)) {
+        if (HasMagic(package, payload, "FEV1", 4)) {
+            exportProjects.insert(std::make_pair(payload.exportIndex, payload));
+            continue;
+        }
+        for (size_t b = 0; b < banks.size(); ++b) {
+            if (banks[b].info.offset == payload.offset) exportBanks[payload.exportIndex].push_back((int)b);
+        }
+    }
+
+    std::map<uint32_t, FEVProject> projects;
+    for (uint32_t i = 0; i < exports->size(); ++i) {
+        const PackageExport& e = (*exports)[i];
+        PackageCue cue;
+        cue.name = tables.Name(e.nameIndex, e.nameNumber);
+        cue.className = tables.ClassName(e);
+        cue.exportIndex = i;
+        cue.bankIndex = -1;
+
+        if (cue.className == "SoundNodeWave") {
+            auto held = exportBanks.find(i);
+            if (held != exportBanks.end()) {
+                cue.bankIndex = held->second.front();
+                for (uint32_t s = 0; s < banks[cue.bankIndex].index.samples.size(); ++s) cue.samples.push_back(s);
+            }
+            cues.push_back(cue);
+            continue;
+        }
+        if (cue.className != "FmodEvent") continue;
+
+        // The event's Owner is its FmodDesignerProject, whose PS3Data is the
+        // FmodEventFile holding both the FEV project and the bank.
+        int64_t file = -1;
+        int32_t owner = ObjectProperty(package, tables, e, "Owner");
+        if (owner > 0 && (size_t)owner <= exports->size()) {
+            int32_t data = ObjectProperty(package, tables, (*exports)[owner - 1], "PS3Data");
+            if (data > 0) file = data - 1;
+        }
+        if (!exportBanks.count((uint32_t)file) || !exportProjects.count((uint32_t)file)) {
+            file = -1;
+            for (const auto& held : exportBanks) {
+                if (exportProjects.count(held.first)) {
+                    file = held.first;
+                    break;
+                }
+            }
+        }
+        if (file < 0) {
+            cues.push_back(cue);
+            continue;
+        }
+
+        auto project = projects.find((uint32_t)file);
+        if (project == projects.end()) {
+            const BulkPayload& fev = exportProjects[(uint32_t)file];
+            project = projects.insert(std::make_pair((uint32_t)file, FEVProject())).first;
+            ReadFEVProject(package.Data() + fev.offset, fev.size, project->second);
+        }
+        std::vector<std::string> files;
+        for (uint32_t def : EventSoundDefs(project->second, cue.name)) {
+            const std::vector<std::string>& defFiles = project->second.soundDefFiles[def];
+            files.insert(files.end(), defFiles.begin(), defFiles.end());
+        }
+
+        const std::vector<int>& fileBanks = exportBanks[(uint32_t)file];
+        cue.bankIndex = fileBanks.front();
+        for (int b : fileBanks) {
+            if (!banks[b].parsed) continue;
+            std::vector<uint32_t> samples = MatchSamples(banks[b], files);
+            if (samples.empty()) continue;
+            cue.bankIndex = b;
+            cue.samples.swap(samples);
+            break;
+        }
+        cues.push_back(cue);
+    }
+}
+
+const PackageCue* FindCue(const std::vector<PackageCue>& cues, const std::string& name) {
+    for (const auto& cue : cues) {
+        if (cue.name == name) return &cue;
+    }
+    return nullptr;
+}
+
+void ListXXXCues(const std::string& path) {
+    XXXPackage package;
+    if (!package.Open(path)) {
+        std::cout << "Failed to open " << path << std::endl;
+        return;
+    }
+    PackageTables tables(package);
+    if (!tables.Exports()) {
+        std::cout << "No readable export table in " << path << std::endl;
+        return;
+    }
+
+    std::vector<FSBBank> banks = FindPackageBanks(package);
+    std::vector<PackageCue> cues;
+    MapPackageCues(package, tables, banks, cues);
+
+    std::cout << path << ": " << cues.size() << " cue(s), " << tables.Exports()->size() << " export(s), " << banks.size() << " bank(s)" << std::endl;
+    for (const auto& cue : cues) {
+        std::cout << "  " << cue.name << " (" << cue.className << ")";
+        if (cue.bankIndex < 0) {
+            std::cout << " no bank" << std::endl;
+            continue;
+        }
+        const FSBBank& bank = banks[cue.bankIndex];
+        std::cout << " bank " << cue.bankIndex << " at 0x" << std::hex << bank.info.offset << std::dec;
+        if (cue.samples.empty()) {
+            std::cout << ", samples not resolved" << std::endl;
+            continue;
+        }
+        std::cout << ":";
+        for (size_t i = 0; i < cue.samples.size(); ++i) std::cout << (i ? ", " : " ") << bank.index.samples[cue.samples[i]].name;
+        std::cout << std::endl;
+    }
+}
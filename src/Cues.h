@@ -0,0 +1,33 @@
+#ifndef CUES_H
+#define CUES_H
+
+#include "Package.h"
+#include "Scanner.h"
+
+// A sound object of a package and the bank samples it plays. MK9 cues are
+// FmodEvent exports whose samples are named by the FMOD project (FEV) stored
+// next to the bank; plain UE3 SoundNodeWave exports hold their bank themselves.
+struct PackageCue {
+    std::string name;
+    std::string className;
+    uint32_t exportIndex;
+    int bankIndex;                 // Into the package's bank list, -1 if not located
+    std::vector<uint32_t> samples; // Into that bank's sample table
+};
+
+// Banks stored as inline bulk data of the package's exports, located through
+// the export table instead of a scan of the whole package. False (and no
+// banks) if the tables are unreadable or no export holds a bank.
+bool LocateExportBanks(const XXXPackage& package, PackageTables& tables, std::vector<FSBBank>& banks);
+
+// Maps every cue of the package to its bank and samples. banks is the bank
+// list of the package, as returned by FindPackageBanks.
+void MapPackageCues(const XXXPackage& package, PackageTables& tables, const std::vector<FSBBank>& banks, std::vector<PackageCue>& cues);
+
+// Cue with this name (case-sensitive), or null.
+const PackageCue* FindCue(const std::vector<PackageCue>& cues, const std::string& name);
+
+// Prints every cue of a package with its bank offset and sample names.
+void ListXXXCues(const std::string& path);
+
+#endif
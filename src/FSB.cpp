@@ -1,153 +1,477 @@
 #include "FSB.h"
+#include "Store.h"
+#include "Hash.h"
+#include "Incremental.h"
+#include "Stats.h"
+#include "Wav.h"
 #include <cstring>
 #include <algorithm>
+#include <unordered_map>
 
-std::string GetFormatString(uint32_t mode) {
-    if (mode & 0x00000008) return "PCM8";
-    if (mode & 0x00000010) return "PCM16";
-    if (mode & 0x00000020) return "PCM24";
-    if (mode & 0x00000040) return "PCM32";
-    if (mode & 0x00000080) return "PCMFLOAT";
-    if (mode & 0x00000100) return "GCADPCM";
-    if (mode & 0x00000200) return "IMAADPCM";
-    if (mode & 0x00000400) return "VAG";
-    if (mode & 0x00000800) return "HEVAG";
-    if (mode & 0x00001000) return "XMA";
-    if (mode & 0x00002000) return "MPEG";
-    if (mode & 0x00004000) return "CELT";
-    if (mode & 0x00008000) return "AT9";
-    if (mode & 0x00010000) return "XWMA";
-    if (mode & 0x00020000) return "VORBIS";
-    return "UNKNOWN";
+uint32_t CodecFromFSB4Mode(uint32_t mode) {
+    if (mode & (0x10000000 | 0x00040000 | 0x00000200)) return FSB_CODEC_MPEG; // MPEG layer 3/2
+    if (mode & 0x00800000) return FSB_CODEC_VAG;
+    if (mode & 0x01000000) return FSB_CODEC_XMA;
+    if (mode & 0x02000000) return FSB_CODEC_GCADPCM;
+    if (mode & 0x00400000) return FSB_CODEC_IMAADPCM;
+    if (mode & 0x08000000) return FSB_CODEC_CELT;
+    if (mode & 0x00000008) return FSB_CODEC_PCM8;
+    if (mode & 0x00200000) return FSB_CODEC_PCM32;
+    return FSB_CODEC_PCM16;
 }
 
-std::vector<FSBSample> ParseFSB(const std::string& fsbPath, uint32_t baseOffset, uint32_t displayOffset) {
-    std::vector<FSBSample> samples;
-    std::ifstream f(fsbPath, std::ios::binary);
-    if (!f.is_open()) return samples;
-
-    f.seekg(baseOffset);
-
-    FSB4_HEADER header;
-    f.read((char*)&header, sizeof(header));
-    if (strncmp(header.magic, "FSB4", 4) != 0) {
-        if (strncmp(header.magic, "FSB5", 4) == 0) {
-            std::cout << "FSB5 detected in " << fsbPath << ". FSB5 parsing is not fully implemented yet." << std::endl;
-        }
-        return samples;
+std::string GetFormatString(uint32_t codec) {
+    switch (codec) {
+    case FSB_CODEC_PCM8: return "PCM8";
+    case FSB_CODEC_PCM16: return "PCM16";
+    case FSB_CODEC_PCM24: return "PCM24";
+    case FSB_CODEC_PCM32: return "PCM32";
+    case FSB_CODEC_PCMFLOAT: return "PCMFLOAT";
+    case FSB_CODEC_GCADPCM: return "GCADPCM";
+    case FSB_CODEC_IMAADPCM: return "IMAADPCM";
+    case FSB_CODEC_VAG: return "VAG";
+    case FSB_CODEC_HEVAG: return "HEVAG";
+    case FSB_CODEC_XMA: return "XMA";
+    case FSB_CODEC_MPEG: return "MPEG";
+    case FSB_CODEC_CELT: return "CELT";
+    case FSB_CODEC_AT9: return "AT9";
+    case FSB_CODEC_XWMA: return "XWMA";
+    case FSB_CODEC_VORBIS: return "VORBIS";
     }
+    return "UNKNOWN";
+}
+
+static bool ParseFSB4Index(const char* data, size_t size, FSBIndex& index) {
+    if (size < sizeof(FSB4_HEADER)) return false;
+    memcpy(&index.header, data, sizeof(FSB4_HEADER));
+    index.version = '4';
+    index.headerRegionSize = (uint32_t)sizeof(FSB4_HEADER) + LE32(index.header.shdr_size);
+    index.dataSize = LE32(index.header.data_size);
 
     // FSB4 headers are Little-Endian in MK9 PS3
-    uint32_t numSamples = LE32(header.numsamples);
-    uint32_t shdrSize = LE32(header.shdr_size);
-    uint32_t dataSize = LE32(header.data_size);
+    uint32_t numSamples = LE32(index.header.numsamples);
+    uint32_t flags = LE32(index.header.flags);
+    size_t regionEnd = index.HeaderRegionSize();
+    if (regionEnd > size) regionEnd = size;
 
     uint32_t currentSampleHeaderOffset = sizeof(FSB4_HEADER);
-    uint32_t dataOffsetBase = sizeof(FSB4_HEADER) + shdrSize;
+    uint32_t dataOffsetBase = index.HeaderRegionSize();
     uint32_t currentDataOffset = 0;
 
+    // A false signature can claim any count; reserve no more than fits.
+    index.samples.reserve(std::min<size_t>(numSamples, regionEnd / sizeof(FSB4_BASIC_SAMPLE_HEADER)));
+    FSB4_SAMPLE_HEADER sh;
     for (uint32_t i = 0; i < numSamples; ++i) {
-        f.seekg(baseOffset + currentSampleHeaderOffset);
-        uint16_t sampleHeaderSize;
-        f.read((char*)&sampleHeaderSize, 2);
-        sampleHeaderSize = LE16(sampleHeaderSize);
-
-        char name[31];
-        memset(name, 0, 31);
-        f.read(name, 30);
-
-        // This is a simplified parser. 
-        // We need to find the size and offset of the audio data for this sample.
-        // In some FSB4, it's in the sample header.
-        
-        // FSB4_SAMPLE_HEADER: 
-        // 0: size(2), 2: name(30), 32: numsamples(4), 36: compressedsize(4), 40: uncompressedsize(4), 
-        // 44: loopstart(4), 48: loopend(4), 52: mode(4), 56: def_freq(4), 60: def_vol(2), 
-        // 62: def_pan(2), 64: def_pri(2), 66: num_channels(2)
-        
-        f.seekg(baseOffset + currentSampleHeaderOffset + 32);
-        uint32_t numSamples;
-        f.read((char*)&numSamples, 4);
-        numSamples = LE32(numSamples);
-
-        uint32_t compressedSize;
-        f.read((char*)&compressedSize, 4);
-        compressedSize = LE32(compressedSize);
-
-        uint32_t uncompressedSize;
-        f.read((char*)&uncompressedSize, 4);
-        uncompressedSize = LE32(uncompressedSize);
-
-        uint32_t loopStart, loopEnd, mode;
-        f.read((char*)&loopStart, 4);
-        f.read((char*)&loopEnd, 4);
-        f.read((char*)&mode, 4);
-        loopStart = LE32(loopStart);
-        loopEnd = LE32(loopEnd);
-        mode = LE32(mode);
-
-        int32_t frequency;
-        f.read((char*)&frequency, 4);
-        frequency = (int32_t)LE32((uint32_t)frequency);
-
-        f.seekg(baseOffset + currentSampleHeaderOffset + 66);
-        uint16_t channels;
-        f.read((char*)&channels, 2);
-        channels = LE16(channels);
-
-        // Heuristic: Use the larger of compressed and uncompressed size for data offset calculation.
-        uint32_t actualDataSize = (compressedSize > uncompressedSize) ? compressedSize : uncompressedSize;
+        const char* p = data + currentSampleHeaderOffset;
+        uint32_t sampleHeaderSize;
+
+        if (i > 0 && (flags & FSB4_FLAG_BASICHEADERS)) {
+            // Basic headers only carry lengths, the rest is inherited from the first sample.
+            if (currentSampleHeaderOffset + sizeof(FSB4_BASIC_SAMPLE_HEADER) > regionEnd) break;
+            FSB4_BASIC_SAMPLE_HEADER basic;
+            memcpy(&basic, p, sizeof(basic));
+            sh.lengthsamples = basic.lengthsamples;
+            sh.lengthcompressedbytes = basic.lengthcompressedbytes;
+            memset(sh.name, 0, sizeof(sh.name));
+            sampleHeaderSize = sizeof(FSB4_BASIC_SAMPLE_HEADER);
+        } else {
+            if (currentSampleHeaderOffset + sizeof(FSB4_SAMPLE_HEADER) > regionEnd) break;
+            memcpy(&sh, p, sizeof(sh));
+            sampleHeaderSize = LE16(sh.size);
+            if (sampleHeaderSize < sizeof(FSB4_SAMPLE_HEADER)) break;
+        }
+
+        uint32_t dataSize = LE32(sh.lengthcompressedbytes);
 
         FSBSample s;
-        s.name = name;
+        s.name.assign(sh.name, strnlen(sh.name, sizeof(sh.name)));
+        if (s.name.empty()) s.name = std::to_string(i);
         s.offset = dataOffsetBase + currentDataOffset;
-        s.size = actualDataSize;
+        s.size = dataSize;
         s.headerOffset = currentSampleHeaderOffset;
         s.headerSize = sampleHeaderSize;
-        s.numSamples = numSamples;
-        s.uncompressedSize = uncompressedSize;
-        s.loopStart = loopStart;
-        s.loopEnd = loopEnd;
-        s.mode = mode;
-        s.frequency = frequency;
-        s.channels = channels;
-        samples.push_back(s);
-
-        uint32_t finalDisplayOffset = (displayOffset > 0) ? displayOffset : baseOffset;
-
-        std::cout << "  [Sample " << i << "] " << s.name << " | Format: " << GetFormatString(mode) 
-                  << " | Channels: " << channels << " | Freq: " << frequency << "Hz"
-                  << " | Offset: 0x" << std::hex << (finalDisplayOffset + s.offset) 
-                  << " | Size: " << std::dec << s.size << " bytes | End: 0x" << std::hex << (finalDisplayOffset + s.offset + s.size) << std::dec << std::endl;
-
-        currentDataOffset += Align(actualDataSize, 32);
+        s.numSamples = LE32(sh.lengthsamples);
+        s.loopStart = LE32(sh.loopstart);
+        s.loopEnd = LE32(sh.loopend);
+        s.mode = LE32(sh.mode);
+        s.codec = CodecFromFSB4Mode(s.mode);
+        s.frequency = (int32_t)LE32((uint32_t)sh.deffreq);
+        s.channels = LE16(sh.numchannels);
+        index.samples.push_back(s);
+
+        currentDataOffset += Align(dataSize, 32);
         currentSampleHeaderOffset += sampleHeaderSize;
     }
 
-    return samples;
+    return true;
+}
+
+static int32_t FSB5Frequency(uint32_t code) {
+    static const int32_t rates[] = { 4000, 8000, 11000, 11025, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+    return code < sizeof(rates) / sizeof(rates[0]) ? rates[code] : 44100;
+}
+
+static uint16_t FSB5Channels(uint32_t code) {
+    static const uint16_t channels[] = { 1, 2, 6, 8 };
+    return channels[code & 3];
+}
+
+static uint32_t Bits(uint64_t value, unsigned start, unsigned count) {
+    return (uint32_t)((value >> start) & ((1ull << count) - 1));
+}
+
+static bool ParseFSB5Index(const char* data, size_t size, FSBIndex& index) {
+    if (size < FSB5_HEADER_SIZE_V1) return false;
+    FSB5_HEADER header;
+    memcpy(&header, data, sizeof(header));
+    uint32_t baseSize = LE32(header.version) == 0 ? FSB5_HEADER_SIZE_V0 : FSB5_HEADER_SIZE_V1;
+    uint32_t numSamples = LE32(header.numsamples);
+    uint32_t shdrSize = LE32(header.shdr_size);
+    uint32_t nameSize = LE32(header.name_size);
+    uint32_t codec = LE32(header.mode);
+    if (size < baseSize) return false;
+
+    index.version = '5';
+    index.headerRegionSize = baseSize + shdrSize + nameSize;
+    index.dataSize = LE32(header.data_size);
+    size_t shdrEnd = (size_t)baseSize + shdrSize;
+    if (shdrEnd > size) shdrEnd = size;
+    size_t nameStart = (size_t)baseSize + shdrSize;
+    size_t nameEnd = nameStart + nameSize;
+    if (nameEnd > size) nameEnd = size;
+
+    std::vector<uint32_t> dataOffsets;
+    size_t fits = std::min<size_t>(numSamples, (shdrEnd - baseSize) / 8);
+    index.samples.reserve(fits);
+    dataOffsets.reserve(fits);
+    size_t pos = baseSize;
+    for (uint32_t i = 0; i < numSamples; ++i) {
+        if (pos + 8 > shdrEnd) break;
+        uint64_t packed = (uint64_t)ReadLE32(data + pos) | ((uint64_t)ReadLE32(data + pos + 4) << 32);
+
+        FSBSample s;
+        s.headerOffset = (uint32_t)pos;
+        s.frequency = FSB5Frequency(Bits(packed, 1, 4));
+        s.channels = FSB5Channels(Bits(packed, 5, 2));
+        dataOffsets.push_back(Bits(packed, 7, 27) * 32);
+        s.numSamples = Bits(packed, 34, 30);
+        s.loopStart = 0;
+        s.loopEnd = 0;
+        s.mode = codec;
+        s.codec = codec;
+        pos += 8;
+
+        // Extra chunks override the packed defaults
+        bool more = Bits(packed, 0, 1) != 0;
+        while (more && pos + 4 <= shdrEnd) {
+            uint32_t chunk = ReadLE32(data + pos);
+            more = (chunk & 1) != 0;
+            uint32_t chunkSize = Bits(chunk, 1, 24);
+            uint32_t chunkType = Bits(chunk, 25, 7);
+            const char* p = data + pos + 4;
+            pos += 4;
+            if (pos + chunkSize > shdrEnd) break;
+            if (chunkType == FSB5_CHUNK_CHANNELS && chunkSize >= 1) {
+                s.channels = (uint8_t)p[0];
+            } else if (chunkType == FSB5_CHUNK_FREQUENCY && chunkSize >= 4) {
+                s.frequency = (int32_t)ReadLE32(p);
+            } else if (chunkType == FSB5_CHUNK_LOOP && chunkSize >= 8) {
+                s.loopStart = ReadLE32(p);
+                s.loopEnd = ReadLE32(p + 4);
+            }
+            pos += chunkSize;
+        }
+        s.headerSize = (uint32_t)pos - s.headerOffset;
+
+        // Names are NUL-terminated strings addressed by an offset table
+        if (nameSize > 0 && nameStart + (i + 1) * 4 <= nameEnd) {
+            size_t nameOffset = nameStart + ReadLE32(data + nameStart + i * 4);
+            if (nameOffset < nameEnd) s.name.assign(data + nameOffset, strnlen(data + nameOffset, nameEnd - nameOffset));
+        }
+        if (s.name.empty()) s.name = std::to_string(i);
+        index.samples.push_back(s);
+    }
+
+    // A sample runs up to the next sample's data (or the end of the data region).
+    for (size_t i = 0; i < index.samples.size(); ++i) {
+        uint32_t start = dataOffsets[i];
+        uint32_t end = i + 1 < dataOffsets.size() ? dataOffsets[i + 1] : index.dataSize;
+        index.samples[i].offset = index.headerRegionSize + start;
+        index.samples[i].size = end > start ? end - start : 0;
+    }
+    return true;
+}
+
+bool ParseFSBIndex(const char* data, size_t size, FSBIndex& index) {
+    ScopedPhase phase("sample parse");
+    index.samples.clear();
+    index.version = 0;
+    index.headerRegionSize = 0;
+    index.dataSize = 0;
+    memset(&index.header, 0, sizeof(FSB4_HEADER));
+    if (size < 4) return false;
+    if (memcmp(data, "FSB4", 4) == 0) return ParseFSB4Index(data, size, index);
+    if (memcmp(data, "FSB5", 4) == 0) return ParseFSB5Index(data, size, index);
+    return false;
 }
 
-void ExtractFSB(const std::string& fsbPath) {
-    auto samples = ParseFSB(fsbPath);
-    if (samples.empty()) {
-        std::cout << "No samples found or invalid FSB: " << fsbPath << std::endl;
+uint32_t FSBHeaderRegionSize(const char* data, size_t size) {
+    if (size >= sizeof(FSB4_HEADER) && memcmp(data, "FSB4", 4) == 0) {
+        return (uint32_t)sizeof(FSB4_HEADER) + ReadLE32(data + 8);
+    }
+    if (size >= FSB5_HEADER_SIZE_V1 && memcmp(data, "FSB5", 4) == 0) {
+        uint32_t baseSize = ReadLE32(data + 4) == 0 ? FSB5_HEADER_SIZE_V0 : FSB5_HEADER_SIZE_V1;
+        return baseSize + ReadLE32(data + 12) + ReadLE32(data + 16);
+    }
+    return 0;
+}
+
+bool ReadFSBIndex(const std::string& fsbPath, uint32_t baseOffset, FSBIndex& index) {
+    std::ifstream f(fsbPath, std::ios::binary);
+    if (!f.is_open()) return false;
+    CountOpen();
+    f.seekg(0, std::ios::end);
+    size_t fileSize = (size_t)f.tellg();
+    if (baseOffset >= fileSize) return false;
+
+    // One read normally covers the whole sample header region; only banks
+    // with very large tables need a second read for the remainder.
+    size_t available = fileSize - baseOffset;
+    std::vector<char> buf(available < (64u << 10) ? available : (64u << 10));
+    f.seekg(baseOffset);
+    f.read(buf.data(), buf.size());
+    CountSeek();
+    CountRead(buf.size());
+    size_t regionSize = FSBHeaderRegionSize(buf.data(), buf.size());
+    if (regionSize > available) regionSize = available;
+    if (regionSize > buf.size()) {
+        size_t have = buf.size();
+        buf.resize(regionSize);
+        f.read(buf.data() + have, regionSize - have);
+        CountRead(regionSize - have);
+    }
+    return ParseFSBIndex(buf.data(), buf.size(), index);
+}
+
+void ReportFSBSamples(const FSBIndex& index, uint32_t displayOffset, std::ostream& log) {
+    ScopedPhase phase("log");
+    for (size_t i = 0; i < index.samples.size(); ++i) {
+        const FSBSample& s = index.samples[i];
+        log << "  [Sample " << i << "] " << s.name << " | Format: " << GetFormatString(s.codec)
+                  << " | Channels: " << s.channels << " | Freq: " << s.frequency << "Hz"
+                  << " | Offset: 0x" << std::hex << (displayOffset + s.offset)
+                  << " | Size: " << std::dec << s.size << " bytes | End: 0x" << std::hex << (displayOffset + s.offset + s.size) << std::dec << std::endl;
+    }
+}
+
+std::vector<FSBSample> ParseFSB(const std::string& fsbPath, uint32_t baseOffset, uint32_t displayOffset, std::ostream& log) {
+    FSBIndex index;
+    if (!ReadFSBIndex(fsbPath, baseOffset, index)) return std::vector<FSBSample>();
+
+    uint32_t finalDisplayOffset = (displayOffset > 0) ? displayOffset : baseOffset;
+    ReportFSBSamples(index, finalDisplayOffset, log);
+    return index.samples;
+}
+
+void ExtractFSB(const std::string& fsbPath, const ExtractOptions& options) {
+    ExtractTotals totals;
+    ExtractFSB(fsbPath, options, std::cout, totals);
+    if (options.store) PrintStoreTotals(totals, std::cout);
+}
+
+std::vector<char> LastSamplesByName(const std::vector<FSBSample>& samples) {
+    std::unordered_map<std::string, size_t> lastByName;
+    for (size_t i = 0; i < samples.size(); ++i) lastByName[samples[i].name] = i;
+    std::vector<char> isLast(samples.size(), 0);
+    for (const auto& entry : lastByName) isLast[entry.second] = 1;
+    return isLast;
+}
+
+// Creates outDir/<name>.bin for every sample inside bankSize and fills it
+// with copy, in parallel. Of the samples sharing a name, only the last one
+// is written. Storing and incremental runs need the payload hashed, so there
+// view supplies it instead.
+static void WriteSamplesWith(const std::vector<FSBSample>& samples, uint64_t bankSize, const std::string& outDir, ExtractTotals& totals,
+                             const SampleOutput& output,
+                             const std::function<bool(RandomAccessFile&, const FSBSample&)>& copy,
+                             const std::function<const char*(const FSBSample&, std::vector<char>&)>& view) {
+    ScopedPhase phase("copy", outDir);
+    std::vector<char> isLast = LastSamplesByName(samples);
+    std::vector<uint64_t> hashes(samples.size());
+    std::vector<char> written(samples.size(), 0);
+    ParallelFor(samples.size(), [&](size_t i) {
+        const FSBSample& s = samples[i];
+        if ((uint64_t)s.offset + s.size > bankSize || !isLast[i]) return;
+        std::string path = outDir + "/" + s.name + ".bin";
+        bool ok;
+        if (output.store || output.state) {
+            std::vector<char> buffer;
+            const char* payload = view(s, buffer);
+            if (!payload) {
+                if (output.state) output.state->MarkIncomplete();
+                return;
+            }
+            hashes[i] = XXH64(payload, s.size);
+            if (output.state && output.state->Reuse(path, s.size, hashes[i])) {
+                totals.outputsSkipped++;
+                written[i] = 1;
+                return;
+            }
+            if (output.store) {
+                bool added = false;
+                ok = output.store->Put(payload, s.size, hashes[i], added) && output.store->Materialize(hashes[i], s.size, path);
+                if (ok && added) {
+                    totals.bytesWritten += s.size;
+                    totals.blobsStored++;
+                } else if (ok) {
+                    totals.bytesDeduped += s.size;
+                }
+            } else {
+                RandomAccessFile sf;
+                ok = sf.Open(path, RandomAccessFile::CreateTruncate) && sf.WriteAt(0, payload, s.size);
+                if (ok) totals.bytesWritten += s.size;
+            }
+        } else {
+            RandomAccessFile sf;
+            ok = sf.Open(path, RandomAccessFile::CreateTruncate) && copy(sf, s);
+            if (ok) totals.bytesWritten += s.size;
+        }
+        if (output.state) {
+            if (ok) {
+                output.state->Record(path, s.size, hashes[i]);
+            } else {
+                output.state->MarkIncomplete();
+            }
+        }
+        if (!ok) return;
+        totals.samples++;
+        written[i] = 1;
+    });
+
+    if (!output.manifest) return;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        if (!written[i]) continue;
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hashes[i]);
+        *output.manifest << hash << "\t" << samples[i].size << "\t" << samples[i].name << std::endl;
+    }
+}
+
+void WriteSampleFiles(const RandomAccessFile& src, uint64_t baseOffset, uint64_t bankSize, const std::vector<FSBSample>& samples,
+                      const std::string& outDir, ExtractTotals& totals, const SampleOutput& output) {
+    WriteSamplesWith(samples, bankSize, outDir, totals, output,
+        [&](RandomAccessFile& out, const FSBSample& s) {
+            return out.CopyFrom(src, baseOffset + s.offset, 0, s.size);
+        },
+        [&](const FSBSample& s, std::vector<char>& buffer) -> const char* {
+            buffer.resize(s.size);
+            if (!src.ReadAt(baseOffset + s.offset, buffer.data(), s.size)) return nullptr;
+            return buffer.data();
+        });
+}
+
+void WriteSampleFiles(const char* bank, uint64_t bankSize, const std::vector<FSBSample>& samples, const std::string& outDir,
+                      ExtractTotals& totals, const SampleOutput& output) {
+    WriteSamplesWith(samples, bankSize, outDir, totals, output,
+        [&](RandomAccessFile& out, const FSBSample& s) {
+            return out.WriteAt(0, bank + s.offset, s.size);
+        },
+        [&](const FSBSample& s, std::vector<char>&) {
+            return bank + s.offset;
+        });
+}
+
+void BeginStoreManifest(std::ostream& manifest, const std::string& sourcePath) {
+    manifest << "# Source: " << GetAbsolutePath(sourcePath) << std::endl;
+    manifest << "# Sample blobs of this bank: xxh64, size, name" << std::endl;
+}
+
+void ExtractStreamedSamples(const FSBIndex& index, uint64_t available, const std::string& samplesDir, const std::string& manifestPath,
+                            const ExtractOptions& options, std::ostream& log, ExtractTotals& totals, const SampleOutput& output) {
+    std::vector<FSBSample> streamed;
+    for (const auto& s : index.samples) {
+        if ((uint64_t)s.offset + s.size > available) streamed.push_back(s);
+    }
+    if (streamed.empty()) return;
+
+    std::ofstream manifest(manifestPath);
+    manifest << "# Samples stored in the external stream of this bank: name, bank offset, size" << std::endl;
+    for (const auto& s : streamed) {
+        manifest << s.name << "\t0x" << std::hex << s.offset << std::dec << "\t" << s.size << std::endl;
+    }
+    manifest.close();
+
+    if (options.streamPath.empty()) {
+        log << "  -> " << streamed.size() << " sample(s) live in an external stream, listed in " << manifestPath
+            << ". Use --stream <file> to extract them." << std::endl;
         return;
     }
 
+    // The stream is either a complete copy of the bank or just its data
+    // region; only the samples missing from the package are read from it.
+    RandomAccessFile stream;
+    if (!stream.Open(options.streamPath, RandomAccessFile::ReadOnly)) {
+        log << "  -> Failed to open stream " << options.streamPath << std::endl;
+        return;
+    }
+    char magic[4] = { 0 };
+    bool wholeBank = stream.ReadAt(0, magic, 4) && memcmp(magic, "FSB", 3) == 0 && magic[3] == index.version;
+    uint32_t dataStart = index.HeaderRegionSize();
+    for (auto& s : streamed) {
+        if (!wholeBank) s.offset = s.offset >= dataStart ? s.offset - dataStart : 0xFFFFFFFF;
+    }
+
+    ExtractTotals resolved;
+    WriteSampleFiles(stream, 0, stream.Size(), streamed, samplesDir, resolved, output);
+    totals.bytesWritten += resolved.bytesWritten;
+    totals.samples += resolved.samples;
+    totals.blobsStored += resolved.blobsStored;
+    totals.bytesDeduped += resolved.bytesDeduped;
+    totals.outputsSkipped += resolved.outputsSkipped;
+    log << "  -> Resolved " << resolved.samples << " of " << streamed.size() << " streamed sample(s) from " << options.streamPath << std::endl;
+}
+
+void ExtractFSB(const std::string& fsbPath, const ExtractOptions& options, std::ostream& log, ExtractTotals& totals) {
+    ScopedPhase phase("extract", fsbPath);
     std::string outDir = GetFileNameWithoutExtension(fsbPath) + "_samples";
+    ExtractState state(outDir);
+    if (options.incremental && state.Begin(fsbPath, options)) {
+        log << "Unchanged since the last extraction: " << fsbPath << std::endl;
+        return;
+    }
+
+    FSBIndex index;
+    if (!ReadFSBIndex(fsbPath, 0, index) || index.samples.empty()) {
+        log << "No samples found or invalid FSB: " << fsbPath << std::endl;
+        return;
+    }
+    ReportFSBSamples(index, 0, log);
     CreateDirectoryIfNotExists(outDir);
 
-    std::ifstream f(fsbPath, std::ios::binary);
-    for (auto& s : samples) {
-        std::string sName = s.name + ".bin";
-        std::ofstream sf(outDir + "/" + sName, std::ios::binary);
-        f.seekg(s.offset);
-        std::vector<char> buf(s.size);
-        f.read(buf.data(), s.size);
-        
-        sf.write(buf.data(), s.size);
-        sf.close();
+    RandomAccessFile f;
+    if (!f.Open(fsbPath, RandomAccessFile::ReadOnly)) return;
+    uint64_t fileSize = f.Size();
+    SampleOutput output;
+    std::ofstream storeManifest;
+    if (options.store) {
+        storeManifest.open(options.store->ManifestPath(fsbPath, 0));
+        BeginStoreManifest(storeManifest, fsbPath);
+        output.store = options.store;
+        output.manifest = &storeManifest;
+    }
+    if (options.incremental) output.state = &state;
+    WriteSampleFiles(f, 0, fileSize, index.samples, outDir, totals, output);
+    totals.bytesRead += fileSize;
+    if (options.writeWav) {
+        size_t undecoded = WriteWavFiles(f, 0, fileSize, index.samples, outDir, totals, output.state);
+        if (undecoded > 0) log << undecoded << " sample(s) have no WAV decoder, kept as .bin only." << std::endl;
     }
-    std::cout << "Extracted " << samples.size() << " samples to " << outDir << std::endl;
-}
 
+    size_t inFile = 0;
+    for (const auto& s : index.samples) inFile += (uint64_t)s.offset + s.size <= fileSize;
+    log << "Extracted " << inFile << " samples to " << outDir << std::endl;
+
+    std::string manifestPath = GetFileNameWithoutExtension(fsbPath) + "_streamed.txt";
+    ExtractStreamedSamples(index, fileSize, outDir, manifestPath, options, log, totals, output);
+    if (options.incremental) state.End();
+}
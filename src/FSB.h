@@ -1,7 +1,11 @@
 #ifndef FSB_H
 #define FSB_H
 
-#include "Utils.h"
+#include "FileIO.h"
+#include <atomic>
+
+#define FSB4_FLAG_BASICHEADERS 0x00000002 // Samples after the first only store lengths
+#define FSB4_MODE_LOOP_NORMAL 0x00000002  // Sample mode: plays loopstart..loopend repeatedly
 
 #pragma pack(push, 1)
 struct FSB4_HEADER {
@@ -14,26 +18,173 @@ struct FSB4_HEADER {
     char hash[16];
     char zero[8];
 };
+
+struct FSB4_SAMPLE_HEADER {
+    uint16_t size;
+    char name[30];
+    uint32_t lengthsamples;
+    uint32_t lengthcompressedbytes;
+    uint32_t loopstart;
+    uint32_t loopend;
+    uint32_t mode;
+    int32_t deffreq;
+    uint16_t defvol;
+    int16_t defpan;
+    uint16_t defpri;
+    uint16_t numchannels;
+};
+
+struct FSB4_BASIC_SAMPLE_HEADER {
+    uint32_t lengthsamples;
+    uint32_t lengthcompressedbytes;
+};
+
+// Leading fields of an FSB5 header. Version 1 headers are 0x3C bytes long,
+// version 0 ones carry an extra field and are 0x40 bytes long.
+struct FSB5_HEADER {
+    char magic[4]; // "FSB5"
+    uint32_t version;
+    uint32_t numsamples;
+    uint32_t shdr_size;
+    uint32_t name_size;
+    uint32_t data_size;
+    uint32_t mode; // Codec, shared by every sample
+};
 #pragma pack(pop)
 
+#define FSB5_HEADER_SIZE_V0 0x40
+#define FSB5_HEADER_SIZE_V1 0x3C
+
+// FSB5 sample headers are a packed 64-bit word (bit 0: more chunks follow,
+// 1-4: rate code, 5-6: channel code, 7-33: data offset / 32, 34-63: length
+// in samples) followed by optional chunks.
+#define FSB5_CHUNK_CHANNELS 1
+#define FSB5_CHUNK_FREQUENCY 2
+#define FSB5_CHUNK_LOOP 3
+
+// Codec ids follow the FSB5 numbering; FSB4 mode flags are mapped onto them.
+enum FSBCodec {
+    FSB_CODEC_UNKNOWN = 0,
+    FSB_CODEC_PCM8 = 1,
+    FSB_CODEC_PCM16 = 2,
+    FSB_CODEC_PCM24 = 3,
+    FSB_CODEC_PCM32 = 4,
+    FSB_CODEC_PCMFLOAT = 5,
+    FSB_CODEC_GCADPCM = 6,
+    FSB_CODEC_IMAADPCM = 7,
+    FSB_CODEC_VAG = 8,
+    FSB_CODEC_HEVAG = 9,
+    FSB_CODEC_XMA = 10,
+    FSB_CODEC_MPEG = 11,
+    FSB_CODEC_CELT = 12,
+    FSB_CODEC_AT9 = 13,
+    FSB_CODEC_XWMA = 14,
+    FSB_CODEC_VORBIS = 15
+};
+
 struct FSBSample {
     std::string name;
-    uint32_t offset;
+    uint32_t offset;       // Relative to the start of the bank
     uint32_t size;
-    uint32_t headerOffset;
+    uint32_t headerOffset; // Relative to the start of the bank
     uint32_t headerSize;
 
     // Metadata
     uint32_t numSamples;
-    uint32_t uncompressedSize;
     uint32_t loopStart;
     uint32_t loopEnd;
     uint32_t mode;
+    uint32_t codec;
     int32_t frequency;
     uint16_t channels;
 };
 
-std::vector<FSBSample> ParseFSB(const std::string& fsbPath, uint32_t baseOffset = 0, uint32_t displayOffset = 0);
-void ExtractFSB(const std::string& fsbPath);
+// Sample table of one FSB4 or FSB5 bank, decoded from the header region alone.
+struct FSBIndex {
+    char version;              // '4' or '5'
+    FSB4_HEADER header;        // Only filled in for FSB4 banks
+    uint32_t headerRegionSize; // Bank header, sample headers and (FSB5) name table
+    uint32_t dataSize;
+    std::vector<FSBSample> samples;
+
+    uint32_t HeaderRegionSize() const { return headerRegionSize; }
+    uint32_t TotalSize() const { return headerRegionSize + dataSize; }
+};
+
+uint32_t CodecFromFSB4Mode(uint32_t mode);
+std::string GetFormatString(uint32_t codec);
+
+// Decodes an FSB4 or FSB5 bank whose header region starts at data (a mapped
+// package or a buffer); no sample payload bytes are touched.
+bool ParseFSBIndex(const char* data, size_t size, FSBIndex& index);
+// Size of the header region (everything before the sample data) of the bank
+// at data, or 0 if data does not start with a complete FSB4/FSB5 header.
+uint32_t FSBHeaderRegionSize(const char* data, size_t size);
+// Loads the header and sample header region of a bank file with one read.
+bool ReadFSBIndex(const std::string& fsbPath, uint32_t baseOffset, FSBIndex& index);
+// Prints one line per sample; displayOffset is added to the bank-relative offsets.
+void ReportFSBSamples(const FSBIndex& index, uint32_t displayOffset, std::ostream& log = std::cout);
+
+// Counters shared by every unit of an extraction run.
+struct ExtractTotals {
+    std::atomic<uint64_t> bytesRead; // Package (uncompressed view) or bank file bytes
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> blobsStored;  // New blobs written to the sample store
+    std::atomic<uint64_t> bytesDeduped; // Sample bytes linked to an existing blob instead of written
+    std::atomic<uint64_t> outputsSkipped; // Unchanged outputs an incremental run left alone
+
+    ExtractTotals() : bytesRead(0), bytesWritten(0), samples(0), blobsStored(0), bytesDeduped(0), outputsSkipped(0) {}
+};
+
+class SampleStore;
+class ExtractState;
+
+struct ExtractOptions {
+    bool writeFsbCopy;         // Also write each package bank out as audio_N.fsb
+    bool incremental;          // Only rewrite outputs whose source bytes changed since the last run
+    std::string streamPath;    // External stream holding the tail of a truncated (streaming) bank
+    const SampleStore* store;  // Deduplicate sample files into this store, if set
+    bool writeWav;             // Also decode each sample that has a decoder to <name>.wav
+
+    ExtractOptions() : writeFsbCopy(true), incremental(false), store(nullptr), writeWav(false) {}
+};
+
+// Samples sharing a name are extracted to the same file; only the last one
+// is written so the result matches a sequential extraction. Returns 1 for
+// the samples to write. Computed before the parallel writers start, so they
+// only read it.
+std::vector<char> LastSamplesByName(const std::vector<FSBSample>& samples);
+
+// Where the samples of one bank are recorded besides their .bin files.
+struct SampleOutput {
+    const SampleStore* store; // Link each file to its blob in this store
+    std::ostream* manifest;   // Store manifest receiving one line per sample
+    ExtractState* state;      // Skip samples whose bytes did not change since the last run
+
+    SampleOutput() : store(nullptr), manifest(nullptr), state(nullptr) {}
+};
+
+// Writes each sample to outDir/<name>.bin, in parallel, copying straight from
+// src at baseOffset + sample offset. Samples past bankSize are skipped. With
+// a store, each file links to the sample's blob and one manifest line per
+// sample goes to the manifest.
+void WriteSampleFiles(const RandomAccessFile& src, uint64_t baseOffset, uint64_t bankSize, const std::vector<FSBSample>& samples,
+                      const std::string& outDir, ExtractTotals& totals, const SampleOutput& output = SampleOutput());
+// Same, for a bank that is already in memory (mapped or decompressed).
+void WriteSampleFiles(const char* bank, uint64_t bankSize, const std::vector<FSBSample>& samples, const std::string& outDir,
+                      ExtractTotals& totals, const SampleOutput& output = SampleOutput());
+// Writes the header lines of a store manifest for the bank of sourcePath.
+void BeginStoreManifest(std::ostream& manifest, const std::string& sourcePath);
+
+std::vector<FSBSample> ParseFSB(const std::string& fsbPath, uint32_t baseOffset = 0, uint32_t displayOffset = 0, std::ostream& log = std::cout);
+// Handles the samples of a streaming bank that lie past the available bytes
+// of its container: they are listed in manifestPath and, when
+// options.streamPath names the matching stream file, read from there.
+void ExtractStreamedSamples(const FSBIndex& index, uint64_t available, const std::string& samplesDir, const std::string& manifestPath,
+                            const ExtractOptions& options, std::ostream& log, ExtractTotals& totals, const SampleOutput& output = SampleOutput());
+
+void ExtractFSB(const std::string& fsbPath, const ExtractOptions& options = ExtractOptions());
+void ExtractFSB(const std::string& fsbPath, const ExtractOptions& options, std::ostream& log, ExtractTotals& totals);
 
 #endif
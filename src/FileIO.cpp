@@ -0,0 +1,296 @@
+#include "FileIO.h"
+#include "Stats.h"
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE 1
+#endif
+
+namespace {
+
+const size_t ZERO_PAGE_SIZE = 64 * 1024;
+const char ZERO_PAGE[ZERO_PAGE_SIZE] = { 0 };
+const size_t COPY_BUFFER_SIZE = 64 * 1024;
+
+} // namespace
+
+#ifdef _WIN32
+
+RandomAccessFile::RandomAccessFile() : handle(INVALID_HANDLE_VALUE), next(0) {
+}
+
+bool RandomAccessFile::Open(const std::string& path, Mode mode) {
+    Close();
+    DWORD access = GENERIC_READ;
+    DWORD disposition = OPEN_EXISTING;
+    if (mode != ReadOnly) access |= GENERIC_WRITE;
+    if (mode == CreateTruncate) disposition = CREATE_ALWAYS;
+    handle = CreateFileA(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+    next = 0;
+    CountOpen();
+    return handle != INVALID_HANDLE_VALUE;
+}
+
+void RandomAccessFile::Close() {
+    if (handle != INVALID_HANDLE_VALUE) CloseHandle((HANDLE)handle);
+    handle = INVALID_HANDLE_VALUE;
+}
+
+bool RandomAccessFile::IsOpen() const {
+    return handle != INVALID_HANDLE_VALUE;
+}
+
+bool RandomAccessFile::ReadAt(uint64_t offset, void* dst, size_t size) const {
+    if (StatsEnabled()) {
+        CountAccess(offset, size);
+        CountRead(size);
+    }
+    char* p = (char*)dst;
+    while (size > 0) {
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD chunk = size > (1u << 30) ? (1u << 30) : (DWORD)size;
+        DWORD done = 0;
+        if (!ReadFile((HANDLE)handle, p, chunk, &done, &ov) || done == 0) return false;
+        p += done;
+        offset += done;
+        size -= done;
+    }
+    return true;
+}
+
+bool RandomAccessFile::WriteAt(uint64_t offset, const void* src, size_t size) {
+    if (StatsEnabled()) {
+        CountAccess(offset, size);
+        CountWrite(size);
+    }
+    const char* p = (const char*)src;
+    while (size > 0) {
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD chunk = size > (1u << 30) ? (1u << 30) : (DWORD)size;
+        DWORD done = 0;
+        if (!WriteFile((HANDLE)handle, p, chunk, &done, &ov) || done == 0) return false;
+        p += done;
+        offset += done;
+        size -= done;
+    }
+    return true;
+}
+
+bool RandomAccessFile::Sync() {
+    return FlushFileBuffers((HANDLE)handle) != 0;
+}
+
+bool RandomAccessFile::CopyFrom(const RandomAccessFile& src, uint64_t srcOffset, uint64_t dstOffset, uint64_t size) {
+    return CopyBuffered(src, srcOffset, dstOffset, size);
+}
+
+uint64_t RandomAccessFile::Size() const {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx((HANDLE)handle, &size)) return 0;
+    return (uint64_t)size.QuadPart;
+}
+
+bool RandomAccessFile::SetSize(uint64_t size) {
+    if (size > Size()) {
+        DWORD returned = 0;
+        DeviceIoControl((HANDLE)handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL);
+    }
+    FILE_END_OF_FILE_INFO info;
+    info.EndOfFile.QuadPart = (LONGLONG)size;
+    return SetFileInformationByHandle((HANDLE)handle, FileEndOfFileInfo, &info, sizeof(info)) != 0;
+}
+
+#else
+
+RandomAccessFile::RandomAccessFile() : fd(-1), next(0) {
+}
+
+bool RandomAccessFile::Open(const std::string& path, Mode mode) {
+    Close();
+    int flags = O_RDONLY;
+    if (mode == ReadWrite) flags = O_RDWR;
+    if (mode == CreateTruncate) flags = O_RDWR | O_CREAT | O_TRUNC;
+    fd = open(path.c_str(), flags, 0666);
+    next = 0;
+    CountOpen();
+    return fd >= 0;
+}
+
+void RandomAccessFile::Close() {
+    if (fd >= 0) close(fd);
+    fd = -1;
+}
+
+bool RandomAccessFile::IsOpen() const {
+    return fd >= 0;
+}
+
+bool RandomAccessFile::ReadAt(uint64_t offset, void* dst, size_t size) const {
+    if (StatsEnabled()) {
+        CountAccess(offset, size);
+        CountRead(size);
+    }
+    char* p = (char*)dst;
+    while (size > 0) {
+        ssize_t done = pread(fd, p, size, (off_t)offset);
+        if (done <= 0) return false;
+        p += done;
+        offset += done;
+        size -= done;
+    }
+    return true;
+}
+
+bool RandomAccessFile::WriteAt(uint64_t offset, const void* src, size_t size) {
+    if (StatsEnabled()) {
+        CountAccess(offset, size);
+        CountWrite(size);
+    }
+    const char* p = (const char*)src;
+    while (size > 0) {
+        ssize_t done = pwrite(fd, p, size, (off_t)offset);
+        if (done <= 0) return false;
+        p += done;
+        offset += done;
+        size -= done;
+    }
+    return true;
+}
+
+bool RandomAccessFile::Sync() {
+    return fsync(fd) == 0;
+}
+
+bool RandomAccessFile::CopyFrom(const RandomAccessFile& src, uint64_t srcOffset, uint64_t dstOffset, uint64_t size) {
+#ifdef HAVE_COPY_FILE_RANGE
+    while (size > 0) {
+        loff_t in = (loff_t)srcOffset;
+        loff_t out = (loff_t)dstOffset;
+        ssize_t done = copy_file_range(src.fd, &in, fd, &out, (size_t)size, 0);
+        if (done < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) break;
+        if (done <= 0) return false;
+        if (StatsEnabled()) {
+            src.CountAccess(srcOffset, done);
+            CountAccess(dstOffset, done);
+            CountRead(done);
+            CountWrite(done);
+        }
+        srcOffset += done;
+        dstOffset += done;
+        size -= done;
+    }
+#endif
+    return CopyBuffered(src, srcOffset, dstOffset, size);
+}
+
+uint64_t RandomAccessFile::Size() const {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return 0;
+    return (uint64_t)st.st_size;
+}
+
+bool RandomAccessFile::SetSize(uint64_t size) {
+    return ftruncate(fd, (off_t)size) == 0;
+}
+
+#endif
+
+RandomAccessFile::~RandomAccessFile() {
+    Close();
+}
+
+void RandomAccessFile::CountAccess(uint64_t offset, uint64_t size) const {
+    if (next.exchange(offset + size, std::memory_order_relaxed) != offset) CountSeek();
+}
+
+bool RandomAccessFile::WriteZerosAt(uint64_t offset, uint64_t size) {
+    while (size > 0) {
+        size_t chunk = size > ZERO_PAGE_SIZE ? ZERO_PAGE_SIZE : (size_t)size;
+        if (!WriteAt(offset, ZERO_PAGE, chunk)) return false;
+        offset += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+bool RandomAccessFile::CopyBuffered(const RandomAccessFile& src, uint64_t srcOffset, uint64_t dstOffset, uint64_t size) {
+    char buf[COPY_BUFFER_SIZE];
+    while (size > 0) {
+        size_t chunk = size > COPY_BUFFER_SIZE ? COPY_BUFFER_SIZE : (size_t)size;
+        if (!src.ReadAt(srcOffset, buf, chunk) || !WriteAt(dstOffset, buf, chunk)) return false;
+        srcOffset += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+int64_t GetFileLength(const std::string& path) {
+    RandomAccessFile f;
+    if (!f.Open(path, RandomAccessFile::ReadOnly)) return -1;
+    return (int64_t)f.Size();
+}
+
+bool GetFileStamp(const std::string& path, uint64_t& size, uint64_t& mtime) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attr)) return false;
+    size = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    mtime = (((uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime) * 100;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    mtime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ull + st.st_mtimespec.tv_nsec;
+#else
+    mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+#endif
+#endif
+    return true;
+}
+
+bool CloneFile(const std::string& from, const std::string& to) {
+#if defined(__linux__) && defined(FICLONE)
+    int src = open(from.c_str(), O_RDONLY);
+    if (src < 0) return false;
+    int dst = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (dst < 0) {
+        close(src);
+        return false;
+    }
+    bool cloned = ioctl(dst, FICLONE, src) == 0;
+    close(src);
+    close(dst);
+    if (!cloned) remove(to.c_str());
+    return cloned;
+#else
+    (void)from;
+    (void)to;
+    return false;
+#endif
+}
+
+bool HardLinkFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+    return CreateHardLinkA(to.c_str(), from.c_str(), NULL) != 0;
+#else
+    return link(from.c_str(), to.c_str()) == 0;
+#endif
+}
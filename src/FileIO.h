@@ -0,0 +1,65 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include "Utils.h"
+#include <atomic>
+
+// Positional file I/O on a single OS handle (pread/pwrite, or ReadFile/
+// WriteFile with an explicit offset on Windows). No shared file pointer, so
+// one handle can serve many reads and writes without seeking.
+class RandomAccessFile {
+public:
+    enum Mode {
+        ReadOnly,
+        ReadWrite,
+        CreateTruncate
+    };
+
+    RandomAccessFile();
+    ~RandomAccessFile();
+
+    bool Open(const std::string& path, Mode mode);
+    void Close();
+    bool IsOpen() const;
+
+    bool ReadAt(uint64_t offset, void* dst, size_t size) const;
+    bool WriteAt(uint64_t offset, const void* src, size_t size);
+    // Writes size zero bytes from a shared zero page.
+    bool WriteZerosAt(uint64_t offset, uint64_t size);
+    // Copies size bytes from src. On Linux this uses copy_file_range so the
+    // data never leaves the kernel; otherwise, or when the filesystem refuses,
+    // it goes through a stack buffer.
+    bool CopyFrom(const RandomAccessFile& src, uint64_t srcOffset, uint64_t dstOffset, uint64_t size);
+    bool Sync();
+    uint64_t Size() const;
+    // Grows or shrinks the file. Growth is a hole (marked sparse on NTFS), so
+    // no zero bytes are written or allocated.
+    bool SetSize(uint64_t size);
+
+private:
+    RandomAccessFile(const RandomAccessFile&);
+    bool CopyBuffered(const RandomAccessFile& src, uint64_t srcOffset, uint64_t dstOffset, uint64_t size);
+    // Counts an access for --stats: a seek unless it continues the previous one.
+    void CountAccess(uint64_t offset, uint64_t size) const;
+
+    RandomAccessFile& operator=(const RandomAccessFile&);
+
+#ifdef _WIN32
+    void* handle;
+#else
+    int fd;
+#endif
+    mutable std::atomic<uint64_t> next; // End of the previous access, while stats are enabled
+};
+
+// Size of a file on disk, or -1 if it cannot be opened.
+int64_t GetFileLength(const std::string& path);
+// Size and last-write time (nanoseconds, platform epoch) without opening the file.
+bool GetFileStamp(const std::string& path, uint64_t& size, uint64_t& mtime);
+// Creates to as a reflink of from (FICLONE on Btrfs/XFS): its own file
+// sharing from's blocks until either is written. False where unsupported.
+bool CloneFile(const std::string& from, const std::string& to);
+// Creates to as a second name of from. to must not exist.
+bool HardLinkFile(const std::string& from, const std::string& to);
+
+#endif
@@ -0,0 +1,89 @@
+#include "Hash.h"
+
+namespace {
+
+const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+const uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t Rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t Read64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+inline uint32_t Read32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint64_t Round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = Rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+inline uint64_t MergeRound(uint64_t acc, uint64_t val) {
+    acc ^= Round(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+// Mixes the trailing (< 32) bytes and applies the final avalanche.
+uint64_t Finalize(uint64_t h, const unsigned char* p, size_t len) {
+    while (len >= 8) {
+        h ^= Round(0, Read64(p));
+        h = Rotl(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)Read32(p) * PRIME1;
+        h = Rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        h ^= (*p) * PRIME5;
+        h = Rotl(h, 11) * PRIME1;
+        p++;
+        len--;
+    }
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t Converge(const uint64_t v[4]) {
+    uint64_t h = Rotl(v[0], 1) + Rotl(v[1], 7) + Rotl(v[2], 12) + Rotl(v[3], 18);
+    for (int i = 0; i < 4; ++i) h = MergeRound(h, v[i]);
+    return h;
+}
+
+} // namespace
+
+uint64_t XXH64(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+        const unsigned char* limit = end - 32;
+        do {
+            for (int i = 0; i < 4; ++i) v[i] = Round(v[i], Read64(p + i * 8));
+            p += 32;
+        } while (p <= limit);
+        h = Converge(v);
+    } else {
+        h = seed + PRIME5;
+    }
+    h += (uint64_t)size;
+    return Finalize(h, p, end - p);
+}
@@ -0,0 +1,10 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "Utils.h"
+
+// XXH64 (xxHash, 64-bit variant). Fast enough to fingerprint whole sample
+// payloads at memory bandwidth; not a cryptographic hash.
+uint64_t XXH64(const void* data, size_t size, uint64_t seed = 0);
+
+#endif
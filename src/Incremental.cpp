@@ -0,0 +1,120 @@
+#include "Incremental.h"
+#include "FileIO.h"
+#include "Store.h"
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+const char* STATE_MAGIC = "MK9STATE 1";
+
+} // namespace
+
+ExtractState::ExtractState(const std::string& dir) : dir(dir), complete(true) {
+    previousSource.size = previousSource.mtime = previousSource.hash = 0;
+    currentSource.size = currentSource.mtime = currentSource.hash = 0;
+}
+
+std::string ExtractState::Relative(const std::string& path) const {
+    if (path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 && (path[dir.size()] == '/' || path[dir.size()] == '\\')) {
+        return path.substr(dir.size() + 1);
+    }
+    return path;
+}
+
+bool ExtractState::Load() {
+    std::ifstream in(dir + "/" + EXTRACT_STATE_FILE);
+    std::string line;
+    if (!std::getline(in, line) || line != STATE_MAGIC) return false;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string first;
+        if (!std::getline(fields, first, '\t')) continue;
+        if (first == "source") {
+            std::string size, mtime, hash;
+            std::getline(fields, size, '\t');
+            std::getline(fields, mtime, '\t');
+            std::getline(fields, hash, '\t');
+            std::getline(fields, previousOptions, '\t');
+            std::getline(fields, previousSource.path);
+            previousSource.size = strtoull(size.c_str(), nullptr, 10);
+            previousSource.mtime = strtoull(mtime.c_str(), nullptr, 10);
+            previousSource.hash = strtoull(hash.c_str(), nullptr, 16);
+            continue;
+        }
+        std::string hash, path;
+        if (!std::getline(fields, hash, '\t') || !std::getline(fields, path)) continue;
+        Output o = { strtoull(first.c_str(), nullptr, 10), strtoull(hash.c_str(), nullptr, 16) };
+        previous[path] = o;
+    }
+    return true;
+}
+
+bool ExtractState::Begin(const std::string& sourcePath, const ExtractOptions& options) {
+    currentOptions = ExtractOptionsKey(options);
+    if (!FingerprintFile(sourcePath, currentSource)) {
+        currentSource.path.clear();
+        return false;
+    }
+    if (!Load() || previousSource.path.empty() || previousSource.path != currentSource.path || previousSource.size != currentSource.size ||
+        previousSource.mtime != currentSource.mtime || previousSource.hash != currentSource.hash || previousOptions != currentOptions) {
+        return false;
+    }
+    for (const auto& o : previous) {
+        int64_t size = GetFileLength(dir + "/" + o.first);
+        if (size < 0 || (uint64_t)size != o.second.size) return false;
+    }
+    return true;
+}
+
+bool ExtractState::End() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::string path = dir + "/" + EXTRACT_STATE_FILE;
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath);
+    if (!out.is_open()) return false;
+    out << STATE_MAGIC << "\n";
+    if (complete && !currentSource.path.empty()) {
+        out << "source\t" << currentSource.size << "\t" << currentSource.mtime << "\t" << std::hex << currentSource.hash << std::dec
+            << "\t" << currentOptions << "\t" << currentSource.path << "\n";
+    }
+    for (const auto& o : current) {
+        out << o.second.size << "\t" << std::hex << o.second.hash << std::dec << "\t" << o.first << "\n";
+    }
+    out.close();
+    return out.good() && ReplaceFileWith(tmpPath, path);
+}
+
+bool ExtractState::Reuse(const std::string& path, uint64_t size, uint64_t hash) {
+    std::string rel = Relative(path);
+    auto it = previous.find(rel);
+    if (it == previous.end() || it->second.size != size || it->second.hash != hash) return false;
+    int64_t onDisk = GetFileLength(path);
+    if (onDisk < 0 || (uint64_t)onDisk != size) return false;
+    Record(path, size, hash);
+    return true;
+}
+
+void ExtractState::Record(const std::string& path, uint64_t size, uint64_t hash) {
+    Output o = { size, hash };
+    std::lock_guard<std::mutex> guard(lock);
+    current[Relative(path)] = o;
+}
+
+void ExtractState::MarkIncomplete() {
+    std::lock_guard<std::mutex> guard(lock);
+    complete = false;
+}
+
+std::string ExtractOptionsKey(const ExtractOptions& options) {
+    std::string key = options.writeFsbCopy ? "fsb" : "nofsb";
+    if (options.store) key += ";store=" + GetAbsolutePath(options.store->Dir());
+    if (options.writeWav) key += ";wav";
+    if (!options.streamPath.empty()) {
+        // A changed stream file changes the samples resolved from it.
+        uint64_t size = 0, mtime = 0;
+        GetFileStamp(options.streamPath, size, mtime);
+        key += ";stream=" + GetAbsolutePath(options.streamPath) + "@" + std::to_string(size) + ":" + std::to_string(mtime);
+    }
+    return key;
+}
@@ -0,0 +1,58 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "Catalog.h"
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#define EXTRACT_STATE_FILE ".mk9state"
+
+// What the last extraction into a folder was made from: the source file's
+// fingerprint and options, and the size and hash of the source bytes behind
+// every output file. Kept as <dir>/.mk9state, so an unchanged package is
+// skipped after a few stat calls and a changed one only rewrites the outputs
+// whose bytes moved or changed.
+class ExtractState {
+public:
+    explicit ExtractState(const std::string& dir);
+
+    // Loads the previous state and fingerprints sourcePath. True if the last
+    // run extracted the same file with the same options, finished, and every
+    // output is still on disk with its recorded size.
+    bool Begin(const std::string& sourcePath, const ExtractOptions& options);
+    // Saves the state. The source only counts as extracted if no output failed.
+    bool End();
+
+    // True, and recorded for the next run, if path was last written from the
+    // same bytes and is still there; the caller then skips writing it.
+    bool Reuse(const std::string& path, uint64_t size, uint64_t hash);
+    void Record(const std::string& path, uint64_t size, uint64_t hash);
+    // A failed write keeps the source from being considered up to date.
+    void MarkIncomplete();
+
+private:
+    struct Output {
+        uint64_t size;
+        uint64_t hash;
+    };
+
+    bool Load();
+    std::string Relative(const std::string& path) const;
+
+    std::string dir;
+    std::unordered_map<std::string, Output> previous;
+    CatalogEntry previousSource;
+    std::string previousOptions;
+
+    std::mutex lock;
+    std::map<std::string, Output> current;
+    CatalogEntry currentSource;
+    std::string currentOptions;
+    bool complete;
+};
+
+// Options that change what an extraction writes.
+std::string ExtractOptionsKey(const ExtractOptions& options);
+
+#endif
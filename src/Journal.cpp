@@ -0,0 +1,279 @@
+#include "Journal.h"
+#include "Catalog.h"
+#include "Hash.h"
+#include <cstring>
+
+namespace {
+
+const char JOURNAL_MAGIC[8] = { 'M', 'K', '9', 'U', 'N', 'D', 'O', '1' };
+
+bool journaling = false;
+
+// A journal as found on disk, up to its last complete record.
+struct JournalContents {
+    PatchJournalHeader header;
+    std::vector<PatchJournalRecord> ranges;
+    std::vector<uint64_t> rangeData; // Journal offset of each range's original bytes
+    bool wholeFile;
+    bool committed;
+    std::vector<uint64_t> newHashes;
+    uint64_t newSize;
+};
+
+bool LoadJournal(const RandomAccessFile& f, JournalContents& c) {
+    c.wholeFile = c.committed = false;
+    c.newSize = 0;
+    uint64_t size = f.Size();
+    if (!f.ReadAt(0, &c.header, sizeof(c.header)) || memcmp(c.header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) return false;
+
+    uint64_t pos = sizeof(c.header);
+    PatchJournalRecord r;
+    while (pos + sizeof(r) <= size && f.ReadAt(pos, &r, sizeof(r))) {
+        pos += sizeof(r);
+        if (r.type == 'R') {
+            if (pos + r.size > size) break;
+            c.ranges.push_back(r);
+            c.rangeData.push_back(pos);
+            pos += r.size;
+        } else if (r.type == 'F') {
+            c.wholeFile = true;
+        } else if (r.type == 'C') {
+            if (pos + (uint64_t)r.size * 8 > size) break;
+            c.newHashes.resize(r.size);
+            if (r.size > 0 && !f.ReadAt(pos, c.newHashes.data(), (size_t)r.size * 8)) break;
+            c.newSize = r.offset;
+            c.committed = true;
+            break;
+        } else {
+            break;
+        }
+    }
+    return true;
+}
+
+bool HashRange(const RandomAccessFile& f, uint64_t offset, uint32_t size, uint64_t& hash) {
+    std::vector<char> buf(size);
+    if (size > 0 && !f.ReadAt(offset, buf.data(), size)) return false;
+    hash = XXH64(buf.data(), size);
+    return true;
+}
+
+std::string JournalPath(const std::string& packagePath) {
+    return packagePath + PATCH_JOURNAL_EXT;
+}
+
+} // namespace
+
+PatchJournal::PatchJournal() : end(0), wholeFile(false) {
+}
+
+bool PatchJournal::Begin(const std::string& path) {
+    if (HasInterruptedPatch(path)) {
+        std::cout << "An interrupted patch of " << path << " is still journaled. Run 'rollback' (or 'verify') first." << std::endl;
+        return false;
+    }
+    packagePath = path;
+    std::string backup = path + PATCH_BACKUP_EXT;
+    if (FileExists(backup)) remove(backup.c_str());
+
+    int64_t size = GetFileLength(path);
+    if (size < 0 || !file.Open(JournalPath(path), RandomAccessFile::CreateTruncate)) {
+        std::cout << "Failed to create patch journal for " << path << std::endl;
+        return false;
+    }
+    PatchJournalHeader header;
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.packageSize = (uint64_t)size;
+    end = sizeof(header);
+    return file.WriteAt(0, &header, sizeof(header));
+}
+
+bool PatchJournal::SaveRanges(const RandomAccessFile& package, const std::vector<PackageRange>& ranges) {
+    std::vector<char> buf;
+    for (const auto& range : ranges) {
+        buf.resize(sizeof(PatchJournalRecord) + range.size);
+        char* data = buf.data() + sizeof(PatchJournalRecord);
+        if (range.size > 0 && !package.ReadAt(range.offset, data, range.size)) return false;
+        PatchJournalRecord r = { 'R', range.size, range.offset, XXH64(data, range.size) };
+        memcpy(buf.data(), &r, sizeof(r));
+        if (!file.WriteAt(end, buf.data(), buf.size())) return false;
+        end += buf.size();
+        saved.push_back(range);
+    }
+    return file.Sync();
+}
+
+bool PatchJournal::SaveWholeFile() {
+    std::string backup = packagePath + PATCH_BACKUP_EXT;
+    // A second name for the old file costs no copy; the rebuilt package
+    // replaces the original name only.
+    if (!HardLinkFile(packagePath, backup) && !CloneFile(packagePath, backup)) {
+        RandomAccessFile src, dst;
+        if (!src.Open(packagePath, RandomAccessFile::ReadOnly) || !dst.Open(backup, RandomAccessFile::CreateTruncate) ||
+            !dst.CopyFrom(src, 0, 0, src.Size()) || !dst.Sync()) {
+            std::cout << "Failed to back up " << packagePath << std::endl;
+            return false;
+        }
+    }
+    PatchJournalRecord r = { 'F', 0, 0, 0 };
+    if (!file.WriteAt(end, &r, sizeof(r))) return false;
+    end += sizeof(r);
+    wholeFile = true;
+    return file.Sync();
+}
+
+bool PatchJournal::Commit() {
+    std::vector<uint64_t> hashes;
+    uint64_t newSize = 0;
+    if (wholeFile) {
+        CatalogEntry fingerprint;
+        if (!FingerprintFile(packagePath, fingerprint)) return false;
+        hashes.push_back(fingerprint.hash);
+        newSize = fingerprint.size;
+    } else {
+        // The new bytes were just written and are read back from the cache.
+        RandomAccessFile package;
+        if (!package.Open(packagePath, RandomAccessFile::ReadOnly)) return false;
+        hashes.resize(saved.size());
+        for (size_t i = 0; i < saved.size(); ++i) {
+            if (!HashRange(package, saved[i].offset, saved[i].size, hashes[i])) return false;
+        }
+        newSize = package.Size();
+    }
+    PatchJournalRecord r = { 'C', (uint32_t)hashes.size(), newSize, 0 };
+    if (!file.WriteAt(end, &r, sizeof(r))) return false;
+    end += sizeof(r);
+    if (!hashes.empty() && !file.WriteAt(end, hashes.data(), hashes.size() * 8)) return false;
+    end += hashes.size() * 8;
+    bool ok = file.Sync();
+    file.Close();
+    return ok;
+}
+
+bool HasInterruptedPatch(const std::string& packagePath) {
+    RandomAccessFile f;
+    if (!f.Open(JournalPath(packagePath), RandomAccessFile::ReadOnly)) return false;
+    JournalContents c;
+    return LoadJournal(f, c) && !c.committed;
+}
+
+bool RollbackPatch(const std::string& packagePath) {
+    std::string journalPath = JournalPath(packagePath);
+    RandomAccessFile f;
+    JournalContents c;
+    if (!f.Open(journalPath, RandomAccessFile::ReadOnly) || !LoadJournal(f, c)) {
+        std::cout << "No patch journal for " << packagePath << std::endl;
+        return false;
+    }
+
+    if (c.wholeFile) {
+        std::string backup = packagePath + PATCH_BACKUP_EXT;
+        if (!ReplaceFileWith(backup, packagePath)) {
+            std::cout << "Failed to restore " << packagePath << " from " << backup << std::endl;
+            return false;
+        }
+        // An interrupted run may never have replaced the package, which left
+        // the backup as a second name of the very same file.
+        if (FileExists(backup)) remove(backup.c_str());
+        std::cout << "Restored " << packagePath << " from its backup" << std::endl;
+    } else {
+        RandomAccessFile package;
+        if (!package.Open(packagePath, RandomAccessFile::ReadWrite)) {
+            std::cout << "Failed to open " << packagePath << " for writing" << std::endl;
+            return false;
+        }
+        // Ranges are synced once per batch, before the batch is written, so
+        // a crash while saving one leaves records whose bytes were never
+        // patched. Only the ranges up to the first torn one are restored; in
+        // a committed journal a bad range is damage, and nothing is restored.
+        size_t valid = 0;
+        for (; valid < c.ranges.size(); ++valid) {
+            uint64_t hash = 0;
+            if (!HashRange(f, c.rangeData[valid], c.ranges[valid].size, hash) || hash != c.ranges[valid].hash) break;
+        }
+        if (valid < c.ranges.size() && c.committed) {
+            std::cout << "Journal range " << valid << " of " << c.ranges.size() << " (0x" << std::hex << c.ranges[valid].offset << std::dec
+                      << ") does not match its hash; not rolling back " << packagePath << std::endl;
+            return false;
+        }
+        if (valid < c.ranges.size()) {
+            std::cout << "Warning: Journal range " << valid << " of " << c.ranges.size() << " (0x" << std::hex << c.ranges[valid].offset
+                      << std::dec << ") is torn; restoring the " << valid << " range(s) before it" << std::endl;
+            c.ranges.resize(valid);
+        }
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < c.ranges.size(); ++i) {
+            if (!package.CopyFrom(f, c.rangeData[i], c.ranges[i].offset, c.ranges[i].size)) {
+                std::cout << "Failed to restore 0x" << std::hex << c.ranges[i].offset << std::dec << " in " << packagePath << std::endl;
+                return false;
+            }
+            bytes += c.ranges[i].size;
+        }
+        if (package.Size() != c.header.packageSize && !package.SetSize(c.header.packageSize)) return false;
+        if (!package.Sync()) return false;
+        std::cout << "Rolled back " << c.ranges.size() << " range(s), " << bytes << " bytes, in " << packagePath << std::endl;
+    }
+    f.Close();
+    remove(journalPath.c_str());
+    return true;
+}
+
+bool VerifyPatch(const std::string& packagePath) {
+    RandomAccessFile f;
+    JournalContents c;
+    if (!f.Open(JournalPath(packagePath), RandomAccessFile::ReadOnly) || !LoadJournal(f, c)) {
+        std::cout << "No patch journal for " << packagePath << std::endl;
+        return false;
+    }
+
+    if (c.wholeFile) {
+        bool hasBackup = FileExists(packagePath + PATCH_BACKUP_EXT);
+        CatalogEntry fingerprint;
+        bool current = FingerprintFile(packagePath, fingerprint);
+        if (!c.committed) {
+            std::cout << packagePath << ": rebuild interrupted" << (hasBackup ? "; run 'rollback' to restore the backup" : ", no backup left") << std::endl;
+            return false;
+        }
+        bool applied = current && fingerprint.size == c.newSize && !c.newHashes.empty() && fingerprint.hash == c.newHashes[0];
+        std::cout << packagePath << ": rebuild " << (applied ? "complete" : "committed, but the package changed since") << "; backup "
+                  << (hasBackup ? "present" : "missing") << std::endl;
+        return applied && hasBackup;
+    }
+
+    RandomAccessFile package;
+    if (!package.Open(packagePath, RandomAccessFile::ReadOnly)) {
+        std::cout << "Failed to open " << packagePath << std::endl;
+        return false;
+    }
+    size_t original = 0, patched = 0, other = 0;
+    for (size_t i = 0; i < c.ranges.size(); ++i) {
+        const PatchJournalRecord& r = c.ranges[i];
+        uint64_t hash;
+        if (!HashRange(package, r.offset, r.size, hash)) {
+            other++;
+            continue;
+        }
+        if (c.committed && i < c.newHashes.size() && hash == c.newHashes[i]) {
+            patched++;
+        } else if (hash == r.hash) {
+            original++;
+        } else if (!c.committed) {
+            patched++; // Overwritten before the crash; the new bytes are not known yet
+        } else {
+            other++;
+            std::cout << "  Range 0x" << std::hex << r.offset << std::dec << " (" << r.size << " bytes) matches neither the original nor the patch" << std::endl;
+        }
+    }
+    std::cout << packagePath << ": " << (c.committed ? "patch committed" : "patch interrupted") << ", " << c.ranges.size() << " range(s): "
+              << patched << " patched, " << original << " original, " << other << " changed since" << std::endl;
+    if (!c.committed) std::cout << "Run 'rollback' to restore the original bytes." << std::endl;
+    return c.committed && other == 0;
+}
+
+void SetPatchJournaling(bool enabled) {
+    journaling = enabled;
+}
+
+bool PatchJournaling() {
+    return journaling;
+}
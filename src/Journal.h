@@ -0,0 +1,72 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "FileIO.h"
+#include "Package.h"
+
+#define PATCH_JOURNAL_EXT ".mk9undo"
+#define PATCH_BACKUP_EXT ".mk9undo.bak"
+
+// Original bytes saved per journal batch before the package is written; the
+// journal and the package are synced once per batch, not once per sample.
+#define PATCH_JOURNAL_BATCH_BYTES (16 << 20)
+
+// On-disk layout, all little-endian: header, then records. A range record is
+// followed by the original bytes of the range, a commit record by one hash of
+// the new bytes per range record (or of the new file's fingerprint after a
+// whole-file backup). A record cut short by a crash is ignored.
+#pragma pack(push, 1)
+struct PatchJournalHeader {
+    char magic[8]; // "MK9UNDO1"
+    uint64_t packageSize;
+};
+
+struct PatchJournalRecord {
+    uint32_t type; // 'R' range, 'F' whole-file backup, 'C' commit
+    uint32_t size; // Range: byte count. Commit: number of hashes that follow
+    uint64_t offset;
+    uint64_t hash; // Range: XXH64 of the original bytes
+};
+#pragma pack(pop)
+
+// Write-ahead undo log of one patch run, kept next to the package as
+// <package>.mk9undo. Ranges patched in place have their original bytes
+// appended before they are overwritten; packages that are rebuilt keep the
+// previous file as a hard link (<package>.mk9undo.bak) instead.
+class PatchJournal {
+public:
+    PatchJournal();
+
+    // Starts a journal for packagePath, replacing the one of an earlier,
+    // completed run. Fails if an interrupted run still needs a rollback.
+    bool Begin(const std::string& packagePath);
+    // Appends the current bytes of ranges and syncs the journal.
+    bool SaveRanges(const RandomAccessFile& package, const std::vector<PackageRange>& ranges);
+    // Keeps the current package file as the backup before it is replaced.
+    bool SaveWholeFile();
+    // Records the patched state, after the package itself has been synced.
+    bool Commit();
+
+private:
+    PatchJournal(const PatchJournal&);
+    PatchJournal& operator=(const PatchJournal&);
+
+    std::string packagePath;
+    RandomAccessFile file;
+    uint64_t end;
+    std::vector<PackageRange> saved;
+    bool wholeFile;
+};
+
+// True if packagePath has a journal whose run never committed.
+bool HasInterruptedPatch(const std::string& packagePath);
+// Restores the package to its state before the journaled run and removes the journal.
+bool RollbackPatch(const std::string& packagePath);
+// Reports whether the journaled run is fully applied, untouched, or partial.
+bool VerifyPatch(const std::string& packagePath);
+
+// Set from the command line; makes every patch run journaled.
+void SetPatchJournaling(bool enabled);
+bool PatchJournaling();
+
+#endif
@@ -0,0 +1,228 @@
+#include "Json.h"
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : text(text), pos(0) {}
+
+    bool Parse(JsonValue& value, std::string& error) {
+        if (!ParseValue(value, 0) || (SkipSpace(), pos != text.size())) {
+            if (message.empty()) message = "unexpected character";
+            error = message + " at offset " + std::to_string(pos);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const int MAX_DEPTH = 64;
+
+    void SkipSpace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) pos++;
+    }
+
+    bool Literal(const char* word) {
+        size_t n = strlen(word);
+        if (text.compare(pos, n, word) != 0) return false;
+        pos += n;
+        return true;
+    }
+
+    bool ParseValue(JsonValue& value, int depth) {
+        SkipSpace();
+        if (pos >= text.size()) {
+            message = "unexpected end";
+            return false;
+        }
+        if (depth > MAX_DEPTH) {
+            message = "nested too deeply";
+            return false;
+        }
+        char c = text[pos];
+        if (c == '{') return ParseObject(value, depth);
+        if (c == '[') return ParseArray(value, depth);
+        if (c == '"') {
+            value.type = JsonValue::String;
+            return ParseString(value.string);
+        }
+        if (Literal("true")) {
+            value.type = JsonValue::Bool;
+            value.boolean = true;
+            return true;
+        }
+        if (Literal("false")) {
+            value.type = JsonValue::Bool;
+            value.boolean = false;
+            return true;
+        }
+        if (Literal("null")) {
+            value.type = JsonValue::Null;
+            return true;
+        }
+        const char* start = text.c_str() + pos;
+        char* end = nullptr;
+        value.number = strtod(start, &end);
+        if (end == start) return false;
+        value.type = JsonValue::Number;
+        pos += end - start;
+        return true;
+    }
+
+    bool ParseObject(JsonValue& value, int depth) {
+        value.type = JsonValue::Object;
+        pos++;
+        SkipSpace();
+        if (pos < text.size() && text[pos] == '}') {
+            pos++;
+            return true;
+        }
+        while (true) {
+            SkipSpace();
+            std::string key;
+            if (pos >= text.size() || text[pos] != '"' || !ParseString(key)) return false;
+            SkipSpace();
+            if (pos >= text.size() || text[pos] != ':') return false;
+            pos++;
+            value.members.push_back(std::make_pair(key, JsonValue()));
+            if (!ParseValue(value.members.back().second, depth + 1)) return false;
+            SkipSpace();
+            if (pos < text.size() && text[pos] == ',') {
+                pos++;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == '}') {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+    }
+
+    bool ParseArray(JsonValue& value, int depth) {
+        value.type = JsonValue::Array;
+        pos++;
+        SkipSpace();
+        if (pos < text.size() && text[pos] == ']') {
+            pos++;
+            return true;
+        }
+        while (true) {
+            value.items.push_back(JsonValue());
+            if (!ParseValue(value.items.back(), depth + 1)) return false;
+            SkipSpace();
+            if (pos < text.size() && text[pos] == ',') {
+                pos++;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == ']') {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+    }
+
+    bool ParseString(std::string& out) {
+        pos++; // Opening quote
+        while (pos < text.size()) {
+            char c = text[pos++];
+            if (c == '"') return true;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= text.size()) break;
+            char e = text[pos++];
+            switch (e) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                if (pos + 4 > text.size()) return false;
+                unsigned cp = (unsigned)strtoul(text.substr(pos, 4).c_str(), nullptr, 16);
+                pos += 4;
+                // Encoded as UTF-8; surrogate pairs are not needed for file names here.
+                if (cp < 0x80) {
+                    out += (char)cp;
+                } else if (cp < 0x800) {
+                    out += (char)(0xC0 | (cp >> 6));
+                    out += (char)(0x80 | (cp & 0x3F));
+                } else {
+                    out += (char)(0xE0 | (cp >> 12));
+                    out += (char)(0x80 | ((cp >> 6) & 0x3F));
+                    out += (char)(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:
+                message = "bad escape";
+                return false;
+            }
+        }
+        message = "unterminated string";
+        return false;
+    }
+
+    const std::string& text;
+    size_t pos;
+    std::string message;
+};
+
+} // namespace
+
+const JsonValue* JsonValue::Get(const std::string& key) const {
+    for (const auto& m : members) {
+        if (m.first == key) return &m.second;
+    }
+    return nullptr;
+}
+
+std::string JsonValue::GetString(const std::string& key, const std::string& fallback) const {
+    const JsonValue* v = Get(key);
+    return v && v->type == String ? v->string : fallback;
+}
+
+uint64_t JsonValue::GetUInt(const std::string& key, uint64_t fallback) const {
+    const JsonValue* v = Get(key);
+    return v && v->type == Number && v->number >= 0 ? (uint64_t)v->number : fallback;
+}
+
+bool JsonValue::GetBool(const std::string& key, bool fallback) const {
+    const JsonValue* v = Get(key);
+    return v && v->type == Bool ? v->boolean : fallback;
+}
+
+bool ParseJson(const std::string& text, JsonValue& value, std::string& error) {
+    JsonParser parser(text);
+    return parser.Parse(value, error);
+}
+
+std::string JsonQuote(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+    }
+    return out + "\"";
+}
@@ -0,0 +1,40 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include "Utils.h"
+
+// Just enough JSON for the files MK9Tool writes and reads back: a parsed
+// value tree and string escaping for writers.
+struct JsonValue {
+    enum Type {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    Type type;
+    bool boolean;
+    double number;
+    std::string string;
+    std::vector<JsonValue> items;                              // Array
+    std::vector<std::pair<std::string, JsonValue>> members;    // Object, in file order
+
+    JsonValue() : type(Null), boolean(false), number(0) {}
+
+    // Member named key of an object, or nullptr.
+    const JsonValue* Get(const std::string& key) const;
+    // Typed member access with a fallback for missing or mistyped members.
+    std::string GetString(const std::string& key, const std::string& fallback = std::string()) const;
+    uint64_t GetUInt(const std::string& key, uint64_t fallback = 0) const;
+    bool GetBool(const std::string& key, bool fallback = false) const;
+};
+
+// Parses text as one JSON value. On failure error holds the reason and the offset.
+bool ParseJson(const std::string& text, JsonValue& value, std::string& error);
+// Returns s as a quoted JSON string.
+std::string JsonQuote(const std::string& s);
+
+#endif
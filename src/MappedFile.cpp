@@ -0,0 +1,130 @@
+#include "MappedFile.h"
+#include "Stats.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : data(nullptr), size(0), mapped(false), opened(false) {
+#ifdef _WIN32
+    fileHandle = INVALID_HANDLE_VALUE;
+    mappingHandle = NULL;
+#endif
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+    CountOpen();
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize)) {
+        CloseHandle(hFile);
+        return false;
+    }
+    size = (size_t)fileSize.QuadPart;
+    opened = true;
+    if (size == 0) {
+        CloseHandle(hFile);
+        return true;
+    }
+
+    HANDLE hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMap != NULL) {
+        void* view = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+        if (view != NULL) {
+            fileHandle = hFile;
+            mappingHandle = hMap;
+            data = (const char*)view;
+            mapped = true;
+            CountMapped(size);
+            return true;
+        }
+        CloseHandle(hMap);
+    }
+    CloseHandle(hFile);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    CountOpen();
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    size = (size_t)st.st_size;
+    opened = true;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view != MAP_FAILED) {
+        madvise(view, size, MADV_SEQUENTIAL);
+        data = (const char*)view;
+        mapped = true;
+        CountMapped(size);
+        return true;
+    }
+#endif
+
+    return ReadFallback(path);
+}
+
+bool MappedFile::ReadFallback(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f.is_open()) {
+        Close();
+        return false;
+    }
+    CountOpen();
+
+    buffer.resize(size);
+    const size_t blockSize = 1 << 20;
+    size_t done = 0;
+    while (done < size) {
+        size_t chunk = (size - done > blockSize) ? blockSize : size - done;
+        if (!f.read(buffer.data() + done, chunk)) break;
+        done += chunk;
+    }
+    CountRead(done);
+    buffer.resize(done);
+    size = done;
+    data = buffer.data();
+    opened = true;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (mapped) {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle((HANDLE)mappingHandle);
+        CloseHandle((HANDLE)fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        munmap((void*)data, size);
+#endif
+    }
+    std::vector<char>().swap(buffer);
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    opened = false;
+}
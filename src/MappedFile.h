@@ -0,0 +1,38 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "Utils.h"
+
+// Read-only view of a whole file. Uses mmap/MapViewOfFile when possible and
+// falls back to reading the file into memory with large buffered reads.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool Open(const std::string& path);
+    void Close();
+
+    const char* Data() const { return data; }
+    size_t Size() const { return size; }
+    bool IsOpen() const { return opened; }
+    bool IsMapped() const { return mapped; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    bool ReadFallback(const std::string& path);
+
+    const char* data;
+    size_t size;
+    bool mapped;
+    bool opened;
+    std::vector<char> buffer;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+};
+
+#endif
@@ -0,0 +1,452 @@
+#include "Package.h"
+#include "Compression.h"
+#include "Stats.h"
+#include <atomic>
+#include <cstdio>
+
+namespace {
+
+struct SummaryReader {
+    const char* data;
+    size_t size;
+    size_t pos;
+    bool ok;
+
+    uint32_t U32() {
+        if (pos + 4 > size) {
+            ok = false;
+            pos = size;
+            return 0;
+        }
+        uint32_t v = ReadBE32(data + pos);
+        pos += 4;
+        return v;
+    }
+
+    void Skip(size_t n) {
+        if (pos + n > size) {
+            ok = false;
+            pos = size;
+            return;
+        }
+        pos += n;
+    }
+
+    std::string String() {
+        int32_t len = (int32_t)U32();
+        std::string s;
+        if (len > 0) {
+            if ((size_t)len > size - pos) {
+                ok = false;
+                return s;
+            }
+            s.assign(data + pos, len - 1);
+            pos += len;
+        } else if (len < 0) {
+            // UTF-16 name; keep the low byte of each character
+            size_t chars = (size_t)(-(int64_t)len);
+            if (chars * 2 > size - pos) {
+                ok = false;
+                return s;
+            }
+            for (size_t i = 0; i + 1 < chars; ++i) s += data[pos + i * 2 + 1];
+            pos += chars * 2;
+        }
+        return s;
+    }
+};
+
+} // namespace
+
+bool ReadPackageSummary(const char* data, size_t size, PackageSummary& summary) {
+    ScopedPhase phase("header parse");
+    SummaryReader r = { data, size, 0, true };
+
+    summary.tag = r.U32();
+    if (!r.ok || summary.tag != PACKAGE_FILE_TAG) return false;
+
+    uint32_t version = r.U32();
+    summary.fileVersion = (uint16_t)(version & 0xFFFF);
+    summary.licenseeVersion = (uint16_t)(version >> 16);
+    summary.headerSize = r.U32();
+
+    // MK9 inserts an "MK  " marker and one extra field before the folder name
+    if (r.pos + 4 <= size && memcmp(data + r.pos, "  KM", 4) == 0) r.Skip(8);
+
+    summary.folderName = r.String();
+    summary.packageFlags = r.U32();
+    summary.nameCount = r.U32();
+    summary.nameOffset = r.U32();
+    summary.exportCount = r.U32();
+    summary.exportOffset = r.U32();
+    summary.importCount = r.U32();
+    summary.importOffset = r.U32();
+    summary.dependsOffset = r.U32();
+    r.Skip(4);  // Unused in MK9 packages, always zero
+    r.Skip(16); // Package GUID
+    summary.engineVersion = r.U32();
+    summary.cookerVersion = r.U32();
+    summary.compressionFlags = r.U32();
+
+    summary.chunkTableOffset = (uint32_t)r.pos;
+    uint32_t numChunks = r.U32();
+    if (!r.ok || numChunks > (size - r.pos) / 16) return false;
+
+    summary.chunks.clear();
+    for (uint32_t i = 0; i < numChunks; ++i) {
+        CompressedChunk c;
+        c.uncompressedOffset = r.U32();
+        c.uncompressedSize = r.U32();
+        c.compressedOffset = r.U32();
+        c.compressedSize = r.U32();
+        summary.chunks.push_back(c);
+    }
+    summary.summaryEnd = (uint32_t)r.pos;
+    return r.ok;
+}
+
+bool ReadNameTable(const char* data, size_t size, const PackageSummary& summary, std::vector<std::string>& names) {
+    names.clear();
+    SummaryReader r = { data, size, summary.nameOffset, summary.nameOffset <= size };
+    for (uint32_t i = 0; i < summary.nameCount && r.ok; ++i) {
+        names.push_back(r.String());
+        r.Skip(8); // Object flags
+    }
+    return r.ok;
+}
+
+bool ReadImportTable(const char* data, size_t size, const PackageSummary& summary, std::vector<PackageImport>& imports) {
+    imports.clear();
+    if (summary.importOffset > size || summary.importCount > (size - summary.importOffset) / 28) return false;
+    for (uint32_t i = 0; i < summary.importCount; ++i) {
+        const char* p = data + summary.importOffset + (size_t)i * 28;
+        PackageImport imp;
+        imp.classPackage = (int32_t)ReadBE32(p);
+        imp.className = (int32_t)ReadBE32(p + 8);
+        imp.outerIndex = (int32_t)ReadBE32(p + 16);
+        imp.objectName = (int32_t)ReadBE32(p + 20);
+        imp.objectNumber = (int32_t)ReadBE32(p + 24);
+        imports.push_back(imp);
+    }
+    return true;
+}
+
+bool ReadExportTable(const char* data, size_t size, const PackageSummary& summary, std::vector<PackageExport>& exports) {
+    exports.clear();
+    size_t pos = summary.exportOffset;
+    for (uint32_t i = 0; i < summary.exportCount; ++i) {
+        if (pos + 44 > size) return false;
+        PackageExport e;
+        e.entryOffset = (uint32_t)pos;
+        e.classIndex = (int32_t)ReadBE32(data + pos);
+        e.superIndex = (int32_t)ReadBE32(data + pos + 4);
+        e.outerIndex = (int32_t)ReadBE32(data + pos + 8);
+        e.nameIndex = (int32_t)ReadBE32(data + pos + 12);
+        e.nameNumber = (int32_t)ReadBE32(data + pos + 16);
+        e.archetypeIndex = (int32_t)ReadBE32(data + pos + 20);
+        e.objectFlags = ((uint64_t)ReadBE32(data + pos + 24) << 32) | ReadBE32(data + pos + 28);
+        e.serialSize = ReadBE32(data + pos + EXPORT_SERIAL_SIZE_FIELD);
+        e.serialOffset = ReadBE32(data + pos + EXPORT_SERIAL_OFFSET_FIELD);
+        uint32_t components = ReadBE32(data + pos + 40);
+        if (components > (size - pos - 44) / 12) return false;
+        pos += 44 + (size_t)components * 12;
+        if (pos + 20 > size) return false;
+        e.exportFlags = ReadBE32(data + pos);
+        pos += 20;
+        exports.push_back(e);
+    }
+    return pos <= size;
+}
+
+bool ReadChunkBlocks(const char* data, size_t size, const CompressedChunk& chunk, std::vector<CompressedBlock>& blocks) {
+    blocks.clear();
+    size_t pos = chunk.compressedOffset;
+    if (pos + 16 > size || ReadBE32(data + pos) != PACKAGE_FILE_TAG) return false;
+
+    uint32_t blockSize = ReadBE32(data + pos + 4);
+    uint32_t totalUncompressed = ReadBE32(data + pos + 12);
+    if (blockSize == 0 || totalUncompressed != chunk.uncompressedSize) return false;
+
+    size_t numBlocks = (totalUncompressed + blockSize - 1) / blockSize;
+    size_t tableEnd = pos + 16 + numBlocks * 8;
+    if (tableEnd > size) return false;
+
+    size_t payload = tableEnd;
+    uint32_t uncompressedOffset = chunk.uncompressedOffset;
+    for (size_t i = 0; i < numBlocks; ++i) {
+        CompressedBlock b;
+        b.compressedSize = ReadBE32(data + pos + 16 + i * 8);
+        b.uncompressedSize = ReadBE32(data + pos + 16 + i * 8 + 4);
+        b.compressedOffset = (uint32_t)payload;
+        b.uncompressedOffset = uncompressedOffset;
+        if (payload + b.compressedSize > size) return false;
+        payload += b.compressedSize;
+        uncompressedOffset += b.uncompressedSize;
+        blocks.push_back(b);
+    }
+    return uncompressedOffset == chunk.uncompressedOffset + chunk.uncompressedSize;
+}
+
+PackageTables::PackageTables(const XXXPackage& package)
+    : package(package), namesState(NotRead), importsState(NotRead), exportsState(NotRead) {
+}
+
+const std::vector<std::string>* PackageTables::Names() {
+    if (namesState == NotRead) {
+        ScopedPhase phase("header parse");
+        bool ok = package.HasSummary() && ReadNameTable(package.Data(), package.Size(), package.Summary(), names);
+        namesState = ok ? Read : Unreadable;
+    }
+    return namesState == Read ? &names : nullptr;
+}
+
+const std::vector<PackageImport>* PackageTables::Imports() {
+    if (importsState == NotRead) {
+        ScopedPhase phase("header parse");
+        bool ok = package.HasSummary() && ReadImportTable(package.Data(), package.Size(), package.Summary(), imports);
+        importsState = ok ? Read : Unreadable;
+    }
+    return importsState == Read ? &imports : nullptr;
+}
+
+const std::vector<PackageExport>* PackageTables::Exports() {
+    if (exportsState == NotRead) {
+        ScopedPhase phase("header parse");
+        bool ok = package.HasSummary() && ReadExportTable(package.Data(), package.Size(), package.Summary(), exports);
+        exportsState = ok ? Read : Unreadable;
+    }
+    return exportsState == Read ? &exports : nullptr;
+}
+
+std::string PackageTables::Name(int32_t index, int32_t number) {
+    const std::vector<std::string>* table = Names();
+    if (!table || index < 0 || (size_t)index >= table->size()) return std::string();
+    if (number > 0) return (*table)[index] + "_" + std::to_string(number - 1);
+    return (*table)[index];
+}
+
+std::string PackageTables::ObjectName(int32_t ref) {
+    if (ref < 0) {
+        const std::vector<PackageImport>* table = Imports();
+        size_t i = (size_t)(-(int64_t)ref) - 1;
+        if (!table || i >= table->size()) return std::string();
+        return Name((*table)[i].objectName, (*table)[i].objectNumber);
+    }
+    if (ref > 0) {
+        const std::vector<PackageExport>* table = Exports();
+        size_t i = (size_t)ref - 1;
+        if (!table || i >= table->size()) return std::string();
+        return Name((*table)[i].nameIndex, (*table)[i].nameNumber);
+    }
+    return std::string();
+}
+
+std::string PackageTables::ClassName(const PackageExport& e) {
+    return e.classIndex == 0 ? "Class" : ObjectName(e.classIndex);
+}
+
+XXXPackage::XXXPackage() : hasSummary(false), compressed(false), data(nullptr), size(0) {
+}
+
+bool XXXPackage::Open(const std::string& packagePath, std::ostream& log) {
+    ScopedPhase phase("open", packagePath);
+    Close();
+    if (!file.Open(packagePath)) return false;
+    path = packagePath;
+
+    data = file.Data();
+    size = file.Size();
+    hasSummary = ReadPackageSummary(data, size, summary);
+    if (hasSummary && (summary.packageFlags & PKG_StoreCompressed) && !summary.chunks.empty()) {
+        if (summary.compressionFlags != COMPRESS_ZLIB) {
+            log << "Warning: Unsupported package compression (flags 0x" << std::hex << summary.compressionFlags << std::dec << ")" << std::endl;
+            return true;
+        }
+        if (!Decompress()) {
+            log << "Warning: Failed to decompress package chunks, using raw file data" << std::endl;
+            uncompressed.clear();
+            data = file.Data();
+            size = file.Size();
+            return true;
+        }
+        compressed = true;
+    }
+    return true;
+}
+
+void XXXPackage::Close() {
+    file.Close();
+    path.clear();
+    std::vector<char>().swap(uncompressed);
+    hasSummary = false;
+    compressed = false;
+    data = nullptr;
+    size = 0;
+}
+
+bool XXXPackage::Decompress() {
+    ScopedPhase phase("decompress");
+    const char* raw = file.Data();
+    size_t rawSize = file.Size();
+
+    std::vector<CompressedBlock> blocks;
+    size_t totalSize = summary.chunks.front().uncompressedOffset;
+    for (const auto& chunk : summary.chunks) {
+        std::vector<CompressedBlock> chunkBlocks;
+        if (!ReadChunkBlocks(raw, rawSize, chunk, chunkBlocks)) return false;
+        blocks.insert(blocks.end(), chunkBlocks.begin(), chunkBlocks.end());
+        size_t chunkEnd = (size_t)chunk.uncompressedOffset + chunk.uncompressedSize;
+        if (chunkEnd > totalSize) totalSize = chunkEnd;
+    }
+    if (summary.chunks.front().uncompressedOffset > rawSize) return false;
+    if (totalSize > rawSize * 64 + (64u << 20)) return false;
+
+    // Everything before the first chunk (the summary itself) is stored
+    // uncompressed. The whole view is allocated up front: callers read it as
+    // one contiguous package, so it cannot be inflated lazily per chunk.
+    uncompressed.assign(totalSize, 0);
+    memcpy(uncompressed.data(), raw, summary.chunks.front().uncompressedOffset);
+
+    // Each block inflates straight from the mapping into its final slot, so no
+    // per-chunk staging buffers are needed and blocks can run on any core.
+    std::atomic<bool> ok(true);
+    char* out = uncompressed.data();
+    ParallelFor(blocks.size(), [&](size_t i) {
+        const CompressedBlock& b = blocks[i];
+        if (!ZlibInflate(raw + b.compressedOffset, b.compressedSize, out + b.uncompressedOffset, b.uncompressedSize)) {
+            ok = false;
+        }
+    });
+    if (!ok) return false;
+
+    data = uncompressed.data();
+    size = uncompressed.size();
+    return true;
+}
+
+bool XXXPackage::CommitCompressed(const std::vector<PackageRange>& dirty, RecompressStats& stats) {
+    if (!compressed) return false;
+    std::string target = path;
+    std::string tmpPath = target + ".tmp";
+    bool ok = WriteCompressedPackage(*this, dirty, tmpPath, stats);
+    Close();
+    if (!ok) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return ReplaceFileWith(tmpPath, target);
+}
+
+bool WriteCompressedPackage(const XXXPackage& package, const std::vector<PackageRange>& dirty, const std::string& outPath,
+                            RecompressStats& stats) {
+    ScopedPhase phase("recompress", outPath);
+    const char* raw = package.File().Data();
+    size_t rawSize = package.File().Size();
+    const char* view = package.Data();
+    const PackageSummary& summary = package.Summary();
+    if (!package.IsCompressed() || summary.chunks.empty()) return false;
+
+    struct ChunkPlan {
+        std::vector<CompressedBlock> blocks;
+        std::vector<int> newBlock; // Index into recompressed, or -1 to copy the original block
+        uint32_t newSize;
+    };
+    std::vector<ChunkPlan> plans(summary.chunks.size());
+    std::vector<const CompressedBlock*> dirtyBlocks;
+
+    for (size_t i = 0; i < summary.chunks.size(); ++i) {
+        ChunkPlan& plan = plans[i];
+        if (!ReadChunkBlocks(raw, rawSize, summary.chunks[i], plan.blocks)) return false;
+        plan.newBlock.assign(plan.blocks.size(), -1);
+        for (size_t b = 0; b < plan.blocks.size(); ++b) {
+            const CompressedBlock& block = plan.blocks[b];
+            for (const auto& r : dirty) {
+                if (r.offset < block.uncompressedOffset + block.uncompressedSize &&
+                    block.uncompressedOffset < r.offset + r.size) {
+                    plan.newBlock[b] = (int)dirtyBlocks.size();
+                    dirtyBlocks.push_back(&block);
+                    break;
+                }
+            }
+        }
+    }
+
+    std::vector<std::vector<char> > recompressed(dirtyBlocks.size());
+    ParallelFor(dirtyBlocks.size(), [&](size_t i) {
+        const CompressedBlock& b = *dirtyBlocks[i];
+        ZlibDeflate(view + b.uncompressedOffset, b.uncompressedSize, recompressed[i]);
+    });
+
+    // Rebuild the chunk table in a copy of the raw header region.
+    uint32_t firstCompressed = summary.chunks.front().compressedOffset;
+    for (const auto& chunk : summary.chunks) {
+        if (chunk.compressedOffset < firstCompressed) firstCompressed = chunk.compressedOffset;
+    }
+    std::vector<char> header(raw, raw + firstCompressed);
+    uint32_t firstUncompressed = summary.chunks.front().uncompressedOffset;
+    if (firstUncompressed > header.size()) firstUncompressed = (uint32_t)header.size();
+    memcpy(header.data(), view, firstUncompressed);
+
+    int64_t shift = 0;
+    std::vector<uint32_t> newOffsets(summary.chunks.size());
+    for (size_t i = 0; i < summary.chunks.size(); ++i) {
+        ChunkPlan& plan = plans[i];
+        const CompressedChunk& chunk = summary.chunks[i];
+        plan.newSize = 16 + (uint32_t)plan.blocks.size() * 8;
+        for (size_t b = 0; b < plan.blocks.size(); ++b) {
+            plan.newSize += plan.newBlock[b] < 0 ? plan.blocks[b].compressedSize : (uint32_t)recompressed[plan.newBlock[b]].size();
+        }
+        newOffsets[i] = (uint32_t)(chunk.compressedOffset + shift);
+        shift += (int64_t)plan.newSize - chunk.compressedSize;
+
+        char* entry = header.data() + summary.chunkTableOffset + 4 + i * 16;
+        WriteBE32(entry + 8, newOffsets[i]);
+        WriteBE32(entry + 12, plan.newSize);
+    }
+
+    std::ofstream out(outPath, std::ios::binary);
+    if (!out.is_open()) return false;
+    out.write(header.data(), header.size());
+
+    size_t rawPos = firstCompressed;
+    for (size_t i = 0; i < summary.chunks.size(); ++i) {
+        const CompressedChunk& chunk = summary.chunks[i];
+        const ChunkPlan& plan = plans[i];
+
+        // Keep whatever sits between chunks (normally nothing)
+        if (chunk.compressedOffset > rawPos) out.write(raw + rawPos, chunk.compressedOffset - rawPos);
+
+        bool touched = false;
+        for (int nb : plan.newBlock) touched |= nb >= 0;
+        if (!touched) {
+            out.write(raw + chunk.compressedOffset, chunk.compressedSize);
+        } else {
+            std::vector<char> table(16 + plan.blocks.size() * 8);
+            WriteBE32(table.data(), PACKAGE_FILE_TAG);
+            memcpy(table.data() + 4, raw + chunk.compressedOffset + 4, 4); // Block size
+            WriteBE32(table.data() + 8, plan.newSize - (uint32_t)table.size());
+            WriteBE32(table.data() + 12, chunk.uncompressedSize);
+            for (size_t b = 0; b < plan.blocks.size(); ++b) {
+                uint32_t size = plan.newBlock[b] < 0 ? plan.blocks[b].compressedSize : (uint32_t)recompressed[plan.newBlock[b]].size();
+                WriteBE32(table.data() + 16 + b * 8, size);
+                WriteBE32(table.data() + 16 + b * 8 + 4, plan.blocks[b].uncompressedSize);
+            }
+            out.write(table.data(), table.size());
+            for (size_t b = 0; b < plan.blocks.size(); ++b) {
+                if (plan.newBlock[b] < 0) {
+                    out.write(raw + plan.blocks[b].compressedOffset, plan.blocks[b].compressedSize);
+                } else {
+                    const std::vector<char>& block = recompressed[plan.newBlock[b]];
+                    out.write(block.data(), block.size());
+                }
+            }
+        }
+        rawPos = (size_t)chunk.compressedOffset + chunk.compressedSize;
+    }
+    if (rawPos < rawSize) out.write(raw + rawPos, rawSize - rawPos);
+
+    stats.blocks = (uint32_t)dirtyBlocks.size();
+    stats.oldSize = rawSize;
+    stats.newSize = (uint64_t)((int64_t)rawSize + shift);
+    return out.good();
+}
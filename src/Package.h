@@ -0,0 +1,180 @@
+#ifndef PACKAGE_H
+#define PACKAGE_H
+
+#include "MappedFile.h"
+
+#define PACKAGE_FILE_TAG 0x9E2A83C1
+#define PKG_StoreCompressed 0x02000000
+
+#define COMPRESS_None 0x00
+#define COMPRESS_ZLIB 0x01
+#define COMPRESS_LZO 0x02
+#define COMPRESS_LZX 0x04
+
+struct CompressedChunk {
+    uint32_t uncompressedOffset;
+    uint32_t uncompressedSize;
+    uint32_t compressedOffset;
+    uint32_t compressedSize;
+};
+
+// Big-endian UE3 package summary as written by the MK9 PS3 cooker.
+struct PackageSummary {
+    uint32_t tag;
+    uint16_t fileVersion;
+    uint16_t licenseeVersion;
+    uint32_t headerSize;
+    std::string folderName;
+    uint32_t packageFlags;
+    uint32_t nameCount;
+    uint32_t nameOffset;
+    uint32_t exportCount;
+    uint32_t exportOffset;
+    uint32_t importCount;
+    uint32_t importOffset;
+    uint32_t dependsOffset;
+    uint32_t engineVersion;
+    uint32_t cookerVersion;
+    uint32_t compressionFlags;
+    std::vector<CompressedChunk> chunks;
+
+    uint32_t chunkTableOffset; // File offset of the chunk count
+    uint32_t summaryEnd;       // File offset just past the chunk table
+};
+
+// UE3 compressed chunks are a header followed by independently compressed blocks.
+struct CompressedBlock {
+    uint32_t compressedOffset;   // File offset of the block payload
+    uint32_t compressedSize;
+    uint32_t uncompressedOffset; // Offset in the uncompressed package
+    uint32_t uncompressedSize;
+};
+
+// A byte range in the uncompressed view of a package.
+struct PackageRange {
+    uint32_t offset;
+    uint32_t size;
+};
+
+// What a recompression changed.
+struct RecompressStats {
+    uint32_t blocks;  // Blocks deflated again
+    uint64_t oldSize; // Package size on disk before and after
+    uint64_t newSize;
+};
+
+// One entry of the export table. MK9 entries are ten big-endian fields, a
+// component map (a count of 12-byte name/export pairs), the export flags and
+// a 16-byte GUID.
+struct PackageExport {
+    int32_t classIndex;
+    int32_t superIndex;
+    int32_t outerIndex;
+    int32_t nameIndex;
+    int32_t nameNumber;
+    int32_t archetypeIndex;
+    uint64_t objectFlags;
+    uint32_t serialSize;
+    uint32_t serialOffset;
+    uint32_t exportFlags;
+    uint32_t entryOffset; // File offset of the entry itself
+};
+
+#define EXPORT_SERIAL_SIZE_FIELD 32
+#define EXPORT_SERIAL_OFFSET_FIELD 36
+
+// One entry of the import table; every field but outerIndex is a name index.
+struct PackageImport {
+    int32_t classPackage;
+    int32_t className;
+    int32_t outerIndex;
+    int32_t objectName;
+    int32_t objectNumber;
+};
+
+bool ReadPackageSummary(const char* data, size_t size, PackageSummary& summary);
+bool ReadNameTable(const char* data, size_t size, const PackageSummary& summary, std::vector<std::string>& names);
+bool ReadImportTable(const char* data, size_t size, const PackageSummary& summary, std::vector<PackageImport>& imports);
+bool ReadExportTable(const char* data, size_t size, const PackageSummary& summary, std::vector<PackageExport>& exports);
+bool ReadChunkBlocks(const char* data, size_t size, const CompressedChunk& chunk, std::vector<CompressedBlock>& blocks);
+
+// A .XXX package seen through its uncompressed layout. Plain packages are
+// served straight from the mapping; chunk-compressed ones are inflated
+// block by block, in parallel, into a single buffer. That buffer holds the
+// whole uncompressed package for as long as it is open: memory is bounded by
+// the package's uncompressed size, not by one chunk. Packages claiming more
+// than 64 times their file size plus 64 MB are left compressed.
+class XXXPackage {
+public:
+    XXXPackage();
+
+    bool Open(const std::string& path, std::ostream& log = std::cout);
+    void Close();
+
+    const char* Data() const { return data; }
+    size_t Size() const { return size; }
+    bool HasSummary() const { return hasSummary; }
+    bool IsCompressed() const { return compressed; }
+    const PackageSummary& Summary() const { return summary; }
+    const MappedFile& File() const { return file; }
+    const std::string& Path() const { return path; }
+
+    // Writable uncompressed view; only available for compressed packages.
+    char* MutableData() { return compressed ? uncompressed.data() : nullptr; }
+
+    // Recompresses the blocks touched by dirty and replaces the package on
+    // disk. The package is closed afterwards.
+    bool CommitCompressed(const std::vector<PackageRange>& dirty, RecompressStats& stats);
+
+private:
+    XXXPackage(const XXXPackage&);
+    XXXPackage& operator=(const XXXPackage&);
+
+    bool Decompress();
+
+    MappedFile file;
+    std::string path;
+    PackageSummary summary;
+    bool hasSummary;
+    bool compressed;
+    const char* data;
+    size_t size;
+    std::vector<char> uncompressed;
+};
+
+// The name, import and export tables of an opened package. Each table is
+// read the first time it is asked for, so callers that only need exports
+// never decode the names.
+class PackageTables {
+public:
+    explicit PackageTables(const XXXPackage& package);
+
+    // Null if the package has no summary or the table is unreadable.
+    const std::vector<std::string>* Names();
+    const std::vector<PackageImport>* Imports();
+    const std::vector<PackageExport>* Exports();
+
+    // "name" or "name_N" as UE3 prints numbered names; empty if out of range.
+    std::string Name(int32_t index, int32_t number = 0);
+    // Name of an object reference: imports are negative, exports positive.
+    std::string ObjectName(int32_t ref);
+    std::string ClassName(const PackageExport& e);
+
+private:
+    enum TableState { NotRead, Read, Unreadable };
+
+    const XXXPackage& package;
+    TableState namesState, importsState, exportsState;
+    std::vector<std::string> names;
+    std::vector<PackageImport> imports;
+    std::vector<PackageExport> exports;
+};
+
+// Writes a compressed package whose uncompressed view was modified in the
+// dirty ranges. Only the overlapping blocks are recompressed; untouched
+// blocks and chunks are copied byte for byte and the chunk table is rebuilt.
+// The counts go to stats for the caller to report.
+bool WriteCompressedPackage(const XXXPackage& package, const std::vector<PackageRange>& dirty, const std::string& outPath,
+                            RecompressStats& stats);
+
+#endif
@@ -0,0 +1,362 @@
+#include "PatchBatch.h"
+#include "Catalog.h"
+#include "FileIO.h"
+#include "Journal.h"
+#include "Relocate.h"
+#include "Stats.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+const size_t STAGING_SIZE = 1 << 20;
+
+// Accumulates consecutive bytes destined for one contiguous range of the
+// package and hands them to the OS in large positional writes.
+class WriteStager {
+public:
+    WriteStager(RandomAccessFile& out, PatchStats& stats) : out(out), stats(stats), start(0), ok(true) {
+        buffer.reserve(STAGING_SIZE);
+    }
+
+    // Positions the stager at offset, flushing if it does not continue the
+    // pending run.
+    void Seek(uint64_t offset) {
+        if (!buffer.empty() && start + buffer.size() == offset) return;
+        Flush();
+        start = offset;
+    }
+
+    void Append(const char* data, uint32_t size) {
+        while (size > 0 && ok) {
+            if (buffer.size() == STAGING_SIZE) Flush();
+            size_t n = std::min<size_t>(STAGING_SIZE - buffer.size(), size);
+            buffer.insert(buffer.end(), data, data + n);
+            data += n;
+            size -= (uint32_t)n;
+        }
+    }
+
+    bool CopyFrom(const RandomAccessFile& src, uint64_t srcPos, uint32_t size) {
+        while (size > 0 && ok) {
+            if (buffer.size() == STAGING_SIZE) Flush();
+            size_t n = STAGING_SIZE - buffer.size();
+            if (n > size) n = size;
+            size_t have = buffer.size();
+            buffer.resize(have + n);
+            if (!src.ReadAt(srcPos, buffer.data() + have, n)) {
+                buffer.resize(have);
+                return false;
+            }
+            srcPos += n;
+            size -= (uint32_t)n;
+        }
+        return ok;
+    }
+
+    // Small gaps ride along with the staged data; large ones are written
+    // straight from the shared zero page.
+    void Zero(uint32_t size) {
+        if (size == 0) return;
+        if (buffer.size() + size <= STAGING_SIZE) {
+            buffer.resize(buffer.size() + size, 0);
+            return;
+        }
+        uint64_t offset = start + buffer.size();
+        Flush();
+        if (ok && !out.WriteZerosAt(offset, size)) ok = false;
+        stats.bytesWritten += size;
+        stats.writeCalls++;
+        start = offset + size;
+    }
+
+    void Flush() {
+        if (buffer.empty()) return;
+        if (ok && !out.WriteAt(start, buffer.data(), buffer.size())) ok = false;
+        stats.bytesWritten += buffer.size();
+        stats.writeCalls++;
+        start += buffer.size();
+        buffer.clear();
+    }
+
+    bool Ok() const { return ok; }
+
+private:
+    RandomAccessFile& out;
+    PatchStats& stats;
+    std::vector<char> buffer;
+    uint64_t start;
+    bool ok;
+};
+
+bool WriteOrder(const PatchWrite& a, const PatchWrite& b) {
+    return a.offset < b.offset;
+}
+
+// Writes the original bytes of w's slot, for a skipped write in an output
+// file whose slots were left as holes.
+bool CopyOriginalSlot(WriteStager& stager, const std::string& originalPath, const PatchWrite& w) {
+    RandomAccessFile original;
+    if (!original.Open(originalPath, RandomAccessFile::ReadOnly)) return false;
+    stager.Seek(w.offset);
+    return stager.CopyFrom(original, w.offset, w.slotSize);
+}
+
+} // namespace
+
+PatchBatch::PatchBatch() {
+}
+
+void PatchBatch::Add(const PatchWrite& write) {
+    writes.push_back(write);
+}
+
+bool PatchBatch::Apply(XXXPackage& package, PatchStats& stats, const std::string& outPath) {
+    ScopedPhase phase("write", package.Path());
+    stats.bytesWritten = 0;
+    stats.writeCalls = 0;
+    stats.seconds = 0;
+    stats.applied = 0;
+    stats.dropped = 0;
+    memset(&stats.recompressed, 0, sizeof(stats.recompressed));
+    auto begin = std::chrono::steady_clock::now();
+
+    // Writes the package cannot take are dropped here, before anything is
+    // journaled, copied or rebuilt; a rebuild only happens for a bank that
+    // can actually be relocated.
+    std::stable_sort(writes.begin(), writes.end(), WriteOrder);
+    std::vector<FSBBank> banks;
+    bool banksFound = false;
+    size_t kept = 0;
+    bool rebuild = false;
+    for (size_t i = 0; i < writes.size(); ++i) {
+        const PatchWrite& w = writes[i];
+        if ((size_t)w.offset + w.slotSize > package.Size()) {
+            std::cout << "Warning: Sample slot at 0x" << std::hex << w.offset << std::dec << " runs past the end of the package. Skipping." << std::endl;
+            continue;
+        }
+        if (w.dataSize > w.slotSize || !w.header.empty()) {
+            if (!banksFound) {
+                banks = FindPackageBanks(package);
+                banksFound = true;
+            }
+            std::string blocker = RelocationBlocker(package, banks, w);
+            if (!blocker.empty()) {
+                std::cout << "Warning: Cannot " << (w.dataSize > w.slotSize ? "grow " : "update the header of ") << w.sampleName << ", "
+                          << blocker << ". Skipping." << std::endl;
+                continue;
+            }
+            rebuild = true;
+        }
+        writes[kept++] = w;
+    }
+    stats.dropped = (uint32_t)(writes.size() - kept);
+    writes.resize(kept);
+    if (stats.dropped > 0) {
+        std::cout << "Skipped " << stats.dropped << " of " << stats.dropped + kept << " write(s)" << std::endl;
+        if (writes.empty()) return false;
+    }
+
+    std::string path = package.Path();
+    std::string target = outPath.empty() || GetAbsolutePath(outPath) == GetAbsolutePath(path) ? std::string() : outPath;
+    if (HasInterruptedPatch(path)) {
+        std::cout << "An interrupted patch of " << path << " is still journaled. Run 'rollback' (or 'verify') first." << std::endl;
+        return false;
+    }
+    // Rebuilt packages replace the file as a whole, so their journal only
+    // keeps the old file under a second name. A separate output leaves the
+    // package untouched and needs no journal.
+    PatchJournal journal;
+    bool journaled = PatchJournaling() && target.empty() && !writes.empty();
+    if (journaled && (!journal.Begin(path) || ((package.IsCompressed() || rebuild) && !journal.SaveWholeFile()))) return false;
+
+    bool ok;
+    if (package.IsCompressed()) {
+        ok = ApplyCompressed(package, stats, target);
+    } else if (rebuild) {
+        ok = ApplyRelocated(package, stats, target);
+    } else if (!target.empty()) {
+        ok = CopyForOutput(path, target, stats);
+        package.Close();
+        ok = ok && ApplyInPlace(target, stats, nullptr, path);
+    } else {
+        package.Close();
+        ok = ApplyInPlace(path, stats, journaled ? &journal : nullptr);
+    }
+    if (ok && journaled && !journal.Commit()) {
+        std::cout << "Failed to commit the patch journal of " << path << std::endl;
+        ok = false;
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return ok;
+}
+
+bool PatchBatch::ApplyInPlace(const std::string& path, PatchStats& stats, PatchJournal* journal, const std::string& originalPath) {
+    if (writes.empty()) return true;
+    RandomAccessFile out;
+    if (!out.Open(path, RandomAccessFile::ReadWrite)) {
+        std::cout << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    WriteStager stager(out, stats);
+    RandomAccessFile src;
+    std::string srcPath;
+    size_t batchEnd = 0;
+    for (size_t i = 0; i < writes.size(); ++i) {
+        const PatchWrite& w = writes[i];
+        if (journal && i == batchEnd && !JournalBatch(out, *journal, i, batchEnd)) {
+            std::cout << "Failed to journal " << path << std::endl;
+            return false;
+        }
+        if (!w.data.empty()) {
+            stager.Seek(w.offset);
+            stager.Append(w.data.data(), w.dataSize);
+            stager.Zero(w.slotSize - w.dataSize);
+            stats.applied++;
+            continue;
+        }
+        // Donor banks feed many writes; keep their handle open.
+        if (w.sourcePath != srcPath) {
+            srcPath.clear();
+            src.Close();
+            if (!src.Open(w.sourcePath, RandomAccessFile::ReadOnly)) {
+                std::cout << "Warning: Failed to open " << w.sourcePath << ". Skipping." << std::endl;
+                if (!originalPath.empty() && !CopyOriginalSlot(stager, originalPath, w)) {
+                    std::cout << "Failed to copy the original slot of " << w.sampleName << " from " << originalPath << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            srcPath = w.sourcePath;
+        }
+        stager.Seek(w.offset);
+        if (!stager.CopyFrom(src, w.sourceOffset, w.dataSize)) {
+            std::cout << "Failed to read " << w.sourcePath << std::endl;
+            return false;
+        }
+        stager.Zero(w.slotSize - w.dataSize);
+        stats.applied++;
+    }
+    stager.Flush();
+    return stager.Ok() && (!journal || out.Sync());
+}
+
+bool PatchBatch::JournalBatch(const RandomAccessFile& out, PatchJournal& journal, size_t first, size_t& end) {
+    ScopedPhase phase("journal");
+    // The journal is synced before any byte of the batch is overwritten; the
+    // package itself is only synced once, before the commit.
+    std::vector<PackageRange> ranges;
+    uint64_t bytes = 0;
+    end = first;
+    while (end < writes.size() && (end == first || bytes + writes[end].slotSize <= PATCH_JOURNAL_BATCH_BYTES)) {
+        const PatchWrite& w = writes[end++];
+        bytes += w.slotSize;
+        if (!ranges.empty() && ranges.back().offset + ranges.back().size == w.offset) {
+            ranges.back().size += w.slotSize;
+        } else if (!ranges.empty() && ranges.back().offset == w.offset) {
+            if (w.slotSize > ranges.back().size) ranges.back().size = w.slotSize;
+        } else {
+            PackageRange range = { w.offset, w.slotSize };
+            ranges.push_back(range);
+        }
+    }
+    return journal.SaveRanges(out, ranges);
+}
+
+bool PatchBatch::ApplyCompressed(XXXPackage& package, PatchStats& stats, const std::string& outPath) {
+    if (writes.empty()) return true;
+    char* view = package.MutableData();
+    std::vector<PackageRange> dirty;
+    std::vector<char> scratch;
+    for (const auto& w : writes) {
+        // Sources are read aside first: a failed read must not leave a torn
+        // slot in a block that another write gets recompressed.
+        const char* data = w.data.data();
+        if (w.data.empty()) {
+            RandomAccessFile src;
+            scratch.resize(w.dataSize);
+            if (!src.Open(w.sourcePath, RandomAccessFile::ReadOnly) || !src.ReadAt(w.sourceOffset, scratch.data(), w.dataSize)) {
+                std::cout << "Warning: Failed to read " << w.sourcePath << ". Skipping." << std::endl;
+                continue;
+            }
+            data = scratch.data();
+        }
+        memcpy(view + w.offset, data, w.dataSize);
+        memset(view + w.offset + w.dataSize, 0, w.slotSize - w.dataSize);
+        PackageRange range = { w.offset, w.slotSize };
+        dirty.push_back(range);
+        stats.bytesWritten += w.slotSize;
+        stats.applied++;
+    }
+    if (dirty.empty()) return true;
+
+    std::string path = outPath.empty() ? package.Path() : outPath;
+    if (!(outPath.empty() ? package.CommitCompressed(dirty, stats.recompressed) : WriteCompressedPackage(package, dirty, outPath, stats.recompressed))) {
+        std::cout << "Failed to write compressed package " << path << std::endl;
+        return false;
+    }
+    stats.writeCalls = 1;
+    return true;
+}
+
+bool PatchBatch::ApplyRelocated(XXXPackage& package, PatchStats& stats, const std::string& outPath) {
+    std::string path = outPath.empty() ? package.Path() : outPath;
+    std::string tmpPath = path + ".relocate.tmp";
+    size_t before = writes.size() + stats.dropped;
+    if (!WriteRelocatedPackage(package, writes, tmpPath, stats)) {
+        std::cout << "Failed to rebuild " << path << std::endl;
+        remove(tmpPath.c_str());
+        return false;
+    }
+    // The writes streamed with their banks are no longer in writes.
+    stats.applied += (uint32_t)(before - writes.size() - stats.dropped);
+    package.Close();
+    // The remaining writes land outside the rebuilt banks, at their new offsets.
+    if (!ApplyInPlace(tmpPath, stats, nullptr) || !ReplaceFileWith(tmpPath, path)) {
+        std::cout << "Failed to replace " << path << std::endl;
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool PatchBatch::CopyForOutput(const std::string& path, const std::string& outPath, PatchStats& stats) {
+    if (CloneFile(path, outPath)) return true;
+
+    // No reflinks here: start from a sparse file of the full size and copy
+    // only the bytes no write replaces. copy_file_range still shares extents
+    // on filesystems that support it.
+    RandomAccessFile src, out;
+    if (!src.Open(path, RandomAccessFile::ReadOnly) || !out.Open(outPath, RandomAccessFile::CreateTruncate) || !out.SetSize(src.Size())) {
+        std::cout << "Failed to create " << outPath << std::endl;
+        return false;
+    }
+    uint64_t pos = 0;
+    for (size_t i = 0; i <= writes.size(); ++i) {
+        uint64_t next = i < writes.size() ? writes[i].offset : src.Size();
+        if (next > pos) {
+            if (!out.CopyFrom(src, pos, pos, next - pos)) {
+                std::cout << "Failed to copy " << path << " to " << outPath << std::endl;
+                return false;
+            }
+            stats.bytesWritten += next - pos;
+            stats.writeCalls++;
+        }
+        if (i < writes.size() && (uint64_t)writes[i].offset + writes[i].slotSize > pos) pos = (uint64_t)writes[i].offset + writes[i].slotSize;
+    }
+    return true;
+}
+
+void PrintRecompressStats(const PatchStats& stats) {
+    if (stats.recompressed.blocks == 0) return;
+    std::cout << "Recompressed " << stats.recompressed.blocks << " block(s), package " << stats.recompressed.oldSize << " -> "
+              << stats.recompressed.newSize << " bytes" << std::endl;
+}
+
+void PrintPatchStats(const PatchStats& stats) {
+    PrintRecompressStats(stats);
+    std::cout << "Wrote " << stats.bytesWritten << " bytes in " << stats.writeCalls << " write(s), "
+              << (uint64_t)(stats.seconds * 1000.0 + 0.5) << " ms" << std::endl;
+}
@@ -0,0 +1,76 @@
+#ifndef PATCHBATCH_H
+#define PATCHBATCH_H
+
+#include "Package.h"
+
+class PatchJournal;
+class RandomAccessFile;
+
+// One planned sample replacement. The slot is filled with dataSize bytes of
+// sourcePath, starting at sourceOffset (or of data, if set), and the
+// remainder of the slot is zeroed. A dataSize larger than the slot grows the
+// sample, and a donor header replaces the sample's metadata too; both
+// rebuild the package.
+struct PatchWrite {
+    uint32_t offset;   // Slot start in the uncompressed view of the package
+    uint32_t slotSize;
+    uint32_t dataSize;
+    std::string sourcePath;
+    uint64_t sourceOffset;
+    std::string sampleName;
+    std::vector<char> header; // Donor FSB4_SAMPLE_HEADER, empty to keep the sample's own
+    std::vector<char> data;   // Payload encoded in memory, e.g. from a WAV; sourcePath then only names it
+};
+
+struct PatchStats {
+    uint64_t bytesWritten; // Payload plus zero fill
+    uint32_t writeCalls;   // Positional writes issued against the package
+    uint32_t applied;      // Writes that reached the package
+    uint32_t dropped;      // Writes whose slot or bank could not take them
+    double seconds;
+    RecompressStats recompressed; // Zero blocks unless a compressed package was rewritten
+};
+
+// Collects every replacement of a patch run before touching the package, then
+// applies them in offset order through one handle. Contiguous slots are
+// coalesced into a single staging buffer so a bank patched end to end costs a
+// handful of large writes instead of one open/seek/write cycle per sample.
+class PatchBatch {
+public:
+    PatchBatch();
+
+    void Add(const PatchWrite& write);
+    size_t Count() const { return writes.size(); }
+    const std::vector<PatchWrite>& Writes() const { return writes; }
+
+    // Writes every slot into the package. Uncompressed packages are patched in
+    // place; compressed ones are patched in their uncompressed view and the
+    // touched blocks are recompressed (which closes the package). Grown
+    // samples and new sample headers in an uncompressed package relocate
+    // everything after them into a rebuilt copy that then replaces the package.
+    // With outPath, the patched package is written there instead and the
+    // original is left untouched. Writes the package cannot take are dropped
+    // with a warning first; false if that leaves none.
+    bool Apply(XXXPackage& package, PatchStats& stats, const std::string& outPath = std::string());
+
+private:
+    // With originalPath, path is a copy of it whose slots may be holes; a
+    // write that is skipped gets its original bytes from there instead.
+    bool ApplyInPlace(const std::string& path, PatchStats& stats, PatchJournal* journal,
+                      const std::string& originalPath = std::string());
+    // Saves the original bytes of the writes from first on, up to the batch
+    // limit, and returns the end of the batch in end.
+    bool JournalBatch(const RandomAccessFile& out, PatchJournal& journal, size_t first, size_t& end);
+    bool ApplyCompressed(XXXPackage& package, PatchStats& stats, const std::string& outPath);
+    bool ApplyRelocated(XXXPackage& package, PatchStats& stats, const std::string& outPath);
+    // Creates outPath as the unpatched package, as a reflink where possible.
+    bool CopyForOutput(const std::string& path, const std::string& outPath, PatchStats& stats);
+
+    std::vector<PatchWrite> writes;
+};
+
+void PrintPatchStats(const PatchStats& stats);
+// Prints the recompression line of stats, if any blocks were recompressed.
+void PrintRecompressStats(const PatchStats& stats);
+
+#endif
@@ -0,0 +1,89 @@
+#include "Plan.h"
+#include "Json.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+bool IsMuchSmaller(const PatchWrite& write) {
+    // Encoded payloads with a new header shrink their sample to fit
+    return write.header.empty() && write.dataSize < write.slotSize * PLAN_SMALL_RATIO;
+}
+
+void WritePatchPlan(const PatchPlan& plan, std::ostream& out) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)plan.packageHash);
+    uint64_t bytes = 0;
+    for (const auto& w : plan.writes) bytes += w.dataSize;
+
+    out << "{\n";
+    out << "  \"package\": " << JsonQuote(plan.packagePath) << ",\n";
+    out << "  \"packageSize\": " << plan.packageSize << ",\n";
+    out << "  \"packageHash\": \"" << hash << "\",\n";
+    out << "  \"folder\": " << JsonQuote(plan.folder) << ",\n";
+    out << "  \"totalWrites\": " << plan.writes.size() << ",\n";
+    out << "  \"totalBytes\": " << bytes << ",\n";
+    out << "  \"writes\": [";
+    for (size_t i = 0; i < plan.writes.size(); ++i) {
+        const PatchWrite& w = plan.writes[i];
+        out << (i ? ",\n" : "\n") << "    {\"sample\": " << JsonQuote(w.sampleName) << ", \"offset\": " << w.offset << ", \"slotSize\": " << w.slotSize
+            << ", \"dataSize\": " << w.dataSize << ", \"source\": " << JsonQuote(w.sourcePath) << ", \"sourceOffset\": " << w.sourceOffset
+            << ", \"encoded\": " << (w.data.empty() ? "false" : "true") << ", \"grows\": " << (w.dataSize > w.slotSize ? "true" : "false")
+            << ", \"muchSmaller\": " << (IsMuchSmaller(w) ? "true" : "false") << "}";
+    }
+    out << (plan.writes.empty() ? "],\n" : "\n  ],\n");
+    out << "  \"skipped\": [";
+    for (size_t i = 0; i < plan.skipped.size(); ++i) {
+        const PlanSkip& s = plan.skipped[i];
+        out << (i ? ",\n" : "\n") << "    {\"file\": " << JsonQuote(s.file) << ", \"sample\": " << JsonQuote(s.sample) << ", \"reason\": " << JsonQuote(s.reason) << "}";
+    }
+    out << (plan.skipped.empty() ? "]\n" : "\n  ]\n");
+    out << "}\n";
+}
+
+bool ReadPatchPlan(const std::string& path, PatchPlan& plan) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        std::cout << "Failed to open plan " << path << std::endl;
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+
+    JsonValue root;
+    std::string error;
+    if (!ParseJson(text.str(), root, error)) {
+        std::cout << "Failed to parse plan " << path << ": " << error << std::endl;
+        return false;
+    }
+    const JsonValue* writes = root.Get("writes");
+    if (root.type != JsonValue::Object || root.GetString("package").empty() || !writes || writes->type != JsonValue::Array) {
+        std::cout << path << " is not a patch plan" << std::endl;
+        return false;
+    }
+
+    plan.packagePath = root.GetString("package");
+    plan.packageSize = root.GetUInt("packageSize");
+    plan.packageHash = strtoull(root.GetString("packageHash").c_str(), nullptr, 16);
+    plan.folder = root.GetString("folder");
+    plan.writes.clear();
+    plan.encoded.clear();
+    for (const auto& item : writes->items) {
+        PatchWrite w = { (uint32_t)item.GetUInt("offset"), (uint32_t)item.GetUInt("slotSize"), (uint32_t)item.GetUInt("dataSize"),
+                         item.GetString("source"), item.GetUInt("sourceOffset"), item.GetString("sample"), std::vector<char>(), std::vector<char>() };
+        if (w.sourcePath.empty()) {
+            std::cout << "Invalid write for " << w.sampleName << " in plan " << path << std::endl;
+            return false;
+        }
+        plan.writes.push_back(w);
+        plan.encoded.push_back(item.GetBool("encoded"));
+    }
+    plan.skipped.clear();
+    const JsonValue* skipped = root.Get("skipped");
+    if (skipped && skipped->type == JsonValue::Array) {
+        for (const auto& item : skipped->items) {
+            PlanSkip s = { item.GetString("file"), item.GetString("sample"), item.GetString("reason") };
+            plan.skipped.push_back(s);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "PatchBatch.h"
+
+// A replacement the planner found but will not apply.
+struct PlanSkip {
+    std::string file;   // Replacement file, if any
+    std::string sample; // Sample it matched, if any
+    std::string reason;
+};
+
+// Every write of a patch run, resolved against one package without touching
+// it. Saved as JSON, it can be reviewed, checked in CI and applied later; the
+// package fingerprint makes sure it is applied to the file it was made for.
+struct PatchPlan {
+    std::string packagePath; // Absolute
+    uint64_t packageSize;
+    uint64_t packageHash;    // Fingerprint hash, as in the catalog
+    std::string folder;
+    std::vector<PatchWrite> writes; // Sorted by offset
+    std::vector<PlanSkip> skipped;
+    // Per write of a plan read back from JSON: its source is a WAV file,
+    // encoded again when the plan is applied. Planned writes carry the
+    // encoded payload itself.
+    std::vector<bool> encoded;
+
+    PatchPlan() : packageSize(0), packageHash(0) {}
+};
+
+// Replacements that fill less than this fraction of their slot probably
+// carry a different format, or would play on over their zero padding, and
+// are flagged.
+#define PLAN_SMALL_RATIO (1 / 1.5)
+
+bool IsMuchSmaller(const PatchWrite& write);
+
+void WritePatchPlan(const PatchPlan& plan, std::ostream& out);
+bool ReadPatchPlan(const std::string& path, PatchPlan& plan);
+
+#endif
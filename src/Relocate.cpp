@@ -0,0 +1,326 @@
+#include "Relocate.h"
+#include "Catalog.h"
+#include "FileIO.h"
+#include "Scanner.h"
+#include "Stats.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <map>
+
+namespace {
+
+// A bank whose sample data is rewritten with a new layout.
+struct BankLayout {
+    const FSBBank* bank;
+    uint32_t start;                              // Absolute offset of the bank
+    uint32_t end;                                // Old end of its sample data
+    int64_t delta;                               // Growth of the bank
+    std::vector<const PatchWrite*> replacements; // Per sample, the write landing in it
+};
+
+struct SampleSlot {
+    size_t bank;
+    size_t sample;
+};
+
+// Where the byte at old offset pos lands once every bank before it has grown.
+uint64_t NewPosition(const std::vector<BankLayout>& layouts, uint64_t pos) {
+    int64_t shift = 0;
+    for (const auto& l : layouts) {
+        if (l.end <= pos) shift += l.delta;
+    }
+    return pos + shift;
+}
+
+// Growth of the rewritten banks lying inside [offset, offset + size).
+int64_t GrowthWithin(const std::vector<BankLayout>& layouts, uint64_t offset, uint64_t size) {
+    int64_t growth = 0;
+    for (const auto& l : layouts) {
+        if (l.start >= offset && l.end <= offset + size) growth += l.delta;
+    }
+    return growth;
+}
+
+// Stored size of sample i after the rebuild. Grown replacements and donor
+// samples take their own size; smaller raw replacements keep the slot and are
+// zero padded as when patching in place.
+uint32_t NewSampleSize(const BankLayout& l, size_t i) {
+    const PatchWrite* w = l.replacements[i];
+    const FSBSample& s = l.bank->index.samples[i];
+    return w && (w->dataSize > s.size || !w->header.empty()) ? w->dataSize : s.size;
+}
+
+// Writes the bank with its new header region and data layout at outPos.
+bool StreamBank(const XXXPackage& package, const RandomAccessFile& in, RandomAccessFile& out, const BankLayout& l, uint64_t& outPos,
+                PatchStats& stats) {
+    const FSBIndex& index = l.bank->index;
+    uint32_t flags = LE32(index.header.flags);
+    uint32_t regionSize = index.HeaderRegionSize();
+    std::vector<char> region(package.Data() + l.start, package.Data() + l.start + regionSize);
+
+    uint32_t dataSize = 0;
+    for (size_t i = 0; i < index.samples.size(); ++i) {
+        const FSBSample& s = index.samples[i];
+        const PatchWrite* w = l.replacements[i];
+        uint32_t size = NewSampleSize(l, i);
+        char* h = region.data() + s.headerOffset;
+        bool basic = i > 0 && (flags & FSB4_FLAG_BASICHEADERS);
+        if (w && !w->header.empty()) {
+            // A donor header brings its own lengths, loop points, mode and
+            // format; the sample keeps its name. Basic headers only hold the
+            // lengths, the rest stays inherited from the first sample.
+            const char* donor = w->header.data();
+            if (basic) {
+                memcpy(h + offsetof(FSB4_BASIC_SAMPLE_HEADER, lengthsamples), donor + offsetof(FSB4_SAMPLE_HEADER, lengthsamples), 4);
+                WriteLE32(h + offsetof(FSB4_BASIC_SAMPLE_HEADER, lengthcompressedbytes), size);
+            } else {
+                size_t from = offsetof(FSB4_SAMPLE_HEADER, lengthsamples);
+                memcpy(h + from, donor + from, sizeof(FSB4_SAMPLE_HEADER) - from);
+                WriteLE32(h + offsetof(FSB4_SAMPLE_HEADER, lengthcompressedbytes), size);
+            }
+        } else if (size != s.size) {
+            // The length in samples is scaled with the byte length, which
+            // holds for every constant bitrate codec FSB4 carries.
+            uint32_t numSamples = s.size ? (uint32_t)((uint64_t)s.numSamples * size / s.size) : s.numSamples;
+            if (basic) {
+                WriteLE32(h + offsetof(FSB4_BASIC_SAMPLE_HEADER, lengthsamples), numSamples);
+                WriteLE32(h + offsetof(FSB4_BASIC_SAMPLE_HEADER, lengthcompressedbytes), size);
+            } else {
+                WriteLE32(h + offsetof(FSB4_SAMPLE_HEADER, lengthsamples), numSamples);
+                WriteLE32(h + offsetof(FSB4_SAMPLE_HEADER, lengthcompressedbytes), size);
+                // A loop over the whole sample keeps covering it.
+                if (s.numSamples > 0 && s.loopEnd == s.numSamples - 1 && numSamples > 0) {
+                    WriteLE32(h + offsetof(FSB4_SAMPLE_HEADER, loopend), numSamples - 1);
+                }
+            }
+        }
+        dataSize += Align(size, 32);
+    }
+    WriteLE32(region.data() + offsetof(FSB4_HEADER, data_size), dataSize);
+
+    if (!out.WriteAt(outPos, region.data(), regionSize)) return false;
+    stats.bytesWritten += regionSize;
+    stats.writeCalls++;
+    outPos += regionSize;
+
+    // Untouched samples are copied in runs; each replacement breaks a run.
+    uint64_t runStart = 0, runSize = 0;
+    for (size_t i = 0; i <= index.samples.size(); ++i) {
+        const PatchWrite* w = i < index.samples.size() ? l.replacements[i] : nullptr;
+        if (i < index.samples.size() && !w) {
+            const FSBSample& s = index.samples[i];
+            if (runSize == 0) runStart = l.start + s.offset;
+            runSize += Align(s.size, 32);
+            continue;
+        }
+        if (runSize > 0) {
+            if (!out.CopyFrom(in, runStart, outPos, runSize)) return false;
+            stats.bytesWritten += runSize;
+            stats.writeCalls++;
+            outPos += runSize;
+            runSize = 0;
+        }
+        if (!w) continue;
+
+        uint32_t slot = Align(NewSampleSize(l, i), 32);
+        RandomAccessFile src;
+        bool read = !w->data.empty() ? out.WriteAt(outPos, w->data.data(), w->dataSize)
+                                     : src.Open(w->sourcePath, RandomAccessFile::ReadOnly) && out.CopyFrom(src, w->sourceOffset, outPos, w->dataSize);
+        if (!read) {
+            std::cout << "Failed to read " << w->sourcePath << std::endl;
+            return false;
+        }
+        if (slot > w->dataSize && !out.WriteZerosAt(outPos + w->dataSize, slot - w->dataSize)) return false;
+        stats.bytesWritten += slot;
+        stats.writeCalls += slot > w->dataSize ? 2 : 1;
+        outPos += slot;
+    }
+    return true;
+}
+
+bool WriteFixup(RandomAccessFile& out, uint64_t offset, uint32_t value, PatchStats& stats) {
+    char buf[4];
+    WriteBE32(buf, value);
+    stats.bytesWritten += 4;
+    stats.writeCalls++;
+    return out.WriteAt(offset, buf, 4);
+}
+
+// Moves the export table entries behind the rewritten banks and grows the
+// exports that contain them.
+bool FixExports(const XXXPackage& package, const std::vector<BankLayout>& layouts, RandomAccessFile& out, PatchStats& stats) {
+    std::vector<PackageExport> exports;
+    if (!ReadExportTable(package.Data(), package.Size(), package.Summary(), exports)) {
+        std::cout << "Failed to read the export table of " << package.Path() << std::endl;
+        return false;
+    }
+    for (const auto& e : exports) {
+        uint64_t entry = NewPosition(layouts, e.entryOffset);
+        uint64_t offset = NewPosition(layouts, e.serialOffset);
+        int64_t growth = GrowthWithin(layouts, e.serialOffset, e.serialSize);
+        if (offset != e.serialOffset && !WriteFixup(out, entry + EXPORT_SERIAL_OFFSET_FIELD, (uint32_t)offset, stats)) return false;
+        if (growth != 0 && !WriteFixup(out, entry + EXPORT_SERIAL_SIZE_FIELD, (uint32_t)(e.serialSize + growth), stats)) return false;
+    }
+    return true;
+}
+
+// Inline bulk data is preceded by flags, element count, size on disk and the
+// absolute offset of the payload, which directly follows the header. Every
+// such header outside the banks is moved along, and those whose payload is a
+// rewritten bank take its growth.
+bool FixBulkHeaders(const XXXPackage& package, const std::vector<FSBBank>& banks, const std::vector<BankLayout>& layouts, RandomAccessFile& out,
+                    PatchStats& stats) {
+    const char* data = package.Data();
+    size_t size = package.Size();
+    size_t next = 0;
+    for (size_t p = 12; p + 4 <= size; ++p) {
+        // Skip sample data, where anything can look like a header.
+        while (next < banks.size() && (!banks[next].parsed || banks[next].info.offset + banks[next].index.TotalSize() <= p)) next++;
+        if (next < banks.size() && banks[next].info.offset <= p) {
+            p = banks[next].info.offset + banks[next].index.TotalSize() - 1;
+            continue;
+        }
+        if (ReadBE32(data + p) != p + 4) continue;
+        uint32_t count = ReadBE32(data + p - 8);
+        uint32_t sizeOnDisk = ReadBE32(data + p - 4);
+        if (sizeOnDisk > size - p - 4) continue;
+
+        uint64_t newPos = NewPosition(layouts, p);
+        if (newPos != p && !WriteFixup(out, newPos, (uint32_t)newPos + 4, stats)) return false;
+        int64_t growth = GrowthWithin(layouts, p + 4, sizeOnDisk);
+        if (growth != 0) {
+            // Byte arrays count elements in bytes; other element types are left alone.
+            if (count == sizeOnDisk && !WriteFixup(out, newPos - 8, (uint32_t)(count + growth), stats)) return false;
+            if (!WriteFixup(out, newPos - 4, (uint32_t)(sizeOnDisk + growth), stats)) return false;
+        }
+    }
+    return true;
+}
+
+// Bank holding the sample slot that starts at offset, or null.
+const FSBBank* FindSlotBank(const std::vector<FSBBank>& banks, uint32_t offset) {
+    for (const auto& bank : banks) {
+        if (!bank.parsed) continue;
+        for (const auto& s : bank.index.samples) {
+            if ((uint32_t)bank.info.offset + s.offset == offset) return &bank;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+std::string BankGrowthBlocker(const XXXPackage& package, const FSBBank& bank) {
+    const PackageSummary& summary = package.Summary();
+    uint32_t tablesEnd = std::max(std::max(summary.nameOffset, summary.exportOffset), std::max(summary.importOffset, summary.dependsOffset));
+    if (package.IsCompressed()) return "samples in compressed packages cannot grow";
+    if (!bank.parsed || bank.index.version != '4') return "only FSB4 banks can be relocated";
+    if (bank.info.offset + bank.index.TotalSize() > package.Size()) return "its bank is truncated (streaming)";
+    if (bank.info.offset <= tablesEnd) return "its bank precedes the package tables";
+    return std::string();
+}
+
+std::string RelocationBlocker(const XXXPackage& package, const std::vector<FSBBank>& banks, const PatchWrite& w) {
+    const FSBBank* bank = FindSlotBank(banks, w.offset);
+    if (!bank) return "it is not at a sample slot of a known bank";
+    return BankGrowthBlocker(package, *bank);
+}
+
+bool WriteRelocatedPackage(const XXXPackage& package, std::vector<PatchWrite>& writes, const std::string& outPath, PatchStats& stats) {
+    ScopedPhase phase("relocate", outPath);
+    std::vector<FSBBank> banks = FindPackageBanks(package);
+    std::map<uint32_t, SampleSlot> slots;
+    for (size_t b = 0; b < banks.size(); ++b) {
+        if (!banks[b].parsed) continue;
+        for (size_t i = 0; i < banks[b].index.samples.size(); ++i) {
+            SampleSlot slot = { b, i };
+            slots[(uint32_t)banks[b].info.offset + banks[b].index.samples[i].offset] = slot;
+        }
+    }
+
+    // Pick the banks to rewrite: those holding a grown sample or a new header.
+    std::map<size_t, BankLayout> rewritten;
+    std::vector<PatchWrite> kept;
+    uint32_t dropped = 0;
+    for (const auto& w : writes) {
+        if (w.dataSize <= w.slotSize && w.header.empty()) {
+            kept.push_back(w);
+            continue;
+        }
+        std::string blocker = RelocationBlocker(package, banks, w);
+        auto it = slots.find(w.offset);
+        if (!blocker.empty()) {
+            std::cout << "Warning: Cannot rebuild the bank of " << w.sampleName << ", " << blocker << ". Skipping." << std::endl;
+            dropped++;
+        } else {
+            const FSBBank* bank = &banks[it->second.bank];
+            BankLayout& l = rewritten[it->second.bank];
+            if (!l.bank) {
+                l.bank = bank;
+                l.start = (uint32_t)bank->info.offset;
+                l.end = l.start + bank->index.TotalSize();
+                l.replacements.assign(bank->index.samples.size(), nullptr);
+            }
+            kept.push_back(w);
+        }
+    }
+    stats.dropped += dropped;
+    if (rewritten.empty()) {
+        std::cout << "No bank to rebuild; " << dropped << " write(s) dropped" << std::endl;
+        return false;
+    }
+
+    // Every write inside a rewritten bank is streamed with it; the rest are
+    // handed back at their new offsets.
+    std::vector<PatchWrite> remaining;
+    for (const auto& w : kept) {
+        auto it = slots.find(w.offset);
+        auto bank = it != slots.end() ? rewritten.find(it->second.bank) : rewritten.end();
+        if (bank == rewritten.end()) {
+            remaining.push_back(w);
+            continue;
+        }
+        bank->second.replacements[it->second.sample] = &w;
+    }
+
+    std::vector<BankLayout> layouts;
+    uint64_t newSize = package.Size();
+    for (auto& entry : rewritten) {
+        BankLayout& l = entry.second;
+        uint32_t dataSize = 0;
+        for (size_t i = 0; i < l.replacements.size(); ++i) dataSize += Align(NewSampleSize(l, i), 32);
+        l.delta = (int64_t)dataSize - l.bank->index.dataSize;
+        newSize += l.delta;
+        layouts.push_back(l);
+    }
+    if (newSize > UINT32_MAX) {
+        std::cout << "Relocated package would exceed 4 GB" << std::endl;
+        return false;
+    }
+
+    RandomAccessFile in, out;
+    if (!in.Open(package.Path(), RandomAccessFile::ReadOnly) || !out.Open(outPath, RandomAccessFile::CreateTruncate)) {
+        std::cout << "Failed to create " << outPath << std::endl;
+        return false;
+    }
+
+    uint64_t pos = 0, outPos = 0;
+    for (const auto& l : layouts) {
+        if (!out.CopyFrom(in, pos, outPos, l.start - pos)) return false;
+        stats.bytesWritten += l.start - pos;
+        stats.writeCalls++;
+        outPos += l.start - pos;
+        if (!StreamBank(package, in, out, l, outPos, stats)) return false;
+        pos = l.end;
+    }
+    if (!out.CopyFrom(in, pos, outPos, package.Size() - pos)) return false;
+    stats.bytesWritten += package.Size() - pos;
+    stats.writeCalls++;
+
+    if (!layouts.empty() && (!FixExports(package, layouts, out, stats) || !FixBulkHeaders(package, banks, layouts, out, stats))) return false;
+
+    for (auto& w : remaining) w.offset = (uint32_t)NewPosition(layouts, w.offset);
+    writes.swap(remaining);
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef RELOCATE_H
+#define RELOCATE_H
+
+#include "PatchBatch.h"
+#include "Scanner.h"
+
+// Rebuilds an uncompressed package into outPath so that replacements larger
+// than their slot fit and donor sample headers can be applied. Each FSB4 bank
+// holding such a sample gets new sample headers, a recomputed 32-byte aligned
+// data layout and a new data_size; everything after it moves, and the export
+// table and inline bulk data headers are fixed up to match. The package is streamed through once with
+// positional copies, never loaded whole.
+//
+// Every write inside a rewritten bank is consumed. On return, writes holds the
+// remaining ones at their offsets in the rebuilt package, ready to be applied
+// in place. Writes that need a rebuild their bank cannot take (see
+// RelocationBlocker) are dropped with a warning; if that leaves no bank to
+// rewrite, nothing is written and the result is false.
+bool WriteRelocatedPackage(const XXXPackage& package, std::vector<PatchWrite>& writes, const std::string& outPath, PatchStats& stats);
+
+// Why the samples of bank cannot grow or take a donor header, or empty if
+// WriteRelocatedPackage can rebuild it: compressed packages, FSB5 banks,
+// truncated (streaming) banks and banks before the package tables cannot.
+std::string BankGrowthBlocker(const XXXPackage& package, const FSBBank& bank);
+// Same for the bank holding the slot of w, among the package's banks.
+std::string RelocationBlocker(const XXXPackage& package, const std::vector<FSBBank>& banks, const PatchWrite& w);
+
+#endif
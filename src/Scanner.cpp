@@ -0,0 +1,51 @@
+#include "Scanner.h"
+#include "Stats.h"
+#include <cstring>
+
+FSBBankInfo ReadFSBBankInfo(const char* data, size_t size, size_t offset) {
+    FSBBankInfo bank;
+    bank.offset = offset;
+    bank.version = data[offset + 3];
+    bank.headerComplete = false;
+    memset(&bank.header, 0, sizeof(bank.header));
+    if (bank.version == '4' && size - offset >= sizeof(FSB4_HEADER)) {
+        memcpy(&bank.header, data + offset, sizeof(FSB4_HEADER));
+        bank.headerComplete = true;
+    } else if (bank.version == '5') {
+        bank.headerComplete = size - offset >= FSB5_HEADER_SIZE_V1;
+    }
+    return bank;
+}
+
+std::vector<FSBBankInfo> ScanFSBBanks(const char* data, size_t size) {
+    ScopedPhase phase("scan");
+    std::vector<FSBBankInfo> banks;
+    if (size < 4) return banks;
+
+    // memchr is vectorized by every libc we build against, so jumping from
+    // 'F' to 'F' and checking the remaining three bytes is one linear pass.
+    const char* p = data;
+    const char* last = data + size - 3;
+    while (p < last) {
+        const char* hit = (const char*)memchr(p, 'F', last - p);
+        if (!hit) break;
+
+        if (hit[1] == 'S' && hit[2] == 'B' && (hit[3] == '4' || hit[3] == '5')) {
+            banks.push_back(ReadFSBBankInfo(data, size, hit - data));
+            p = hit + 4;
+        } else {
+            p = hit + 1;
+        }
+    }
+    return banks;
+}
+
+std::vector<FSBBank> ScanAndParseFSBBanks(const char* data, size_t size) {
+    std::vector<FSBBankInfo> infos = ScanFSBBanks(data, size);
+    std::vector<FSBBank> banks(infos.size());
+    for (size_t i = 0; i < infos.size(); ++i) {
+        banks[i].info = infos[i];
+        banks[i].parsed = infos[i].headerComplete && ParseFSBIndex(data + infos[i].offset, size - infos[i].offset, banks[i].index);
+    }
+    return banks;
+}
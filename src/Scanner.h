@@ -0,0 +1,27 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include "FSB.h"
+
+struct FSBBankInfo {
+    size_t offset;       // Absolute offset of the "FSBx" magic
+    char version;        // '4' or '5'
+    bool headerComplete; // False if the bank header runs past the end of the data
+    FSB4_HEADER header;  // Only filled in for FSB4 banks
+};
+
+// A bank found in a package together with its decoded sample table.
+struct FSBBank {
+    FSBBankInfo info;
+    FSBIndex index;
+    bool parsed; // False if the bank header is incomplete or unreadable
+};
+
+// Describes the bank whose "FSBx" magic is at offset; size is that of data.
+FSBBankInfo ReadFSBBankInfo(const char* data, size_t size, size_t offset);
+// Finds every "FSB4"/"FSB5" signature in one pass over the buffer.
+std::vector<FSBBankInfo> ScanFSBBanks(const char* data, size_t size);
+// Scans the buffer and decodes the sample table of every bank found.
+std::vector<FSBBank> ScanAndParseFSBBanks(const char* data, size_t size);
+
+#endif
@@ -0,0 +1,130 @@
+#include "Search.h"
+#include "Batch.h"
+#include "Catalog.h"
+#include <algorithm>
+#include <chrono>
+#include <regex>
+#include <sstream>
+
+namespace {
+
+bool EqualsIgnoreCase(const std::string& a, const std::string& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+bool Matches(const SampleQuery& query, const std::regex* re, const FSBSample& s) {
+    if (query.channels >= 0 && s.channels != query.channels) return false;
+    if (query.frequency >= 0 && s.frequency != query.frequency) return false;
+    if (s.size < query.minSize || s.size > query.maxSize) return false;
+    if (!query.codec.empty() && !EqualsIgnoreCase(query.codec, GetFormatString(s.codec))) return false;
+    if (!query.name.empty() && !WildcardMatch(query.name.c_str(), s.name.c_str())) return false;
+    if (re && !std::regex_search(s.name, *re)) return false;
+    return true;
+}
+
+// Banks of one input file with their sample tables. Standalone .fsb files
+// are one bank at offset 0 and only their header region is read. Compressed
+// packages would have to be inflated whole, so only the catalog serves them;
+// error says why a file was not searched.
+bool LoadBanks(const std::string& path, std::vector<FSBBank>& banks, std::string& error) {
+    error = "Failed to open " + path;
+    const Catalog* catalog = ActiveCatalog();
+    CatalogEntry entry;
+    if (catalog && FingerprintFile(path, entry)) {
+        int64_t current = catalog->FindCurrent(entry);
+        if (current >= 0) {
+            catalog->ReadEntry((size_t)current, entry);
+            banks.swap(entry.banks);
+            return true;
+        }
+    }
+
+    if (HasExtension(path, ".fsb")) {
+        FSBBank bank;
+        memset(&bank.info, 0, sizeof(bank.info));
+        bank.parsed = ReadFSBIndex(path, 0, bank.index);
+        if (!bank.parsed && bank.index.samples.empty()) return false;
+        bank.info.version = bank.index.version;
+        bank.info.headerComplete = bank.parsed;
+        banks.push_back(bank);
+        return true;
+    }
+
+    MappedFile file;
+    PackageSummary summary;
+    if (!file.Open(path)) return false;
+    if (ReadPackageSummary(file.Data(), file.Size(), summary) && (summary.packageFlags & PKG_StoreCompressed) && !summary.chunks.empty()) {
+        error = "Skipped " + path + ": compressed and not in the catalog, run 'catalog' on it first";
+        return false;
+    }
+    file.Close();
+
+    XXXPackage package;
+    std::ostringstream ignored;
+    if (!package.Open(path, ignored)) return false;
+    banks = LocatePackageBanks(package);
+    return true;
+}
+
+} // namespace
+
+void FindSamples(const std::vector<std::string>& inputs, const SampleQuery& query) {
+    std::regex re;
+    if (!query.regex.empty()) {
+        try {
+            re.assign(query.regex, std::regex::ECMAScript | std::regex::icase | std::regex::optimize);
+        } catch (const std::regex_error& e) {
+            std::cout << "Invalid regex " << query.regex << ": " << e.what() << std::endl;
+            return;
+        }
+    }
+
+    std::vector<std::string> files = ExpandAudioInputs(inputs);
+    if (files.empty()) {
+        std::cout << "No .xxx or .fsb files found" << std::endl;
+        return;
+    }
+    // Results are printed in path order whatever order the workers finish in.
+    std::sort(files.begin(), files.end());
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::string> output(files.size());
+    std::vector<size_t> matchCounts(files.size(), 0);
+    std::vector<size_t> sampleCounts(files.size(), 0);
+    ParallelFor(files.size(), [&](size_t i) {
+        std::vector<FSBBank> banks;
+        std::string error;
+        if (!LoadBanks(files[i], banks, error)) {
+            output[i] = error + "\n";
+            return;
+        }
+        std::ostringstream log;
+        for (size_t b = 0; b < banks.size(); ++b) {
+            const FSBBank& bank = banks[b];
+            for (const auto& s : bank.index.samples) {
+                sampleCounts[i]++;
+                if (!Matches(query, query.regex.empty() ? nullptr : &re, s)) continue;
+                matchCounts[i]++;
+                log << files[i] << " [Bank " << b << "] " << s.name << " | Format: " << GetFormatString(s.codec)
+                    << " | Channels: " << s.channels << " | Freq: " << s.frequency << "Hz | Offset: 0x" << std::hex
+                    << (bank.info.offset + s.offset) << std::dec << " | Size: " << s.size << " bytes" << std::endl;
+            }
+        }
+        output[i] = log.str();
+    });
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    size_t matches = 0;
+    size_t samples = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::cout << output[i];
+        matches += matchCounts[i];
+        samples += sampleCounts[i];
+    }
+    std::cout << matches << " match(es) among " << samples << " sample(s) in " << files.size() << " file(s), "
+              << (uint64_t)(ms + 0.5) << " ms" << std::endl;
+}
@@ -0,0 +1,25 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "FSB.h"
+
+// Filters for 'find'; an unset field matches every sample.
+struct SampleQuery {
+    std::string name;  // Case-insensitive '*'/'?' pattern
+    std::string regex; // ECMAScript regex, searched case-insensitively within the name
+    std::string codec; // As printed by GetFormatString, e.g. "MPEG"
+    int channels;
+    int frequency;
+    uint64_t minSize;
+    uint64_t maxSize;
+
+    SampleQuery() : channels(-1), frequency(-1), minSize(0), maxSize(UINT64_MAX) {}
+};
+
+// Searches the sample tables of every package and FSB file named by inputs,
+// in parallel, and prints each match with its bank and absolute offset.
+// Only bank header regions are decoded, and packages the active catalog
+// holds are answered from it without being opened.
+void FindSamples(const std::vector<std::string>& inputs, const SampleQuery& query);
+
+#endif
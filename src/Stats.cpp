@@ -0,0 +1,160 @@
+#include "Stats.h"
+#include "Json.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+bool statsEnabled = false;
+IoCounters ioCounters;
+
+namespace {
+
+struct PhaseEvent {
+    const char* name;
+    std::string detail;
+    uint64_t begin; // Nanoseconds since EnableStats
+    uint64_t duration;
+    uint32_t thread;
+    uint64_t bytesRead; // Counters when the phase ended
+    uint64_t bytesWritten;
+};
+
+std::mutex eventsMutex;
+std::vector<PhaseEvent> events;
+std::chrono::steady_clock::time_point runBegin;
+bool printSummary = false;
+std::string traceFile;
+std::atomic<uint32_t> nextThread(0);
+
+// Small, stable thread numbers for the trace, in order of first use.
+uint32_t TraceThread() {
+    static thread_local uint32_t id = nextThread++;
+    return id;
+}
+
+uint64_t Nanoseconds(std::chrono::steady_clock::time_point t) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t - runBegin).count();
+}
+
+uint64_t Load(const std::atomic<uint64_t>& counter) {
+    return counter.load(std::memory_order_relaxed);
+}
+
+// Microseconds, as Chrome trace timestamps are, keeping nanosecond precision.
+std::string Micros(uint64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu.%03u", (unsigned long long)(ns / 1000), (unsigned)(ns % 1000));
+    return buf;
+}
+
+void PrintSummary(uint64_t total) {
+    // Totals per phase, in order of first appearance. Nested phases are part
+    // of their parent's time too, and phases on parallel threads add up.
+    std::vector<const char*> order;
+    std::vector<uint64_t> calls, nanos;
+    for (const auto& e : events) {
+        size_t k = std::find(order.begin(), order.end(), e.name) - order.begin();
+        if (k == order.size()) {
+            order.push_back(e.name);
+            calls.push_back(0);
+            nanos.push_back(0);
+        }
+        calls[k]++;
+        nanos[k] += e.duration;
+    }
+
+    char line[128];
+    snprintf(line, sizeof(line), "Run statistics (%.1f ms):", total / 1e6);
+    std::cout << line << std::endl;
+    snprintf(line, sizeof(line), "  %-16s %8s %12s", "phase", "calls", "total ms");
+    std::cout << line << std::endl;
+    for (size_t k = 0; k < order.size(); ++k) {
+        snprintf(line, sizeof(line), "  %-16s %8llu %12.3f", order[k], (unsigned long long)calls[k], nanos[k] / 1e6);
+        std::cout << line << std::endl;
+    }
+    std::cout << "  " << Load(ioCounters.bytesRead) << " bytes read, " << Load(ioCounters.bytesWritten) << " bytes written, "
+              << Load(ioCounters.bytesMapped) << " bytes mapped" << std::endl;
+    std::cout << "  " << Load(ioCounters.opens) << " file opens, " << Load(ioCounters.seeks) << " seeks, "
+              << Load(ioCounters.allocations) << " heap allocations" << std::endl;
+}
+
+bool WriteTrace(const std::string& path, uint64_t total) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) return false;
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"MK9Tool\"}}";
+    for (const auto& e : events) {
+        out << ",\n  {\"name\": " << JsonQuote(e.name) << ", \"cat\": \"phase\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread
+            << ", \"ts\": " << Micros(e.begin) << ", \"dur\": " << Micros(e.duration);
+        if (!e.detail.empty()) out << ", \"args\": {\"detail\": " << JsonQuote(e.detail) << "}";
+        out << "}";
+    }
+
+    // The I/O counters as they stood at the end of every phase, as one
+    // counter track
+    std::vector<const PhaseEvent*> byEnd;
+    for (const auto& e : events) byEnd.push_back(&e);
+    std::stable_sort(byEnd.begin(), byEnd.end(), [](const PhaseEvent* a, const PhaseEvent* b) {
+        return a->begin + a->duration < b->begin + b->duration;
+    });
+    out << ",\n  {\"name\": \"io\", \"ph\": \"C\", \"pid\": 1, \"ts\": 0, \"args\": {\"read\": 0, \"written\": 0}}";
+    for (const PhaseEvent* e : byEnd) {
+        out << ",\n  {\"name\": \"io\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << Micros(e->begin + e->duration)
+            << ", \"args\": {\"read\": " << e->bytesRead << ", \"written\": " << e->bytesWritten << "}}";
+    }
+    out << ",\n  {\"name\": \"run\", \"cat\": \"run\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": 0, \"dur\": " << Micros(total)
+        << ", \"args\": {\"bytesRead\": " << Load(ioCounters.bytesRead) << ", \"bytesWritten\": " << Load(ioCounters.bytesWritten)
+        << ", \"bytesMapped\": " << Load(ioCounters.bytesMapped) << ", \"seeks\": " << Load(ioCounters.seeks)
+        << ", \"opens\": " << Load(ioCounters.opens) << ", \"allocations\": " << Load(ioCounters.allocations) << "}}";
+    out << "\n]}\n";
+    return out.good();
+}
+
+} // namespace
+
+ScopedPhase::ScopedPhase(const char* name) : name(name) {
+    if (statsEnabled) begin = std::chrono::steady_clock::now();
+}
+
+ScopedPhase::ScopedPhase(const char* name, const std::string& detail) : name(name) {
+    if (!statsEnabled) return;
+    this->detail = detail;
+    begin = std::chrono::steady_clock::now();
+}
+
+ScopedPhase::~ScopedPhase() {
+    if (!statsEnabled) return;
+    PhaseEvent e;
+    e.name = name;
+    e.begin = Nanoseconds(begin);
+    e.duration = Nanoseconds(std::chrono::steady_clock::now()) - e.begin;
+    e.thread = TraceThread();
+    e.bytesRead = Load(ioCounters.bytesRead);
+    e.bytesWritten = Load(ioCounters.bytesWritten);
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    events.push_back(e);
+    events.back().detail.swap(detail);
+}
+
+void EnableStats(bool summary, const std::string& tracePath) {
+    runBegin = std::chrono::steady_clock::now();
+    printSummary = summary;
+    traceFile = tracePath;
+    TraceThread(); // The main thread is thread 0
+    statsEnabled = true;
+}
+
+void FinishStats() {
+    if (!statsEnabled) return;
+    statsEnabled = false;
+    uint64_t total = Nanoseconds(std::chrono::steady_clock::now());
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    if (printSummary) PrintSummary(total);
+    if (traceFile.empty()) return;
+    if (WriteTrace(traceFile, total)) {
+        std::cout << "Wrote trace of " << events.size() << " phase(s) to " << traceFile << std::endl;
+    } else {
+        std::cout << "Failed to write trace " << traceFile << std::endl;
+    }
+}
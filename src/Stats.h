@@ -0,0 +1,66 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "Utils.h"
+#include <atomic>
+#include <chrono>
+
+// Run-wide counters and phase timers behind --stats and --trace. Every hook
+// tests statsEnabled first, so a run without either option pays one
+// predictable branch per call and records nothing.
+extern bool statsEnabled;
+
+struct IoCounters {
+    std::atomic<uint64_t> bytesRead;
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<uint64_t> bytesMapped; // Mapped files are read by page faults, not counted in bytesRead
+    std::atomic<uint64_t> seeks;       // Accesses that do not continue the previous one on their handle
+    std::atomic<uint64_t> opens;
+    std::atomic<uint64_t> allocations; // Counted by the tool's operator new
+};
+
+extern IoCounters ioCounters;
+
+inline bool StatsEnabled() {
+    return statsEnabled;
+}
+
+inline void CountStat(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    if (statsEnabled) counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void CountRead(uint64_t bytes) { CountStat(ioCounters.bytesRead, bytes); }
+inline void CountWrite(uint64_t bytes) { CountStat(ioCounters.bytesWritten, bytes); }
+inline void CountMapped(uint64_t bytes) { CountStat(ioCounters.bytesMapped, bytes); }
+inline void CountSeek() { CountStat(ioCounters.seeks); }
+inline void CountOpen() { CountStat(ioCounters.opens); }
+inline void CountAllocation() { CountStat(ioCounters.allocations); }
+
+// Times the enclosing scope as one phase of the run. Phases nest and may run
+// on several threads at once; each becomes one slice of the trace. name must
+// outlive the run (a string literal); detail, such as the package path, is
+// only copied when stats are enabled.
+class ScopedPhase {
+public:
+    explicit ScopedPhase(const char* name);
+    ScopedPhase(const char* name, const std::string& detail);
+    ~ScopedPhase();
+
+private:
+    ScopedPhase(const ScopedPhase&);
+    ScopedPhase& operator=(const ScopedPhase&);
+
+    const char* name;
+    std::string detail;
+    std::chrono::steady_clock::time_point begin;
+};
+
+// Enables the counters and timers for the rest of the run. summary prints a
+// per-phase table at the end; a tracePath gets a Chrome trace (chrome://tracing,
+// Perfetto) of every phase plus the I/O counters over time.
+void EnableStats(bool summary, const std::string& tracePath);
+// Prints the summary and writes the trace, as enabled. Safe to call once
+// from atexit.
+void FinishStats();
+
+#endif
@@ -0,0 +1,134 @@
+#include "Store.h"
+#include "FileIO.h"
+#include "Hash.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+std::atomic<uint32_t> tempCounter(0);
+
+std::string HashString(uint64_t hash) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+    return buf;
+}
+
+// One "<hash>\t<size>\t<name>" line of a bank manifest.
+struct ManifestEntry {
+    std::string manifest;
+    std::string hash;
+    std::string size;
+    std::string name;
+};
+
+} // namespace
+
+bool SampleStore::Open(const std::string& path) {
+    dir = path;
+    CreateDirectoryIfNotExists(dir);
+    CreateDirectoryIfNotExists(dir + "/blobs");
+    CreateDirectoryIfNotExists(dir + "/manifests");
+    return IsDirectory(dir + "/blobs") && IsDirectory(dir + "/manifests");
+}
+
+std::string SampleStore::BlobPath(uint64_t hash, uint32_t size) const {
+    std::string h = HashString(hash);
+    return dir + "/blobs/" + h.substr(0, 2) + "/" + h + "-" + std::to_string(size) + ".bin";
+}
+
+std::string SampleStore::ManifestPath(const std::string& sourcePath, int bankIndex) const {
+    std::string absolute = GetAbsolutePath(sourcePath);
+    std::string pathHash = HashString(XXH64(absolute.data(), absolute.size())).substr(0, 8);
+    return dir + "/manifests/" + GetFileNameWithoutExtension(sourcePath) + "-" + pathHash + "_audio_" + std::to_string(bankIndex) + ".txt";
+}
+
+bool SampleStore::Put(const char* data, uint32_t size, uint64_t hash, bool& added) const {
+    added = false;
+    std::string path = BlobPath(hash, size);
+
+    // Writers of the same blob serialize on its stripe, so a blob is never
+    // linked while another thread is still writing it.
+    std::lock_guard<std::mutex> lock(locks[hash % LOCK_STRIPES]);
+    if (FileExists(path)) return true;
+
+    CreateDirectoryIfNotExists(dir + "/blobs/" + HashString(hash).substr(0, 2));
+    // Published by rename so another process never sees a partial blob.
+    std::string tmpPath = path + "." + std::to_string(tempCounter++) + ".tmp";
+    RandomAccessFile out;
+    if (!out.Open(tmpPath, RandomAccessFile::CreateTruncate)) return false;
+    bool ok = out.WriteAt(0, data, size);
+    out.Close();
+    if (!ok || !ReplaceFileWith(tmpPath, path)) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    added = true;
+    return true;
+}
+
+bool SampleStore::Materialize(uint64_t hash, uint32_t size, const std::string& dst) const {
+    std::string blob = BlobPath(hash, size);
+    remove(dst.c_str());
+    // A reflink shares the blob's blocks until either file is written; a
+    // copy is the only other form that later writes to dst cannot reach.
+    if (CloneFile(blob, dst)) return true;
+
+    RandomAccessFile src;
+    RandomAccessFile out;
+    if (!src.Open(blob, RandomAccessFile::ReadOnly) || !out.Open(dst, RandomAccessFile::CreateTruncate)) return false;
+    return out.CopyFrom(src, 0, 0, src.Size());
+}
+
+void PrintStoreTotals(const ExtractTotals& totals, std::ostream& log) {
+    log << "Store: " << totals.blobsStored << " new blob(s), " << totals.bytesDeduped / (1024.0 * 1024.0)
+        << " MB of duplicate samples not stored again" << std::endl;
+}
+
+void FindSharedSamples(const std::string& storeDir, const std::string& key) {
+    std::string manifestDir = storeDir + "/manifests";
+    std::vector<std::string> manifests = GetFilesInDirectory(manifestDir);
+    if (manifests.empty()) {
+        std::cout << "No manifests found in " << manifestDir << std::endl;
+        return;
+    }
+    std::sort(manifests.begin(), manifests.end());
+
+    std::vector<ManifestEntry> entries;
+    std::unordered_map<std::string, bool> wanted;
+    for (const auto& m : manifests) {
+        if (!HasExtension(m, ".txt")) continue;
+        std::ifstream in(manifestDir + "/" + m);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream fields(line);
+            ManifestEntry e;
+            e.manifest = m.substr(0, m.size() - 4);
+            if (!std::getline(fields, e.hash, '\t') || !std::getline(fields, e.size, '\t') || !std::getline(fields, e.name)) continue;
+            if (e.name == key || e.hash == key) wanted[e.hash + "-" + e.size] = true;
+            entries.push_back(e);
+        }
+    }
+    if (wanted.empty()) {
+        std::cout << "No stored sample named " << key << std::endl;
+        return;
+    }
+
+    std::vector<std::string> blobs;
+    for (const auto& w : wanted) blobs.push_back(w.first);
+    std::sort(blobs.begin(), blobs.end());
+    for (const auto& blob : blobs) {
+        size_t users = 0;
+        std::ostringstream list;
+        for (const auto& e : entries) {
+            if (e.hash + "-" + e.size != blob) continue;
+            list << "  " << e.manifest << " " << e.name << std::endl;
+            users++;
+        }
+        std::cout << "Blob " << blob << ".bin is shared by " << users << " sample(s):" << std::endl << list.str();
+    }
+}
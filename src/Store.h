@@ -0,0 +1,41 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "FSB.h"
+#include <mutex>
+
+// Content-addressed store of sample payloads. Each distinct payload is kept
+// once as blobs/<hh>/<xxh64>-<size>.bin; extracted sample files are reflinks
+// or, where those are unsupported, copies of their blob. Never hard links:
+// later writes truncate the extracted files in place, which would rewrite the
+// blob of every package sharing it. Every extracted bank also leaves
+// manifests/<source>-<path hash>_audio_<N>.txt mapping sample names to blobs;
+// the hash of the source's full path keeps same-named packages apart.
+class SampleStore {
+public:
+    bool Open(const std::string& dir);
+    const std::string& Dir() const { return dir; }
+
+    std::string BlobPath(uint64_t hash, uint32_t size) const;
+    std::string ManifestPath(const std::string& sourcePath, int bankIndex) const;
+
+    // Stores data, whose XXH64 is hash, unless an identical blob is already
+    // there. Safe to call from many threads, also for the same payload.
+    bool Put(const char* data, uint32_t size, uint64_t hash, bool& added) const;
+    // Creates dst as a link to (or copy of) a stored blob, replacing dst.
+    bool Materialize(uint64_t hash, uint32_t size, const std::string& dst) const;
+
+private:
+    static const int LOCK_STRIPES = 64;
+
+    std::string dir;
+    mutable std::mutex locks[LOCK_STRIPES];
+};
+
+// Prints how many blobs an extraction added and how much it deduplicated.
+void PrintStoreTotals(const ExtractTotals& totals, std::ostream& log);
+// Prints every manifest entry sharing a blob with the sample named key (or
+// with the blob whose hash is key).
+void FindSharedSamples(const std::string& storeDir, const std::string& key);
+
+#endif
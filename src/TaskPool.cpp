@@ -0,0 +1,103 @@
+#include "TaskPool.h"
+
+namespace {
+
+thread_local const TaskPool* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+
+} // namespace
+
+TaskPool::TaskPool(size_t threadCount) : queued(0), pending(0), nextQueue(0), stopping(false) {
+    if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0) threadCount = 1;
+    for (size_t i = 0; i < threadCount; ++i) queues.push_back(new Queue());
+    for (size_t i = 0; i < threadCount; ++i) threads.emplace_back(&TaskPool::WorkerLoop, this, i);
+}
+
+TaskPool::~TaskPool() {
+    Wait();
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& t : threads) t.join();
+    for (Queue* q : queues) delete q;
+}
+
+void TaskPool::Submit(const std::function<void()>& task) {
+    size_t target;
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        pending++;
+        if (currentPool == this) {
+            target = currentWorker;
+        } else {
+            target = nextQueue;
+            nextQueue = (nextQueue + 1) % queues.size();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[target]->lock);
+        queues[target]->tasks.push_back(task);
+    }
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        queued++;
+    }
+    workAvailable.notify_one();
+}
+
+void TaskPool::Wait() {
+    std::unique_lock<std::mutex> guard(stateLock);
+    allDone.wait(guard, [this] { return pending == 0; });
+}
+
+bool TaskPool::PopLocal(size_t self, std::function<void()>& task) {
+    Queue& q = *queues[self];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tasks.empty()) return false;
+    task = q.tasks.back();
+    q.tasks.pop_back();
+    return true;
+}
+
+bool TaskPool::Steal(size_t self, std::function<void()>& task) {
+    for (size_t i = 1; i < queues.size(); ++i) {
+        Queue& q = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.tasks.empty()) continue;
+        task = q.tasks.front();
+        q.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void TaskPool::WorkerLoop(size_t self) {
+    currentPool = this;
+    currentWorker = self;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(stateLock);
+            workAvailable.wait(guard, [this] { return stopping || queued > 0; });
+            if (queued == 0) return; // Stopping with nothing left
+        }
+
+        std::function<void()> task;
+        if (!PopLocal(self, task) && !Steal(self, task)) continue;
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            queued--;
+        }
+
+        task();
+
+        std::lock_guard<std::mutex> guard(stateLock);
+        if (--pending == 0) allDone.notify_all();
+    }
+}
+
+bool InTaskPoolWorker() {
+    return currentPool != nullptr;
+}
@@ -0,0 +1,57 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a deque: tasks submitted from
+// a worker go to the back of its own deque and are popped LIFO, so a package
+// task that fans out into bank tasks keeps them hot on the same core, while
+// idle workers steal the oldest tasks from the front of other deques.
+class TaskPool {
+public:
+    // threads == 0 uses one worker per hardware thread.
+    explicit TaskPool(size_t threads = 0);
+    ~TaskPool();
+
+    void Submit(const std::function<void()>& task);
+    // Blocks until every submitted task, including ones submitted by other
+    // tasks, has finished.
+    void Wait();
+
+    size_t ThreadCount() const { return queues.size(); }
+
+private:
+    TaskPool(const TaskPool&);
+    TaskPool& operator=(const TaskPool&);
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    void WorkerLoop(size_t self);
+    bool PopLocal(size_t self, std::function<void()>& task);
+    bool Steal(size_t self, std::function<void()>& task);
+
+    std::vector<Queue*> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex stateLock;
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+    size_t queued;  // Tasks sitting in a deque
+    size_t pending; // Tasks submitted but not yet finished
+    size_t nextQueue;
+    bool stopping;
+};
+
+// True on a TaskPool worker thread. ParallelFor runs inline there, since the
+// pool already keeps every core busy.
+bool InTaskPoolWorker();
+
+#endif
@@ -1,8 +1,14 @@
 #include "Utils.h"
+#include "TaskPool.h"
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <thread>
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <dirent.h>
+#include <cstdio>
 #include <sys/stat.h>
 #endif
 
@@ -47,10 +53,32 @@ std::string GetFileNameWithoutExtension(const std::string& path) {
     return path.substr(lastslash + 1, lastdot - lastslash - 1);
 }
 
+std::string GetAbsolutePath(const std::string& path) {
+#ifdef _WIN32
+    char buf[MAX_PATH];
+    if (_fullpath(buf, path.c_str(), MAX_PATH) == NULL) return path;
+    return buf;
+#else
+    char* resolved = realpath(path.c_str(), NULL);
+    if (!resolved) return path;
+    std::string result = resolved;
+    free(resolved);
+    return result;
+#endif
+}
+
 void CreateDirectoryIfNotExists(const std::string& path) {
     MKDIR(path.c_str());
 }
 
+bool ReplaceFileWith(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
 std::vector<std::string> GetFilesInDirectory(const std::string& path) {
     std::vector<std::string> files;
 #ifdef _WIN32
@@ -79,3 +107,52 @@ std::vector<std::string> GetFilesInDirectory(const std::string& path) {
 #endif
     return files;
 }
+
+bool HasExtension(const std::string& path, const char* ext) {
+    size_t len = strlen(ext);
+    if (path.size() < len) return false;
+    for (size_t i = 0; i < len; ++i) {
+        if (tolower((unsigned char)path[path.size() - len + i]) != tolower((unsigned char)ext[i])) return false;
+    }
+    return true;
+}
+
+bool WildcardMatch(const char* pattern, const char* name) {
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while (*name) {
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = name;
+        } else if (*pattern == '?' || tolower((unsigned char)*pattern) == tolower((unsigned char)*name)) {
+            pattern++;
+            name++;
+        } else if (star) {
+            pattern = star + 1;
+            name = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') pattern++;
+    return *pattern == 0;
+}
+
+void ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    size_t numThreads = std::thread::hardware_concurrency();
+    if (numThreads == 0) numThreads = 1;
+    if (numThreads > count) numThreads = count;
+    if (numThreads <= 1 || InTaskPoolWorker()) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) fn(i);
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < numThreads; ++t) threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads) t.join();
+}
@@ -6,6 +6,8 @@
 #include <string>
 #include <fstream>
 #include <cstdint>
+#include <cstring>
+#include <functional>
 
 #ifdef _WIN32
 #include <direct.h>
@@ -35,6 +37,14 @@ inline uint16_t LE16(uint16_t v) {
 #endif
 }
 
+inline uint64_t LE64(uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return ((uint64_t)SwapEndian((uint32_t)v) << 32) | SwapEndian((uint32_t)(v >> 32));
+#else
+    return v;
+#endif
+}
+
 inline uint32_t BE32(uint32_t v) {
 #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
     return v;
@@ -43,11 +53,55 @@ inline uint32_t BE32(uint32_t v) {
 #endif
 }
 
+inline uint32_t ReadLE32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return LE32(v);
+}
+
+inline uint16_t ReadLE16(const char* p) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return LE16(v);
+}
+
+inline uint32_t ReadBE32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return BE32(v);
+}
+
+inline void WriteLE32(char* p, uint32_t v) {
+    v = LE32(v);
+    memcpy(p, &v, 4);
+}
+
+inline void WriteLE16(char* p, uint16_t v) {
+    v = LE16(v);
+    memcpy(p, &v, 2);
+}
+
+inline void WriteBE32(char* p, uint32_t v) {
+    v = BE32(v);
+    memcpy(p, &v, 4);
+}
+
 bool FileExists(const std::string& name);
 bool IsDirectory(const std::string& path);
 std::string GetFileNameWithoutExtension(const std::string& path);
+// Absolute, normalized form of path; returns path unchanged if it cannot be resolved.
+std::string GetAbsolutePath(const std::string& path);
 void CreateDirectoryIfNotExists(const std::string& path);
+bool ReplaceFileWith(const std::string& from, const std::string& to);
 std::vector<std::string> GetFilesInDirectory(const std::string& path);
+// Case-insensitive test for an extension such as ".xxx".
+bool HasExtension(const std::string& path, const char* ext);
+// Case-insensitive '*' and '?' matching, as used by Windows file patterns.
+bool WildcardMatch(const char* pattern, const char* name);
+
+// Runs fn(i) for every i in [0, count) across the available cores, or inline
+// when called from a TaskPool worker.
+void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
 
 inline uint32_t Align(uint32_t val, uint32_t alignment) {
     if (alignment == 0) return val;
@@ -0,0 +1,211 @@
+#include "Vag.h"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VAG_USE_SSE2 1
+#endif
+
+// Predictor coefficients, scaled by 64. Frames naming a predictor past the
+// table decode as unfiltered, the way the SPU treats them.
+static const int32_t VAG_COEFS[5][2] = { { 0, 0 }, { 60, 0 }, { 115, -52 }, { 98, -55 }, { 122, -60 } };
+
+// Expands the 28 nibbles of a frame into out[0..27] as (nibble << 12) >> shift.
+// Every sample of a frame shares the shift, so this step has no dependency
+// between samples and runs four 8-lane vectors at a time.
+static void ExpandFrame(const unsigned char* frame, int shift, int16_t* out) {
+#ifdef VAG_USE_SSE2
+    // Bytes 2..15 of the frame, followed by two zero bytes (samples 28..31)
+    __m128i bytes = _mm_srli_si128(_mm_loadu_si128((const __m128i*)frame), 2);
+    __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i lo = _mm_and_si128(bytes, mask);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    __m128i first = _mm_unpacklo_epi8(lo, hi); // Samples 0..15, low nibble first
+    __m128i second = _mm_unpackhi_epi8(lo, hi); // Samples 16..31
+    // A nibble in the top four bits of a 16-bit lane is already sign-extended
+    // by the arithmetic shift.
+    __m128i zero = _mm_setzero_si128();
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m128i v0 = _mm_sra_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(zero, first), 4), count);
+    __m128i v1 = _mm_sra_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(zero, first), 4), count);
+    __m128i v2 = _mm_sra_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(zero, second), 4), count);
+    __m128i v3 = _mm_sra_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(zero, second), 4), count);
+    _mm_storeu_si128((__m128i*)out, v0);
+    _mm_storeu_si128((__m128i*)(out + 8), v1);
+    _mm_storeu_si128((__m128i*)(out + 16), v2);
+    _mm_storeu_si128((__m128i*)(out + 24), v3);
+#else
+    for (int i = 0; i < VAG_FRAME_SAMPLES; ++i) {
+        int nibble = (frame[2 + i / 2] >> ((i & 1) * 4)) & 0x0F;
+        out[i] = (int16_t)((int16_t)(nibble << 12) >> shift);
+    }
+#endif
+}
+
+bool DecodeVAG(const char* data, size_t size, uint16_t channels, uint32_t sampleCount, std::vector<int16_t>& pcm) {
+    pcm.clear();
+    if (channels == 0) channels = 1;
+    size_t framesPerChannel = size / VAG_FRAME_SIZE / channels;
+    if (framesPerChannel == 0) return false;
+    size_t total = framesPerChannel * VAG_FRAME_SAMPLES;
+    if (sampleCount > 0 && sampleCount < total) total = sampleCount;
+    pcm.resize(total * channels);
+
+    // The predictor feeds each sample into the next, so the filter itself
+    // stays scalar; the channels' histories are independent and advance in
+    // the same pass, one frame of each channel after another.
+    std::vector<int32_t> history(2 * channels, 0);
+    const unsigned char* frame = (const unsigned char*)data;
+    int16_t scaled[32];
+    for (size_t k = 0; k * VAG_FRAME_SAMPLES < total; ++k) {
+        size_t first = k * VAG_FRAME_SAMPLES;
+        size_t count = std::min<size_t>(VAG_FRAME_SAMPLES, total - first);
+        for (uint16_t c = 0; c < channels; ++c, frame += VAG_FRAME_SIZE) {
+            int predictor = frame[0] >> 4;
+            int shift = frame[0] & 0x0F;
+            if (shift > 12) shift = 9;
+            const int32_t* coef = VAG_COEFS[predictor < 5 ? predictor : 0];
+            ExpandFrame(frame, shift, scaled);
+
+            int32_t h1 = history[2 * c], h2 = history[2 * c + 1];
+            int16_t* out = pcm.data() + first * channels + c;
+            for (size_t i = 0; i < count; ++i) {
+                int32_t s = scaled[i] + ((h1 * coef[0] + h2 * coef[1] + 32) >> 6);
+                s = std::min(32767, std::max(-32768, s));
+                h2 = h1;
+                h1 = s;
+                out[i * channels] = (int16_t)s;
+            }
+            history[2 * c] = h1;
+            history[2 * c + 1] = h2;
+        }
+    }
+    return true;
+}
+
+static inline int32_t Clamp16(int32_t s) {
+    return std::min(32767, std::max(-32768, s));
+}
+
+#ifdef VAG_USE_SSE2
+static inline __m128i Max32(__m128i a, __m128i b) {
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+static inline __m128i Min32(__m128i a, __m128i b) {
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+#endif
+
+// Largest absolute prediction error of a frame under each predictor, with
+// the prediction taken from the source signal. buf holds two samples of
+// history, the 28 samples of the frame and four zeros.
+static void PredictorPeaks(const int16_t* buf, int32_t peaks[5]) {
+#ifdef VAG_USE_SSE2
+    // madd multiplies (x[i-1], x[i-2]) pairs by (coef0, coef1) four lanes
+    // at a time, so one predictor costs seven madds per frame.
+    __m128i round = _mm_set1_epi32(32);
+    for (int p = 0; p < 5; ++p) {
+        __m128i coef = _mm_set1_epi32((int32_t)(((uint32_t)(uint16_t)VAG_COEFS[p][1] << 16) | (uint16_t)VAG_COEFS[p][0]));
+        __m128i hi = _mm_setzero_si128(), lo = _mm_setzero_si128();
+        for (int i = 0; i < VAG_FRAME_SAMPLES; i += 8) {
+            __m128i prev1 = _mm_loadu_si128((const __m128i*)(buf + 1 + i));
+            __m128i prev2 = _mm_loadu_si128((const __m128i*)(buf + i));
+            __m128i cur = _mm_loadu_si128((const __m128i*)(buf + 2 + i));
+            __m128i pred = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(prev1, prev2), coef), round), 6);
+            __m128i r = _mm_sub_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(cur, cur), 16), pred);
+            hi = Max32(hi, r);
+            lo = Min32(lo, r);
+            if (i + 4 >= VAG_FRAME_SAMPLES) break;
+            pred = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(prev1, prev2), coef), round), 6);
+            r = _mm_sub_epi32(_mm_srai_epi32(_mm_unpackhi_epi16(cur, cur), 16), pred);
+            hi = Max32(hi, r);
+            lo = Min32(lo, r);
+        }
+        hi = Max32(hi, _mm_sub_epi32(_mm_setzero_si128(), lo));
+        int32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, hi);
+        peaks[p] = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    }
+#else
+    for (int p = 0; p < 5; ++p) {
+        int32_t peak = 0;
+        for (int i = 0; i < VAG_FRAME_SAMPLES; ++i) {
+            int32_t pred = (buf[i + 1] * VAG_COEFS[p][0] + buf[i] * VAG_COEFS[p][1] + 32) >> 6;
+            int32_t r = buf[i + 2] - pred;
+            peak = std::max(peak, r < 0 ? -r : r);
+        }
+        peaks[p] = peak;
+    }
+#endif
+}
+
+// Encodes the frame in buf (as for PredictorPeaks) against the decoder's
+// history h1, h2, which is advanced past it.
+static void EncodeFrame(const int16_t* buf, bool unfiltered, int32_t& h1, int32_t& h2, unsigned char* frame) {
+    int predictor = 0;
+    int32_t peaks[5];
+    PredictorPeaks(buf, peaks);
+    if (!unfiltered) {
+        for (int p = 1; p < 5; ++p) {
+            if (peaks[p] < peaks[predictor]) predictor = p;
+        }
+    }
+    // The finest step that still spans the largest error in four bits
+    int shift = 12;
+    while (shift > 0 && peaks[predictor] > (7 << (12 - shift))) shift--;
+
+    // Quantized against the decoded history, so errors do not accumulate
+    const int32_t* coef = VAG_COEFS[predictor];
+    frame[0] = (unsigned char)((predictor << 4) | shift);
+    frame[1] = 0;
+    for (int i = 0; i < VAG_FRAME_SAMPLES; ++i) {
+        int32_t pred = (h1 * coef[0] + h2 * coef[1] + 32) >> 6;
+        int32_t q = (((buf[i + 2] - pred) * (1 << shift)) + 2048) >> 12;
+        q = std::min(7, std::max(-8, q));
+        int32_t s = Clamp16(((int16_t)(q * 4096) >> shift) + pred);
+        h2 = h1;
+        h1 = s;
+        if (i & 1) {
+            frame[2 + i / 2] |= (unsigned char)((q & 0x0F) << 4);
+        } else {
+            frame[2 + i / 2] = (unsigned char)(q & 0x0F);
+        }
+    }
+}
+
+size_t VAGEncodedSize(size_t sampleCount, uint16_t channels) {
+    return (sampleCount + VAG_FRAME_SAMPLES - 1) / VAG_FRAME_SAMPLES * (channels ? channels : 1) * VAG_FRAME_SIZE;
+}
+
+size_t VAGSegmentCount(size_t sampleCount) {
+    size_t frames = (sampleCount + VAG_FRAME_SAMPLES - 1) / VAG_FRAME_SAMPLES;
+    return (frames + VAG_SEGMENT_FRAMES - 1) / VAG_SEGMENT_FRAMES;
+}
+
+void EncodeVAGSegment(const int16_t* pcm, size_t sampleCount, uint16_t channels, uint16_t channel, size_t segment, char* out) {
+    if (channels == 0) channels = 1;
+    size_t frames = (sampleCount + VAG_FRAME_SAMPLES - 1) / VAG_FRAME_SAMPLES;
+    size_t first = segment * VAG_SEGMENT_FRAMES;
+    size_t last = std::min(frames, first + VAG_SEGMENT_FRAMES);
+    int32_t h1 = 0, h2 = 0;
+    int16_t buf[2 + 32];
+    for (size_t k = first; k < last; ++k) {
+        size_t start = k * VAG_FRAME_SAMPLES;
+        for (int j = 0; j < 2 + 32; ++j) {
+            size_t n = start + j - 2; // Wraps below zero and fails the bound
+            buf[j] = j < 2 + VAG_FRAME_SAMPLES && n < sampleCount ? pcm[n * channels + channel] : 0;
+        }
+        EncodeFrame(buf, k == first, h1, h2, (unsigned char*)out + (k * channels + channel) * VAG_FRAME_SIZE);
+    }
+}
+
+void EncodeVAG(const int16_t* pcm, size_t sampleCount, uint16_t channels, std::vector<char>& out) {
+    out.assign(VAGEncodedSize(sampleCount, channels), 0);
+    size_t segments = VAGSegmentCount(sampleCount);
+    for (uint16_t c = 0; c < (channels ? channels : 1); ++c) {
+        for (size_t s = 0; s < segments; ++s) EncodeVAGSegment(pcm, sampleCount, channels, c, s, out.data());
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef VAG_H
+#define VAG_H
+
+#include "Utils.h"
+
+// PS-ADPCM (VAG) frames are 16 bytes: a predictor/shift byte, a flag byte and
+// 28 four-bit samples, low nibble first. Multichannel FSB samples interleave
+// whole frames, one per channel in turn.
+#define VAG_FRAME_SIZE 16
+#define VAG_FRAME_SAMPLES 28
+
+// Decodes a VAG payload into interleaved 16-bit PCM, sampleCount frames per
+// channel (0 decodes every complete frame). False if the payload holds no
+// complete frame for every channel.
+bool DecodeVAG(const char* data, size_t size, uint16_t channels, uint32_t sampleCount, std::vector<int16_t>& pcm);
+
+// The encoder splits every channel into segments of this many frames. A
+// segment starts with an unfiltered frame, which decodes without the history
+// of the previous one, so segments are encoded independently of each other.
+#define VAG_SEGMENT_FRAMES 256
+
+// Payload size of sampleCount frames per channel.
+size_t VAGEncodedSize(size_t sampleCount, uint16_t channels);
+size_t VAGSegmentCount(size_t sampleCount);
+// Encodes one segment of one channel of interleaved 16-bit PCM into out, the
+// whole payload (VAGEncodedSize bytes). Every (channel, segment) pair writes
+// its own frames, so all of them may be encoded concurrently.
+void EncodeVAGSegment(const int16_t* pcm, size_t sampleCount, uint16_t channels, uint16_t channel, size_t segment, char* out);
+// Encodes a whole payload on the calling thread.
+void EncodeVAG(const int16_t* pcm, size_t sampleCount, uint16_t channels, std::vector<char>& out);
+
+#endif
@@ -0,0 +1,269 @@
+#include "Wav.h"
+#include "Vag.h"
+#include "Hash.h"
+#include "Incremental.h"
+#include "Stats.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+
+bool CanDecodeToWav(uint32_t codec) {
+    return codec == FSB_CODEC_VAG;
+}
+
+// FSB4 flags looping in the mode; FSB5 samples, whose mode is their codec,
+// only carry loop points when they loop.
+static bool IsLooped(const FSBSample& s) {
+    if (s.loopEnd <= s.loopStart) return false;
+    return s.mode == s.codec || (s.mode & FSB4_MODE_LOOP_NORMAL) != 0;
+}
+
+static void AppendChunk(std::vector<char>& wav, const char* id, uint32_t size) {
+    size_t at = wav.size();
+    wav.resize(at + 8);
+    memcpy(&wav[at], id, 4);
+    WriteLE32(&wav[at + 4], size);
+}
+
+bool DecodeSampleToWav(const FSBSample& sample, const char* payload, std::vector<char>& wav) {
+    std::vector<int16_t> pcm;
+    if (sample.codec != FSB_CODEC_VAG || !DecodeVAG(payload, sample.size, sample.channels, sample.numSamples, pcm)) return false;
+    uint16_t channels = sample.channels ? sample.channels : 1;
+    uint32_t frequency = sample.frequency > 0 ? (uint32_t)sample.frequency : 44100;
+    uint32_t frames = (uint32_t)(pcm.size() / channels);
+    bool looped = IsLooped(sample) && sample.loopStart < frames;
+    uint32_t dataSize = (uint32_t)(pcm.size() * 2);
+
+    wav.clear();
+    wav.reserve(12 + 24 + (looped ? 68 : 0) + 8 + dataSize);
+    AppendChunk(wav, "RIFF", 0);
+    wav.insert(wav.end(), { 'W', 'A', 'V', 'E' });
+
+    AppendChunk(wav, "fmt ", 16);
+    size_t fmt = wav.size();
+    wav.resize(fmt + 16);
+    WriteLE16(&wav[fmt], 1); // PCM
+    WriteLE16(&wav[fmt + 2], channels);
+    WriteLE32(&wav[fmt + 4], frequency);
+    WriteLE32(&wav[fmt + 8], frequency * channels * 2);
+    WriteLE16(&wav[fmt + 12], (uint16_t)(channels * 2));
+    WriteLE16(&wav[fmt + 14], 16);
+
+    if (looped) {
+        // smpl chunk with a single forward loop; the end point is inclusive.
+        AppendChunk(wav, "smpl", 60);
+        size_t smpl = wav.size();
+        wav.resize(smpl + 60, 0);
+        WriteLE32(&wav[smpl + 8], 1000000000u / frequency);
+        WriteLE32(&wav[smpl + 12], 60); // MIDI unity note
+        WriteLE32(&wav[smpl + 28], 1);  // Loop count
+        WriteLE32(&wav[smpl + 44], sample.loopStart);
+        WriteLE32(&wav[smpl + 48], std::min(sample.loopEnd, frames - 1));
+    }
+
+    AppendChunk(wav, "data", dataSize);
+    size_t data = wav.size();
+    wav.resize(data + dataSize);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (size_t i = 0; i < pcm.size(); ++i) WriteLE16(&wav[data + i * 2], (uint16_t)pcm[i]);
+#else
+    memcpy(&wav[data], pcm.data(), dataSize);
+#endif
+    WriteLE32(&wav[4], (uint32_t)wav.size() - 8);
+    return true;
+}
+
+// Decodes every sample that has a decoder, one task per sample, reading
+// payloads through view like WriteSamplesWith does.
+static size_t WriteWavsWith(const std::vector<FSBSample>& samples, uint64_t bankSize, const std::string& outDir, ExtractTotals& totals,
+                            ExtractState* state, const std::function<const char*(const FSBSample&, std::vector<char>&)>& view) {
+    ScopedPhase phase("decode", outDir);
+    std::vector<char> isLast = LastSamplesByName(samples);
+    std::atomic<size_t> undecoded(0);
+    ParallelFor(samples.size(), [&](size_t i) {
+        const FSBSample& s = samples[i];
+        if ((uint64_t)s.offset + s.size > bankSize || !isLast[i]) return;
+        if (!CanDecodeToWav(s.codec)) {
+            undecoded++;
+            return;
+        }
+        std::vector<char> buffer, wav;
+        const char* payload = view(s, buffer);
+        if (!payload || !DecodeSampleToWav(s, payload, wav)) {
+            undecoded++;
+            return;
+        }
+
+        // Sample names usually keep the .wav of the file they were built from
+        std::string path = outDir + "/" + s.name + (HasExtension(s.name, ".wav") ? "" : ".wav");
+        uint64_t hash = state ? XXH64(payload, s.size) : 0;
+        if (state && state->Reuse(path, wav.size(), hash)) {
+            totals.outputsSkipped++;
+            return;
+        }
+        RandomAccessFile f;
+        bool ok = f.Open(path, RandomAccessFile::CreateTruncate) && f.WriteAt(0, wav.data(), wav.size());
+        if (ok) totals.bytesWritten += wav.size();
+        if (state && ok) {
+            state->Record(path, wav.size(), hash);
+        } else if (state) {
+            state->MarkIncomplete();
+        }
+    });
+    return undecoded;
+}
+
+size_t WriteWavFiles(const char* bank, uint64_t bankSize, const std::vector<FSBSample>& samples, const std::string& outDir,
+                     ExtractTotals& totals, ExtractState* state) {
+    return WriteWavsWith(samples, bankSize, outDir, totals, state,
+        [&](const FSBSample& s, std::vector<char>&) {
+            return bank + s.offset;
+        });
+}
+
+size_t WriteWavFiles(const RandomAccessFile& src, uint64_t baseOffset, uint64_t bankSize, const std::vector<FSBSample>& samples,
+                     const std::string& outDir, ExtractTotals& totals, ExtractState* state) {
+    return WriteWavsWith(samples, bankSize, outDir, totals, state,
+        [&](const FSBSample& s, std::vector<char>& buffer) -> const char* {
+            buffer.resize(s.size);
+            if (!src.ReadAt(baseOffset + s.offset, buffer.data(), s.size)) return nullptr;
+            return buffer.data();
+        });
+}
+
+bool IsWavFile(const std::string& path) {
+    char head[12];
+    std::ifstream f(path, std::ios::binary);
+    if (!f.is_open()) return false;
+    CountOpen();
+    CountRead(sizeof(head));
+    return f.read(head, sizeof(head)) && memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WAVE", 4) == 0;
+}
+
+bool ReadWavFile(const std::string& path, PcmAudio& audio, std::string& error) {
+    std::ifstream f(path, std::ios::binary);
+    std::vector<char> file((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    if (f.is_open()) CountOpen();
+    CountRead(file.size());
+    if (file.size() < 12 || memcmp(file.data(), "RIFF", 4) != 0 || memcmp(file.data() + 8, "WAVE", 4) != 0) {
+        error = "not a RIFF WAVE file";
+        return false;
+    }
+
+    uint16_t format = 0, channels = 0, bits = 0;
+    uint32_t frequency = 0;
+    const char* data = nullptr;
+    size_t dataSize = 0;
+    for (size_t pos = 12; pos + 8 <= file.size();) {
+        const char* chunk = file.data() + pos;
+        size_t size = std::min<size_t>(ReadLE32(chunk + 4), file.size() - pos - 8);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            format = ReadLE16(chunk + 8);
+            channels = ReadLE16(chunk + 10);
+            frequency = ReadLE32(chunk + 12);
+            bits = ReadLE16(chunk + 22);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            data = chunk + 8;
+            dataSize = size;
+        }
+        pos += 8 + size + (size & 1); // Chunks are padded to even sizes
+    }
+    if (!data || channels == 0 || frequency == 0) {
+        error = "no fmt or data chunk";
+        return false;
+    }
+    // WAVE_FORMAT_EXTENSIBLE files are taken as PCM as well
+    if ((format != 1 && format != 0xFFFE) || bits != 16) {
+        error = "only 16-bit PCM is supported (format " + std::to_string(format) + ", " + std::to_string(bits) + "-bit)";
+        return false;
+    }
+
+    audio.frequency = frequency;
+    audio.channels = channels;
+    audio.samples.resize(dataSize / 2 / channels * channels);
+    for (size_t i = 0; i < audio.samples.size(); ++i) audio.samples[i] = (int16_t)ReadLE16(data + i * 2);
+    return true;
+}
+
+void ConvertPcm(const PcmAudio& in, uint32_t frequency, uint16_t channels, PcmAudio& out) {
+    if (frequency == 0) frequency = in.frequency;
+    if (channels == 0) channels = in.channels;
+    size_t inFrames = in.Frames();
+
+    // Channels first, at the source rate
+    std::vector<int16_t> mapped;
+    const std::vector<int16_t>* source = &in.samples;
+    if (channels != in.channels) {
+        mapped.resize(inFrames * channels);
+        for (size_t i = 0; i < inFrames; ++i) {
+            const int16_t* frame = in.samples.data() + i * in.channels;
+            if (channels == 1) {
+                int32_t sum = 0;
+                for (uint16_t c = 0; c < in.channels; ++c) sum += frame[c];
+                mapped[i] = (int16_t)(sum / in.channels);
+            } else {
+                for (uint16_t c = 0; c < channels; ++c) mapped[i * channels + c] = frame[c % in.channels];
+            }
+        }
+        source = &mapped;
+    }
+
+    out.frequency = frequency;
+    out.channels = channels;
+    if (frequency == in.frequency || inFrames == 0) {
+        out.samples = *source;
+        return;
+    }
+    size_t outFrames = std::max<size_t>(1, (size_t)((uint64_t)inFrames * frequency / in.frequency));
+    out.samples.resize(outFrames * channels);
+    for (size_t i = 0; i < outFrames; ++i) {
+        uint64_t pos = (uint64_t)i * in.frequency;
+        size_t a = (size_t)(pos / frequency);
+        size_t b = std::min(a + 1, inFrames - 1);
+        int64_t frac = (int64_t)(pos % frequency);
+        for (uint16_t c = 0; c < channels; ++c) {
+            int64_t va = (*source)[a * channels + c], vb = (*source)[b * channels + c];
+            out.samples[i * channels + c] = (int16_t)(va + (vb - va) * frac / (int64_t)frequency);
+        }
+    }
+}
+
+void EncodeWavFiles(std::vector<WavEncodeJob>& jobs) {
+    ScopedPhase phase("encode");
+    std::vector<PcmAudio> pcm(jobs.size());
+    ParallelFor(jobs.size(), [&](size_t i) {
+        WavEncodeJob& job = jobs[i];
+        PcmAudio source;
+        if (!ReadWavFile(job.path, source, job.error)) return;
+        if (source.Frames() == 0) {
+            job.error = "no samples";
+            return;
+        }
+        ConvertPcm(source, job.frequency, job.channels, pcm[i]);
+        job.vag.assign(VAGEncodedSize(pcm[i].Frames(), pcm[i].channels), 0);
+        job.sampleCount = (uint32_t)pcm[i].Frames();
+    });
+
+    struct Segment {
+        size_t job;
+        uint16_t channel;
+        size_t index;
+    };
+    std::vector<Segment> segments;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (!jobs[i].error.empty()) continue;
+        size_t count = VAGSegmentCount(pcm[i].Frames());
+        for (uint16_t c = 0; c < pcm[i].channels; ++c) {
+            for (size_t s = 0; s < count; ++s) {
+                Segment segment = { i, c, s };
+                segments.push_back(segment);
+            }
+        }
+    }
+    ParallelFor(segments.size(), [&](size_t i) {
+        const Segment& s = segments[i];
+        const PcmAudio& audio = pcm[s.job];
+        EncodeVAGSegment(audio.samples.data(), audio.Frames(), audio.channels, s.channel, s.index, jobs[s.job].vag.data());
+    });
+}
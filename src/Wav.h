@@ -0,0 +1,61 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include "FSB.h"
+
+class ExtractState;
+
+// True if samples of this codec can be decoded to WAV.
+bool CanDecodeToWav(uint32_t codec);
+
+// Decodes one sample payload into a complete 16-bit PCM WAV file, using the
+// sample's frequency and channels. Looping samples get a smpl chunk with
+// their loop points.
+bool DecodeSampleToWav(const FSBSample& sample, const char* payload, std::vector<char>& wav);
+
+// Writes outDir/<name>.wav (just <name> if it already ends in .wav) for
+// every decodable sample within bankSize, in parallel, and returns how many
+// samples could not be decoded.
+size_t WriteWavFiles(const char* bank, uint64_t bankSize, const std::vector<FSBSample>& samples, const std::string& outDir,
+                     ExtractTotals& totals, ExtractState* state = nullptr);
+// Same, reading each payload from src at baseOffset + sample offset.
+size_t WriteWavFiles(const RandomAccessFile& src, uint64_t baseOffset, uint64_t bankSize, const std::vector<FSBSample>& samples,
+                     const std::string& outDir, ExtractTotals& totals, ExtractState* state = nullptr);
+
+// Interleaved 16-bit PCM.
+struct PcmAudio {
+    uint32_t frequency;
+    uint16_t channels;
+    std::vector<int16_t> samples;
+
+    PcmAudio() : frequency(0), channels(0) {}
+    size_t Frames() const { return channels ? samples.size() / channels : 0; }
+};
+
+// True if path starts like a RIFF WAVE file.
+bool IsWavFile(const std::string& path);
+// Loads a 16-bit PCM WAV file; false with the reason in error otherwise.
+bool ReadWavFile(const std::string& path, PcmAudio& audio, std::string& error);
+// Resamples (linearly) and remaps channels: many to one are averaged, one to
+// many duplicated, and otherwise channel n takes source channel n modulo the
+// source count.
+void ConvertPcm(const PcmAudio& in, uint32_t frequency, uint16_t channels, PcmAudio& out);
+
+// One WAV file to encode to VAG in the format of the sample it replaces.
+struct WavEncodeJob {
+    std::string path;
+    uint32_t frequency;
+    uint16_t channels;
+    std::vector<char> vag; // Encoded payload
+    uint32_t sampleCount;  // Samples per channel in vag, before padding to whole frames
+    std::string error;     // Set instead if the file could not be encoded
+
+    WavEncodeJob() : frequency(0), channels(0), sampleCount(0) {}
+};
+
+// Loads and converts every job's file in parallel, then encodes every
+// segment of every channel of every file in one parallel pass, so one long
+// file keeps all cores as busy as a folder of short ones.
+void EncodeWavFiles(std::vector<WavEncodeJob>& jobs);
+
+#endif
@@ -1,359 +1,732 @@
 #include "XXX.h"
+#include "Package.h"
+#include "PatchBatch.h"
+#include "FileIO.h"
+#include "Scanner.h"
+#include "Catalog.h"
+#include "Cues.h"
+#include "Store.h"
+#include "Hash.h"
+#include "Incremental.h"
+#include "Plan.h"
+#include "Relocate.h"
+#include "Stats.h"
+#include "Wav.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <vector>
 #include <iterator>
+#include <cstddef>
 #include <cstring>
+#include <unordered_map>
 
-void ExtractXXX(const std::string& path) {
-    std::ifstream f(path, std::ios::binary);
-    if (!f.is_open()) {
-        std::cout << "Failed to open " << path << std::endl;
-        return;
+std::string XXXOutputDir(const std::string& path) {
+    return GetFileNameWithoutExtension(path) + "_extracted";
+}
+
+// Writes a whole output file, unless an incremental run finds it unchanged.
+static void WriteOutputFile(const std::string& path, const char* data, size_t size, ExtractState* state, ExtractTotals& totals) {
+    ScopedPhase phase("copy", path);
+    uint64_t hash = 0;
+    if (state) {
+        hash = XXH64(data, size);
+        if (state->Reuse(path, size, hash)) {
+            totals.outputsSkipped++;
+            return;
+        }
+    }
+    std::ofstream f(path, std::ios::binary);
+    f.write(data, size);
+    f.close();
+    CountOpen();
+    CountWrite(size);
+    totals.bytesWritten += size;
+    if (!state) return;
+    if (f.good()) {
+        state->Record(path, size, hash);
+    } else {
+        state->MarkIncomplete();
+    }
+}
+
+std::string PrepareXXXExtraction(const XXXPackage& package, std::ostream& log, ExtractTotals& totals, ExtractState* state) {
+    const char* data = package.Data();
+    size_t fileSize = package.Size();
+    if (fileSize < 12) {
+        log << "Warning: Invalid XXX magic" << std::endl;
+        return std::string();
     }
 
-    uint32_t magic;
-    f.read((char*)&magic, 4);
-    if (BE32(magic) != 0x9E2A83C1) {
-        std::cout << "Warning: Invalid XXX magic" << std::endl;
+    if (ReadBE32(data) != PACKAGE_FILE_TAG) {
+        log << "Warning: Invalid XXX magic" << std::endl;
+    }
+    if (package.IsCompressed()) {
+        log << "Decompressed " << package.Summary().chunks.size() << " chunks (" << package.File().Size()
+            << " -> " << fileSize << " bytes)" << std::endl;
     }
 
-    f.seekg(8);
-    uint32_t headerSize;
-    f.read((char*)&headerSize, 4);
-    headerSize = BE32(headerSize);
+    uint32_t headerSize = ReadBE32(data + 8);
+    if (headerSize > fileSize) headerSize = (uint32_t)fileSize;
 
-    std::string outDir = GetFileNameWithoutExtension(path) + "_extracted";
+    std::string outDir = XXXOutputDir(package.Path());
     CreateDirectoryIfNotExists(outDir);
 
-    f.seekg(0);
-    std::vector<char> headerData(headerSize);
-    f.read(headerData.data(), headerSize);
-    
-    std::ofstream hf(outDir + "/header.bin", std::ios::binary);
-    hf.write(headerData.data(), headerSize);
-    hf.close();
-
-    std::ofstream df(outDir + "/data.bin", std::ios::binary);
-    f.seekg(headerSize);
-    
-    // Buffered copy for data.bin
-    char buf[8192];
-    while (f.read(buf, sizeof(buf))) df.write(buf, sizeof(buf));
-    df.write(buf, f.gcount());
-    df.close();
-
-    std::cout << "Extracted header and data to " << outDir << std::endl;
-
-    // Scanning for FSB without loading entire file
-    f.clear();
-    f.seekg(0, std::ios::beg);
-    
-    int fsbCount = 0;
-    size_t pos = 0;
-    while (true) {
-        char c;
-        if (!f.get(c)) break;
-        if (c == 'F') {
-            char sig[3];
-            if (f.read(sig, 3)) {
-                if (sig[0] == 'S' && sig[1] == 'B' && (sig[2] == '4' || sig[2] == '5')) {
-                    size_t startPos = (size_t)f.tellg() - 4;
-                    std::cout << "Found FSB" << sig[2] << " [Index " << fsbCount << "] at 0x" << std::hex << startPos << std::dec << std::endl;
-
-                    uint32_t shdrSize = 0;
-                    uint32_t dataSize = 0;
-                    uint32_t totalFSBSize = 0;
-
-                    if (sig[2] == '4') {
-                        FSB4_HEADER fsbHeader;
-                        f.seekg(startPos);
-                        f.read((char*)&fsbHeader, sizeof(fsbHeader));
-                        shdrSize = LE32(fsbHeader.shdr_size);
-                        dataSize = LE32(fsbHeader.data_size);
-                        totalFSBSize = sizeof(FSB4_HEADER) + shdrSize + dataSize;
-                    } else {
-                        // FSB5 - just a placeholder chunk
-                        totalFSBSize = 1024 * 1024; // 1MB safe chunk
-                    }
-
-                    f.seekg(0, std::ios::end);
-                    size_t fileSize = (size_t)f.tellg();
-                    f.seekg(startPos);
-
-                    size_t available = fileSize - startPos;
-                    size_t toWrite = totalFSBSize;
-                    if (toWrite > available) {
-                        toWrite = available;
-                        std::cout << "  -> Detected Streaming Bank (truncated). Padding to match header size." << std::endl;
-                    }
-
-                    std::string fsbOutPath = outDir + "/audio_" + std::to_string(fsbCount) + ".fsb";
-                    std::ofstream fsbf(fsbOutPath, std::ios::binary);
-                    
-                    size_t remaining = toWrite;
-                    while (remaining > 0) {
-                        size_t chunk = (remaining > sizeof(buf)) ? sizeof(buf) : remaining;
-                        f.read(buf, chunk);
-                        fsbf.write(buf, f.gcount());
-                        remaining -= f.gcount();
-                        if (f.gcount() == 0) break;
-                    }
-
-                    if (toWrite < totalFSBSize) {
-                        std::vector<char> padding(totalFSBSize - toWrite, 0);
-                        fsbf.write(padding.data(), padding.size());
-                    }
-                    fsbf.close();
-
-                    // Sample extraction
-                    std::string samplesDir = outDir + "/audio_" + std::to_string(fsbCount) + "_samples";
-                    CreateDirectoryIfNotExists(samplesDir);
-                    auto samples = ParseFSB(fsbOutPath, 0, (uint32_t)startPos);
-                    if (!samples.empty()) {
-                        std::ifstream fsbIn(fsbOutPath, std::ios::binary);
-                        for (auto& s : samples) {
-                            if (s.offset + s.size <= totalFSBSize) {
-                                std::string sName = s.name + ".bin";
-                                std::ofstream sf(samplesDir + "/" + sName, std::ios::binary);
-                                fsbIn.seekg(s.offset);
-                                std::vector<char> sbuf(s.size);
-                                fsbIn.read(sbuf.data(), s.size);
-                                sf.write(sbuf.data(), s.size);
-                                sf.close();
-                            }
-                        }
-                    }
-
-                    fsbCount++;
-                    f.seekg(startPos + 4); // Continue after 'FSB'
-                } else {
-                    f.seekg((size_t)f.tellg() - 3);
-                }
+    WriteOutputFile(outDir + "/header.bin", data, headerSize, state, totals);
+    WriteOutputFile(outDir + "/data.bin", data + headerSize, fileSize - headerSize, state, totals);
+    totals.bytesRead += fileSize;
+    log << "Extracted header and data to " << outDir << std::endl;
+    return outDir;
+}
+
+void ExtractXXXBank(const XXXPackage& package, const FSBBank& bank, int fsbCount, const std::string& outDir,
+                    const ExtractOptions& options, std::ostream& log, ExtractTotals& totals, ExtractState* state) {
+    const char* data = package.Data();
+    size_t fileSize = package.Size();
+    size_t startPos = bank.info.offset;
+    log << "Found FSB" << bank.info.version << " [Index " << fsbCount << "] at 0x" << std::hex << startPos << std::dec << std::endl;
+
+    size_t available = fileSize - startPos;
+    const FSBIndex& index = bank.index;
+    bool parsed = bank.parsed;
+    uint64_t totalFSBSize = parsed ? index.TotalSize() : available;
+
+    size_t toWrite = totalFSBSize;
+    if (toWrite > available) {
+        toWrite = available;
+        log << "  -> Detected Streaming Bank (truncated)." << (options.writeFsbCopy ? " Extending the copy sparsely to match header size." : "") << std::endl;
+    }
+
+    if (options.writeFsbCopy) {
+        std::string fsbOutPath = outDir + "/audio_" + std::to_string(fsbCount) + ".fsb";
+        uint64_t hash = state ? XXH64(data + startPos, toWrite) : 0;
+        if (state && state->Reuse(fsbOutPath, totalFSBSize, hash)) {
+            totals.outputsSkipped++;
+        } else {
+            // The missing tail of a streaming bank becomes a hole, not zeros.
+            ScopedPhase phase("copy", fsbOutPath);
+            RandomAccessFile fsbf;
+            bool ok = fsbf.Open(fsbOutPath, RandomAccessFile::CreateTruncate) && fsbf.WriteAt(0, data + startPos, toWrite) &&
+                      (toWrite == totalFSBSize || fsbf.SetSize(totalFSBSize));
+            totals.bytesWritten += toWrite;
+            if (state && ok) {
+                state->Record(fsbOutPath, totalFSBSize, hash);
+            } else if (state) {
+                state->MarkIncomplete();
             }
         }
     }
+
+    // Samples are sliced straight out of the package, never from the copy.
+    std::string samplesDir = outDir + "/audio_" + std::to_string(fsbCount) + "_samples";
+    CreateDirectoryIfNotExists(samplesDir);
+    if (!parsed) log << "  -> Incomplete bank header, no samples extracted." << std::endl;
+    ReportFSBSamples(index, (uint32_t)startPos, log);
+    if (index.samples.empty()) return;
+
+    SampleOutput output;
+    std::ofstream storeManifest;
+    if (options.store) {
+        storeManifest.open(options.store->ManifestPath(package.Path(), fsbCount));
+        BeginStoreManifest(storeManifest, package.Path());
+        output.store = options.store;
+        output.manifest = &storeManifest;
+    }
+    output.state = state;
+
+    // Uncompressed packages are copied file to file; the decompressed view
+    // of compressed ones is written from memory. Storing and incremental
+    // runs hash the payload, which the mapping already has in memory.
+    RandomAccessFile source;
+    if (!output.store && !output.state && !package.IsCompressed() && source.Open(package.Path(), RandomAccessFile::ReadOnly)) {
+        WriteSampleFiles(source, startPos, toWrite, index.samples, samplesDir, totals);
+    } else {
+        WriteSampleFiles(data + startPos, toWrite, index.samples, samplesDir, totals, output);
+    }
+    if (options.writeWav) {
+        size_t undecoded = WriteWavFiles(data + startPos, toWrite, index.samples, samplesDir, totals, state);
+        if (undecoded > 0) log << "  -> " << undecoded << " sample(s) have no WAV decoder, kept as .bin only." << std::endl;
+    }
+
+    if (toWrite < totalFSBSize) {
+        std::string manifestPath = outDir + "/audio_" + std::to_string(fsbCount) + "_streamed.txt";
+        ExtractStreamedSamples(index, toWrite, samplesDir, manifestPath, options, log, totals, output);
+    }
 }
 
-void PatchXXXAudio(const std::string& xxxPath, const std::string& sampleName, const std::string& newAudioPath) {
-    std::ifstream f(xxxPath, std::ios::binary);
-    if (!f.is_open()) return;
+void ExtractXXX(const std::string& path, const ExtractOptions& options) {
+    ScopedPhase phase("extract", path);
+    ExtractState state(XXXOutputDir(path));
+    ExtractState* incremental = options.incremental ? &state : nullptr;
+    if (incremental && state.Begin(path, options)) {
+        std::cout << "Unchanged since the last extraction: " << path << std::endl;
+        return;
+    }
+
+    XXXPackage package;
+    if (!package.Open(path)) {
+        std::cout << "Failed to open " << path << std::endl;
+        return;
+    }
+
+    ExtractTotals totals;
+    std::string outDir = PrepareXXXExtraction(package, std::cout, totals, incremental);
+    if (outDir.empty()) return;
+
+    std::vector<FSBBank> banks = FindPackageBanks(package);
+    for (size_t i = 0; i < banks.size(); ++i) {
+        ExtractXXXBank(package, banks[i], (int)i, outDir, options, std::cout, totals, incremental);
+    }
+    if (incremental) {
+        state.End();
+        std::cout << totals.outputsSkipped << " unchanged output(s) left as they were" << std::endl;
+    }
+    if (options.store) PrintStoreTotals(totals, std::cout);
+}
+
+// Sample header for a WAV encoded shorter than the slot of sample i, so the
+// sample shrinks to the payload instead of playing, or looping, on over zero
+// padding. It takes the header-write path of patchfromfsb, which rebuilds the
+// bank; empty if the bank cannot be rebuilt or the payload fills the slot.
+static std::vector<char> ShortenedSampleHeader(const XXXPackage& package, const FSBBank& bank, size_t i, const WavEncodeJob& job) {
+    const FSBSample& s = bank.index.samples[i];
+    if (job.vag.size() >= s.size || job.sampleCount == 0 || !BankGrowthBlocker(package, bank).empty()) return std::vector<char>();
+    // Basic headers only take the lengths; the rest comes from the first sample.
+    bool basic = i > 0 && (LE32(bank.index.header.flags) & FSB4_FLAG_BASICHEADERS);
+    const char* h = package.Data() + bank.info.offset + (basic ? bank.index.samples[0] : s).headerOffset;
+    std::vector<char> header(h, h + sizeof(FSB4_SAMPLE_HEADER));
+    // A loop over the whole sample keeps covering it; others are clamped.
+    uint32_t loopEnd = s.loopEnd;
+    if (loopEnd >= job.sampleCount || (s.numSamples > 0 && loopEnd == s.numSamples - 1)) loopEnd = job.sampleCount - 1;
+    WriteLE32(header.data() + offsetof(FSB4_SAMPLE_HEADER, lengthsamples), job.sampleCount);
+    WriteLE32(header.data() + offsetof(FSB4_SAMPLE_HEADER, lengthcompressedbytes), (uint32_t)job.vag.size());
+    if (!basic) {
+        WriteLE32(header.data() + offsetof(FSB4_SAMPLE_HEADER, loopstart), std::min(s.loopStart, loopEnd));
+        WriteLE32(header.data() + offsetof(FSB4_SAMPLE_HEADER, loopend), loopEnd);
+    }
+    return header;
+}
+
+bool PatchXXXAudio(const std::string& xxxPath, const std::string& sampleName, const std::string& newAudioPath, const std::string& outPath) {
+    XXXPackage package;
+    if (!package.Open(xxxPath)) return false;
 
-    // Scan for FSB4 without loading everything
     bool found = false;
-    while (true) {
-        char c;
-        if (!f.get(c)) break;
-        if (c == 'F') {
-            char sig[3];
-            if (f.read(sig, 3)) {
-                if (sig[0] == 'S' && sig[1] == 'B' && sig[2] == '4') {
-                    size_t startPos = (size_t)f.tellg() - 4;
-                    
-                    FSB4_HEADER fsbHeader;
-                    f.seekg(startPos);
-                    f.read((char*)&fsbHeader, sizeof(fsbHeader));
-                    
-                    uint32_t numSamples = LE32(fsbHeader.numsamples);
-                    uint32_t shdrSize = LE32(fsbHeader.shdr_size);
-                    
-                    uint32_t currentSampleHeaderOffset = (uint32_t)startPos + sizeof(FSB4_HEADER);
-                    uint32_t dataOffsetBase = (uint32_t)startPos + sizeof(FSB4_HEADER) + shdrSize;
-                    uint32_t currentDataOffset = 0;
-
-                    for (uint32_t j = 0; j < numSamples; ++j) {
-                        f.seekg(currentSampleHeaderOffset);
-                        uint16_t sampleHeaderSize;
-                        f.read((char*)&sampleHeaderSize, 2);
-                        sampleHeaderSize = LE16(sampleHeaderSize);
-                        
-                        char name[31];
-                        memset(name, 0, 31);
-                        f.read(name, 30);
-                        
-                        if (std::string(name) == sampleName) {
-                            f.seekg(currentSampleHeaderOffset + 2 + 30 + 4);
-                            uint32_t compressedSize;
-                            f.read((char*)&compressedSize, 4);
-                            compressedSize = LE32(compressedSize);
-                            
-                            uint32_t uncompressedSize;
-                            f.read((char*)&uncompressedSize, 4);
-                            uncompressedSize = LE32(uncompressedSize);
-
-                            uint32_t actualDataSize = (compressedSize > uncompressedSize) ? compressedSize : uncompressedSize;
-
-                            std::ifstream newData(newAudioPath, std::ios::binary);
-                            if (!newData.is_open()) {
-                                std::cout << "Failed to open new audio data" << std::endl;
-                                return;
-                            }
-                            newData.seekg(0, std::ios::end);
-                            uint32_t newSize = (uint32_t)newData.tellg();
-                            newData.seekg(0, std::ios::beg);
-
-                            if (newSize > actualDataSize) {
-                                std::cout << "New audio too large for " << sampleName << " (" << newSize << " > " << actualDataSize << ")" << std::endl;
-                                return;
-                            }
-
-                            if (newSize < actualDataSize / 1.5) {
-                                std::cout << "Warning: New data is much smaller than the original slot. If the sound is corrupt, use 'patchfromfsb' with a source FSB to update metadata (channels/frequency)." << std::endl;
-                            }
-
-                            std::fstream xxxFile(xxxPath, std::ios::binary | std::ios::in | std::ios::out);
-                            xxxFile.seekp(dataOffsetBase + currentDataOffset);
-                            
-                            char patchBuf[4096];
-                            while (newData.read(patchBuf, sizeof(patchBuf))) xxxFile.write(patchBuf, sizeof(patchBuf));
-                            xxxFile.write(patchBuf, newData.gcount());
-                            
-                            if (newSize < actualDataSize) {
-                                std::vector<char> padding(actualDataSize - newSize, 0);
-                                xxxFile.write(padding.data(), padding.size());
-                            }
-                            
-                            std::cout << "Patched " << sampleName << " in " << xxxPath << " at 0x" << std::hex << (dataOffsetBase + currentDataOffset) << std::dec 
-                                      << " (" << actualDataSize << " -> " << newSize << " bytes)" << std::endl;
-                            found = true;
-                            break;
-                        }
-                        
-                        // Advance
-                        f.seekg(currentSampleHeaderOffset + 2 + 30 + 4);
-                        uint32_t sampleCompressedSize;
-                        f.read((char*)&sampleCompressedSize, 4);
-                        sampleCompressedSize = LE32(sampleCompressedSize);
-                        
-                        uint32_t sampleUncompressedSize;
-                        f.read((char*)&sampleUncompressedSize, 4);
-                        sampleUncompressedSize = LE32(sampleUncompressedSize);
-
-                        uint32_t actualSampleDataSize = (sampleCompressedSize > sampleUncompressedSize) ? sampleCompressedSize : sampleUncompressedSize;
-
-                        currentDataOffset += Align(actualSampleDataSize, 32);
-                        currentSampleHeaderOffset += sampleHeaderSize;
-                    }
-                } else {
-                    f.seekg((size_t)f.tellg() - 3);
-                }
+    uint32_t patchOffset = 0;
+    uint32_t actualDataSize = 0;
+    const FSBSample* target = nullptr;
+    const FSBBank* targetBank = nullptr;
+
+    std::vector<FSBBank> banks = FindPackageBanks(package);
+    for (const auto& bank : banks) {
+        if (!bank.parsed) continue;
+
+        for (const auto& sample : bank.index.samples) {
+            if (sample.name == sampleName) {
+                patchOffset = (uint32_t)bank.info.offset + sample.offset;
+                actualDataSize = sample.size;
+                target = &sample;
+                targetBank = &bank;
+                found = true;
+                break;
             }
         }
         if (found) break;
     }
-    
+
+    // A cue name stands for the sample it plays
+    std::string targetName = sampleName;
+    if (!found) {
+        PackageTables tables(package);
+        std::vector<PackageCue> cues;
+        MapPackageCues(package, tables, banks, cues);
+        const PackageCue* cue = FindCue(cues, sampleName);
+        if (cue && cue->bankIndex >= 0 && cue->samples.size() > 1) {
+            std::cout << "Cue " << sampleName << " plays " << cue->samples.size() << " samples, patch them by name:" << std::endl;
+            for (uint32_t s : cue->samples) std::cout << "  " << banks[cue->bankIndex].index.samples[s].name << std::endl;
+            return false;
+        }
+        if (cue && cue->bankIndex >= 0 && cue->samples.size() == 1) {
+            const FSBBank& bank = banks[cue->bankIndex];
+            const FSBSample& sample = bank.index.samples[cue->samples[0]];
+            targetName = sample.name;
+            patchOffset = (uint32_t)bank.info.offset + sample.offset;
+            actualDataSize = sample.size;
+            target = &sample;
+            targetBank = &bank;
+            found = true;
+            std::cout << "Cue " << sampleName << " plays " << targetName << std::endl;
+        }
+    }
+
     if (!found) {
         std::cout << "Sample " << sampleName << " not found in " << xxxPath << std::endl;
+        return false;
+    }
+
+    int64_t newFileSize = GetFileLength(newAudioPath);
+    if (newFileSize < 0) {
+        std::cout << "Failed to open new audio data" << std::endl;
+        return false;
+    }
+    uint32_t newSize = (uint32_t)newFileSize;
+
+    // WAV files are encoded in the format of the sample they replace
+    std::vector<char> encoded;
+    std::vector<char> header;
+    if (IsWavFile(newAudioPath)) {
+        if (target->codec != FSB_CODEC_VAG) {
+            std::cout << newAudioPath << " is a WAV file, but " << targetName << " is " << GetFormatString(target->codec)
+                      << "; only VAG samples can be encoded from WAV" << std::endl;
+            return false;
+        }
+        std::vector<WavEncodeJob> jobs(1);
+        jobs[0].path = newAudioPath;
+        jobs[0].frequency = (uint32_t)target->frequency;
+        jobs[0].channels = target->channels;
+        EncodeWavFiles(jobs);
+        if (!jobs[0].error.empty()) {
+            std::cout << "Failed to encode " << newAudioPath << ": " << jobs[0].error << std::endl;
+            return false;
+        }
+        header = ShortenedSampleHeader(package, *targetBank, target - targetBank->index.samples.data(), jobs[0]);
+        encoded.swap(jobs[0].vag);
+        newSize = (uint32_t)encoded.size();
+        std::cout << "Encoded " << newAudioPath << " to VAG (" << target->frequency << "Hz, " << target->channels << " channel(s), "
+                  << newSize << " bytes)" << std::endl;
+    }
+
+    if (newSize > actualDataSize) {
+        std::string blocker = BankGrowthBlocker(package, *targetBank);
+        if (!blocker.empty()) {
+            std::cout << "New audio is larger than the slot of " << targetName << " (" << newSize << " > " << actualDataSize
+                      << ") and the sample cannot grow: " << blocker << std::endl;
+            return false;
+        }
+        std::cout << "New audio is larger than the slot of " << targetName << " (" << newSize << " > " << actualDataSize
+                  << "), the package will be rebuilt" << std::endl;
+    } else if (!header.empty()) {
+        std::cout << "Encoded audio is shorter than the slot of " << targetName << ", its sample header is updated and the package will be rebuilt"
+                  << std::endl;
+    } else if (newSize < actualDataSize / 1.5 && !encoded.empty()) {
+        std::cout << "Warning: Encoded audio is much shorter than the slot of " << targetName
+                  << " and its bank cannot be rebuilt; the rest of the slot plays as silence" << std::endl;
+    } else if (newSize < actualDataSize / 1.5) {
+        std::cout << "Warning: New data is much smaller than the original slot. If the sound is corrupt, use 'patchfromfsb' with a source FSB to update metadata (channels/frequency)." << std::endl;
     }
+
+    PatchBatch batch;
+    PatchWrite write = { patchOffset, actualDataSize, newSize, newAudioPath, 0, targetName, header, encoded };
+    batch.Add(write);
+    PatchStats stats;
+    if (!batch.Apply(package, stats, outPath)) return false;
+    PrintRecompressStats(stats);
+
+    std::cout << "Patched " << targetName << " in " << (outPath.empty() ? xxxPath : outPath) << " at 0x" << std::hex << patchOffset << std::dec
+              << " (" << actualDataSize << " -> " << newSize << " bytes)" << std::endl;
+    return true;
+}
+
+// Replacement files keyed by every rule patchall accepts. Each map keeps the
+// position of the first file in directory order, so resolving a sample picks
+// the same file the old linear scan did.
+struct ReplacementIndex {
+    std::unordered_map<std::string, size_t> exact;    // "<name>"
+    std::unordered_map<std::string, size_t> binStem;  // "<name>.bin", keyed by name
+    std::unordered_map<uint32_t, size_t> indexBin;    // "<index>.bin"
+    std::unordered_map<uint32_t, size_t> indexPrefix; // "<index>_..."
+};
+
+// Parses s[0, end) as a sample index written the way std::to_string writes it.
+static bool ParseSampleIndex(const std::string& s, size_t end, uint32_t& value) {
+    if (end == 0 || end > 10 || (s[0] == '0' && end > 1)) return false;
+    uint64_t v = 0;
+    for (size_t i = 0; i < end; ++i) {
+        if (s[i] < '0' || s[i] > '9') return false;
+        v = v * 10 + (s[i] - '0');
+    }
+    if (v > 0xFFFFFFFFull) return false;
+    value = (uint32_t)v;
+    return true;
+}
+
+static ReplacementIndex BuildReplacementIndex(const std::vector<std::string>& files) {
+    ReplacementIndex idx;
+    for (size_t k = 0; k < files.size(); ++k) {
+        const std::string& file = files[k];
+        uint32_t n;
+        idx.exact.emplace(file, k);
+        if (file.size() > 4 && file.compare(file.size() - 4, 4, ".bin") == 0) {
+            idx.binStem.emplace(file.substr(0, file.size() - 4), k);
+            if (ParseSampleIndex(file, file.size() - 4, n)) idx.indexBin.emplace(n, k);
+        }
+        size_t underscore = file.find('_');
+        if (underscore != std::string::npos && ParseSampleIndex(file, underscore, n)) idx.indexPrefix.emplace(n, k);
+    }
+    return idx;
+}
+
+// Returns the position of the replacement file for a sample, or -1.
+static int64_t FindReplacement(const ReplacementIndex& idx, const std::string& sampleName, uint32_t sampleIndex) {
+    int64_t best = -1;
+    auto consider = [&best](size_t k) {
+        if (best < 0 || (int64_t)k < best) best = (int64_t)k;
+    };
+
+    auto e = idx.exact.find(sampleName);
+    if (e != idx.exact.end()) consider(e->second);
+    auto b = idx.binStem.find(sampleName);
+    if (b != idx.binStem.end()) consider(b->second);
+    auto ib = idx.indexBin.find(sampleIndex);
+    if (ib != idx.indexBin.end()) consider(ib->second);
+    auto ip = idx.indexPrefix.find(sampleIndex);
+    if (ip != idx.indexPrefix.end()) consider(ip->second);
+    return best;
 }
 
-void PatchAllXXXAudio(const std::string& xxxPath, const std::string& folderPath) {
+bool PlanPatchAll(const XXXPackage& package, const std::string& folderPath, PatchPlan& plan) {
+    ScopedPhase phase("plan", folderPath);
     std::vector<std::string> files = GetFilesInDirectory(folderPath);
     if (files.empty()) {
         std::cout << "No files found in folder " << folderPath << std::endl;
+        return false;
+    }
+
+    CatalogEntry fingerprint;
+    if (!FingerprintFile(package.Path(), fingerprint)) return false;
+    plan.packagePath = fingerprint.path;
+    plan.packageSize = fingerprint.size;
+    plan.packageHash = fingerprint.hash;
+    plan.folder = GetAbsolutePath(folderPath);
+
+    ReplacementIndex replacements = BuildReplacementIndex(files);
+    std::vector<bool> used(files.size(), false);
+
+    // Why a replacement of newSize bytes cannot go into the sample's slot, if
+    // it cannot.
+    auto skipReason = [&package](int64_t newSize, const PatchWrite& w, const std::string& growBlocker) -> std::string {
+        if (newSize < 0) return "cannot be read";
+        if ((size_t)w.offset + w.slotSize > package.Size()) return "sample slot runs past the end of the package";
+        if ((uint64_t)newSize > w.slotSize && !growBlocker.empty()) return "larger than its slot; " + growBlocker;
+        if ((uint64_t)newSize > UINT32_MAX) return "too large";
+        return std::string();
+    };
+
+    // WAV replacements are encoded together once every sample is matched
+    std::vector<PatchWrite> wavWrites;
+    std::vector<std::pair<const FSBBank*, uint32_t>> wavSamples; // Bank and index of each
+    std::vector<std::string> wavGrowBlockers;
+    std::vector<WavEncodeJob> wavJobs;
+
+    std::vector<FSBBank> banks = FindPackageBanks(package);
+    for (const auto& bank : banks) {
+        if (!bank.parsed) continue;
+        size_t startPos = bank.info.offset;
+        const FSBIndex& index = bank.index;
+        std::string growBlocker = BankGrowthBlocker(package, bank);
+
+        for (uint32_t j = 0; j < index.samples.size(); ++j) {
+            const FSBSample& sample = index.samples[j];
+            const std::string& sampleName = sample.name;
+            uint32_t sampleOffset = (uint32_t)startPos + sample.offset;
+            uint32_t actualDataSize = sample.size;
+
+            // Check if we have a matching file
+            int64_t match = FindReplacement(replacements, sampleName, j);
+            if (match < 0) continue;
+            used[match] = true;
+            std::string matchingFile = plan.folder + "/" + files[match];
+
+            PatchWrite write = { sampleOffset, actualDataSize, 0, matchingFile, 0, sampleName, std::vector<char>(), std::vector<char>() };
+            PlanSkip skip = { matchingFile, sampleName, std::string() };
+            if (IsWavFile(matchingFile)) {
+                if (sample.codec != FSB_CODEC_VAG) {
+                    skip.reason = "is a WAV file, but the sample is " + GetFormatString(sample.codec) + "; only VAG samples can be encoded";
+                    plan.skipped.push_back(skip);
+                    continue;
+                }
+                WavEncodeJob job;
+                job.path = matchingFile;
+                job.frequency = (uint32_t)sample.frequency;
+                job.channels = sample.channels;
+                wavJobs.push_back(job);
+                wavWrites.push_back(write);
+                wavSamples.push_back(std::make_pair(&bank, j));
+                wavGrowBlockers.push_back(growBlocker);
+                continue;
+            }
+
+            int64_t newFileSize = GetFileLength(matchingFile);
+            skip.reason = skipReason(newFileSize, write, growBlocker);
+            if (!skip.reason.empty()) {
+                plan.skipped.push_back(skip);
+                continue;
+            }
+            write.dataSize = (uint32_t)newFileSize;
+            plan.writes.push_back(write);
+        }
+    }
+
+    EncodeWavFiles(wavJobs);
+    for (size_t k = 0; k < wavJobs.size(); ++k) {
+        PatchWrite& write = wavWrites[k];
+        PlanSkip skip = { write.sourcePath, write.sampleName, std::string() };
+        if (!wavJobs[k].error.empty()) {
+            skip.reason = "cannot be encoded: " + wavJobs[k].error;
+        } else {
+            skip.reason = skipReason((int64_t)wavJobs[k].vag.size(), write, wavGrowBlockers[k]);
+        }
+        if (!skip.reason.empty()) {
+            plan.skipped.push_back(skip);
+            continue;
+        }
+        write.dataSize = (uint32_t)wavJobs[k].vag.size();
+        write.header = ShortenedSampleHeader(package, *wavSamples[k].first, wavSamples[k].second, wavJobs[k]);
+        write.data.swap(wavJobs[k].vag);
+        plan.writes.push_back(write);
+    }
+
+    for (size_t k = 0; k < files.size(); ++k) {
+        if (used[k]) continue;
+        PlanSkip skip = { plan.folder + "/" + files[k], std::string(), "no matching sample" };
+        plan.skipped.push_back(skip);
+    }
+    std::stable_sort(plan.writes.begin(), plan.writes.end(), [](const PatchWrite& a, const PatchWrite& b) { return a.offset < b.offset; });
+    return true;
+}
+
+// Prints what a plan will do, the way patchall always has.
+static void ReportPlannedWrites(const PatchPlan& plan) {
+    for (const auto& w : plan.writes) {
+        if (w.dataSize > w.slotSize) {
+            std::cout << "  " << w.sourcePath << " is larger than its slot (" << w.dataSize << " > " << w.slotSize << "), the package will be rebuilt" << std::endl;
+        } else if (!w.header.empty()) {
+            std::cout << "  " << w.sourcePath << " is shorter than its slot, its sample header is updated and the package will be rebuilt" << std::endl;
+        } else if (IsMuchSmaller(w)) {
+            std::cout << "  Warning: New data is much smaller than original. Suggest using 'patchfromfsb'." << std::endl;
+        }
+        std::cout << "Auto-patched: " << w.sampleName << " [Offset: 0x" << std::hex << w.offset << std::dec << "] (" << w.slotSize << " -> " << w.dataSize << " bytes)" << std::endl;
+    }
+    for (const auto& s : plan.skipped) {
+        if (!s.sample.empty()) std::cout << "Warning: " << s.file << " " << s.reason << ". Skipping." << std::endl;
+    }
+}
+
+static bool ApplyPlan(XXXPackage& package, const PatchPlan& plan, const std::string& outPath) {
+    PatchBatch batch;
+    for (const auto& w : plan.writes) batch.Add(w);
+    PatchStats stats;
+    if (!batch.Apply(package, stats, outPath)) return false;
+    PrintPatchStats(stats);
+    std::cout << "Finished. Total samples patched: " << stats.applied << std::endl;
+    return true;
+}
+
+void PatchAllXXXAudio(const std::string& xxxPath, const std::string& folderPath, const std::string& outPath) {
+    XXXPackage package;
+    if (!package.Open(xxxPath)) {
+        std::cout << "Failed to open " << xxxPath << std::endl;
         return;
     }
 
-    std::ifstream f(xxxPath, std::ios::binary);
-    if (!f.is_open()) {
+    PatchPlan plan;
+    if (!PlanPatchAll(package, folderPath, plan)) return;
+    ReportPlannedWrites(plan);
+    ApplyPlan(package, plan, outPath);
+}
+
+void PlanXXXAudio(const std::string& xxxPath, const std::string& folderPath, const std::string& planPath) {
+    XXXPackage package;
+    if (!package.Open(xxxPath)) {
         std::cout << "Failed to open " << xxxPath << std::endl;
         return;
     }
+    PatchPlan plan;
+    if (!PlanPatchAll(package, folderPath, plan)) return;
 
-    int patchCount = 0;
-    while (true) {
-        char c;
-        if (!f.get(c)) break;
-        if (c == 'F') {
-            char sig[3];
-            if (f.read(sig, 3)) {
-                if (sig[0] == 'S' && sig[1] == 'B' && sig[2] == '4') {
-                    size_t startPos = (size_t)f.tellg() - 4;
-                    
-                    FSB4_HEADER fsbHeader;
-                    f.seekg(startPos);
-                    f.read((char*)&fsbHeader, sizeof(fsbHeader));
-                    
-                    uint32_t numSamples = LE32(fsbHeader.numsamples);
-                    uint32_t shdrSize = LE32(fsbHeader.shdr_size);
-                    
-                    uint32_t currentSampleHeaderOffset = (uint32_t)startPos + sizeof(FSB4_HEADER);
-                    uint32_t dataOffsetBase = (uint32_t)startPos + sizeof(FSB4_HEADER) + shdrSize;
-                    uint32_t currentDataOffset = 0;
-
-                    for (uint32_t j = 0; j < numSamples; ++j) {
-                        f.seekg(currentSampleHeaderOffset);
-                        uint16_t sampleHeaderSize;
-                        f.read((char*)&sampleHeaderSize, 2);
-                        sampleHeaderSize = LE16(sampleHeaderSize);
-                        
-                        char name[31];
-                        memset(name, 0, 31);
-                        f.read(name, 30);
-                        std::string sampleName(name);
-
-                        f.seekg(currentSampleHeaderOffset + 2 + 30 + 4);
-                        uint32_t compressedSize;
-                        f.read((char*)&compressedSize, 4);
-                        compressedSize = LE32(compressedSize);
-                        
-                        uint32_t uncompressedSize;
-                        f.read((char*)&uncompressedSize, 4);
-                        uncompressedSize = LE32(uncompressedSize);
-
-                        uint32_t actualDataSize = (compressedSize > uncompressedSize) ? compressedSize : uncompressedSize;
-
-                        // Check if we have a matching file
-                        std::string matchingFile = "";
-                        for (const auto& file : files) {
-                            if (file == sampleName || file == (sampleName + ".bin") ||
-                                file == (std::to_string(j) + ".bin") ||
-                                file.find(std::to_string(j) + "_") == 0) {
-                                matchingFile = folderPath + "/" + file;
-                                break;
-                            }
-                        }
-
-                        if (!matchingFile.empty()) {
-                            std::ifstream newData(matchingFile, std::ios::binary);
-                            if (newData.is_open()) {
-                                newData.seekg(0, std::ios::end);
-                                uint32_t newSize = (uint32_t)newData.tellg();
-                                newData.seekg(0, std::ios::beg);
-
-                                if (newSize > actualDataSize) {
-                                    std::cout << "Warning: " << matchingFile << " too large (" << newSize << " > " << actualDataSize << "). Skipping." << std::endl;
-                                } else {
-                                    if (newSize < actualDataSize / 1.5) {
-                                        std::cout << "  Warning: New data is much smaller than original. Suggest using 'patchfromfsb'." << std::endl;
-                                    }
-                                    std::fstream xxxFile(xxxPath, std::ios::binary | std::ios::in | std::ios::out);
-                                    xxxFile.seekp(dataOffsetBase + currentDataOffset);
-                                    
-                                    char patchBuf[4096];
-                                    while (newData.read(patchBuf, sizeof(patchBuf))) xxxFile.write(patchBuf, sizeof(patchBuf));
-                                    xxxFile.write(patchBuf, newData.gcount());
-                                    
-                                    if (newSize < actualDataSize) {
-                                        std::vector<char> padding(actualDataSize - newSize, 0);
-                                        xxxFile.write(padding.data(), padding.size());
-                                    }
-                                    
-                                    std::cout << "Auto-patched: " << sampleName << " [Offset: 0x" << std::hex << (dataOffsetBase + currentDataOffset) << std::dec << "] (" << actualDataSize << " -> " << newSize << " bytes)" << std::endl;
-                                    patchCount++;
-                                }
-                            }
-                        }
-                        
-                        currentDataOffset += Align(actualDataSize, 32);
-                        currentSampleHeaderOffset += sampleHeaderSize;
-                    }
-                } else {
-                    f.seekg((size_t)f.tellg() - 3);
+    if (planPath.empty()) {
+        WritePatchPlan(plan, std::cout);
+        return;
+    }
+    std::ofstream out(planPath, std::ios::binary);
+    WritePatchPlan(plan, out);
+    out.close();
+    if (!out.good()) {
+        std::cout << "Failed to write plan " << planPath << std::endl;
+        return;
+    }
+    size_t grows = 0, small = 0;
+    for (const auto& w : plan.writes) {
+        if (w.dataSize > w.slotSize) grows++;
+        if (IsMuchSmaller(w)) small++;
+    }
+    std::cout << "Planned " << plan.writes.size() << " write(s) (" << grows << " growing, " << small << " much smaller), "
+              << plan.skipped.size() << " skipped: " << planPath << std::endl;
+}
+
+// Encodes the WAV sources of a plan read back from JSON again, in the format
+// of the samples they replace. The encoder is deterministic, so each payload
+// must come out at the planned size.
+static bool EncodePlannedWavs(const XXXPackage& package, PatchPlan& plan) {
+    std::vector<size_t> writes;
+    std::vector<std::pair<const FSBBank*, uint32_t>> samples; // Bank and index of each
+    std::vector<WavEncodeJob> jobs;
+    std::vector<FSBBank> banks;
+    for (size_t i = 0; i < plan.writes.size(); ++i) {
+        if (!plan.encoded[i]) continue;
+        if (banks.empty()) banks = FindPackageBanks(package);
+        const FSBSample* target = nullptr;
+        const FSBBank* targetBank = nullptr;
+        for (const auto& bank : banks) {
+            for (const auto& s : bank.index.samples) {
+                if (bank.info.offset + s.offset == plan.writes[i].offset && s.name == plan.writes[i].sampleName) {
+                    target = &s;
+                    targetBank = &bank;
                 }
             }
         }
+        if (!target || target->codec != FSB_CODEC_VAG) {
+            std::cout << "No VAG sample " << plan.writes[i].sampleName << " at 0x" << std::hex << plan.writes[i].offset << std::dec
+                      << " in " << plan.packagePath << std::endl;
+            return false;
+        }
+        WavEncodeJob job;
+        job.path = plan.writes[i].sourcePath;
+        job.frequency = (uint32_t)target->frequency;
+        job.channels = target->channels;
+        jobs.push_back(job);
+        writes.push_back(i);
+        samples.push_back(std::make_pair(targetBank, (uint32_t)(target - targetBank->index.samples.data())));
     }
-    std::cout << "Finished. Total samples patched: " << patchCount << std::endl;
+
+    EncodeWavFiles(jobs);
+    for (size_t k = 0; k < jobs.size(); ++k) {
+        PatchWrite& w = plan.writes[writes[k]];
+        if (!jobs[k].error.empty() || jobs[k].vag.size() != w.dataSize) {
+            std::cout << w.sourcePath << " changed since the plan was made. Plan it again." << std::endl;
+            return false;
+        }
+        w.header = ShortenedSampleHeader(package, *samples[k].first, samples[k].second, jobs[k]);
+        w.data.swap(jobs[k].vag);
+    }
+    return true;
+}
+
+bool ApplyXXXPlan(const std::string& planPath, const std::string& outPath) {
+    PatchPlan plan;
+    if (!ReadPatchPlan(planPath, plan)) return false;
+
+    CatalogEntry fingerprint;
+    if (!FingerprintFile(plan.packagePath, fingerprint) || fingerprint.size != plan.packageSize || fingerprint.hash != plan.packageHash) {
+        std::cout << plan.packagePath << " changed since the plan was made. Plan it again." << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < plan.writes.size(); ++i) {
+        const PatchWrite& w = plan.writes[i];
+        int64_t size = GetFileLength(w.sourcePath);
+        bool stale = plan.encoded[i] ? !IsWavFile(w.sourcePath) : size < 0 || (uint64_t)size < w.sourceOffset + w.dataSize;
+        if (stale) {
+            std::cout << w.sourcePath << " changed since the plan was made. Plan it again." << std::endl;
+            return false;
+        }
+    }
+
+    XXXPackage package;
+    if (!package.Open(plan.packagePath)) return false;
+    if (!EncodePlannedWavs(package, plan)) return false;
+    return ApplyPlan(package, plan, outPath);
+}
+
+// Loads the header region of a donor FSB4 bank file with a single read
+// beyond the bank header.
+static bool ReadDonorBank(const std::string& path, std::vector<char>& region, FSBIndex& index, uint64_t& fileSize) {
+    RandomAccessFile f;
+    if (!f.Open(path, RandomAccessFile::ReadOnly)) return false;
+    fileSize = f.Size();
+    if (fileSize < sizeof(FSB4_HEADER)) return false;
+    region.resize(sizeof(FSB4_HEADER));
+    if (!f.ReadAt(0, region.data(), region.size())) return false;
+    uint32_t regionSize = FSBHeaderRegionSize(region.data(), region.size());
+    if (regionSize == 0 || regionSize > fileSize || memcmp(region.data(), "FSB4", 4) != 0) return false;
+    region.resize(regionSize);
+    return f.ReadAt(0, region.data(), regionSize) && ParseFSBIndex(region.data(), regionSize, index);
 }
 
+void PatchXXXFromFSB(const std::string& xxxPath, const std::string& donorPath, const std::string& outPath) {
+    std::vector<char> region;
+    FSBIndex donor;
+    uint64_t donorSize = 0;
+    if (!ReadDonorBank(donorPath, region, donor, donorSize)) {
+        std::cout << "Failed to read donor FSB4 bank " << donorPath << std::endl;
+        return;
+    }
+
+    // Full sample headers of the donor, keyed by name. Samples stored with a
+    // basic header take the format of the first sample and their own lengths.
+    uint32_t flags = LE32(donor.header.flags);
+    std::unordered_map<std::string, size_t> donorSamples;
+    std::vector<std::vector<char>> donorHeaders(donor.samples.size());
+    // Donor samples already reported are not reported again as missing.
+    std::vector<bool> used(donor.samples.size(), false);
+    for (size_t i = 0; i < donor.samples.size(); ++i) {
+        const FSBSample& s = donor.samples[i];
+        if ((uint64_t)s.offset + s.size > donorSize) {
+            std::cout << "Warning: Donor sample " << s.name << " runs past the end of " << donorPath << ". Skipping." << std::endl;
+            used[i] = true;
+            continue;
+        }
+        const FSBSample& full = (i > 0 && (flags & FSB4_FLAG_BASICHEADERS)) ? donor.samples[0] : s;
+        const char* h = region.data() + full.headerOffset;
+        donorHeaders[i].assign(h, h + sizeof(FSB4_SAMPLE_HEADER));
+        WriteLE32(donorHeaders[i].data() + offsetof(FSB4_SAMPLE_HEADER, lengthsamples), s.numSamples);
+        WriteLE32(donorHeaders[i].data() + offsetof(FSB4_SAMPLE_HEADER, lengthcompressedbytes), s.size);
+        donorSamples.emplace(s.name, i);
+    }
+
+    XXXPackage package;
+    if (!package.Open(xxxPath)) return;
+
+    // Samples the package cannot take are reported here rather than by Apply,
+    // so that only the writes actually applied are listed afterwards.
+    std::vector<std::pair<const FSBSample*, uint32_t>> patched; // Sample and original offset
+    PatchBatch batch;
+    std::vector<FSBBank> banks = FindPackageBanks(package);
+    for (const auto& bank : banks) {
+        if (!bank.parsed) continue;
+        for (const auto& sample : bank.index.samples) {
+            auto it = donorSamples.find(sample.name);
+            if (it == donorSamples.end()) continue;
+            used[it->second] = true;
+            const FSBSample& d = donor.samples[it->second];
+            uint32_t offset = (uint32_t)bank.info.offset + sample.offset;
+            PatchWrite write = { offset, sample.size, d.size, donorPath, d.offset, sample.name, donorHeaders[it->second], std::vector<char>() };
+            if ((size_t)offset + sample.size > package.Size()) {
+                std::cout << "Warning: Sample slot of " << sample.name << " runs past the end of the package. Skipping." << std::endl;
+                continue;
+            }
+            std::string blocker = RelocationBlocker(package, banks, write);
+            if (!blocker.empty()) {
+                std::cout << "Warning: Cannot update the header of " << sample.name << ", " << blocker << ". Skipping." << std::endl;
+                continue;
+            }
+            batch.Add(write);
+            patched.push_back(std::make_pair(&sample, offset));
+        }
+    }
+
+    for (size_t i = 0; i < donor.samples.size(); ++i) {
+        if (!used[i]) std::cout << "Warning: Donor sample " << donor.samples[i].name << " not found in " << xxxPath << std::endl;
+    }
+    if (batch.Count() == 0) return;
+
+    PatchStats stats;
+    if (!batch.Apply(package, stats, outPath)) return;
+    for (const auto& p : patched) {
+        const FSBSample& sample = *p.first;
+        const FSBSample& d = donor.samples[donorSamples[sample.name]];
+        std::cout << "Patched from donor: " << sample.name << " [Offset: 0x" << std::hex << p.second << std::dec << "] (" << sample.size << " -> "
+                  << d.size << " bytes, " << GetFormatString(d.codec) << ", " << d.channels << " ch, " << d.frequency << "Hz)" << std::endl;
+    }
+    PrintPatchStats(stats);
+    std::cout << "Finished. Total samples patched: " << stats.applied << std::endl;
+}
@@ -1,10 +1,40 @@
 #ifndef XXX_H
 #define XXX_H
 
-#include "FSB.h"
+#include "Package.h"
+#include "Scanner.h"
 
-void ExtractXXX(const std::string& path);
-void PatchXXXAudio(const std::string& xxxPath, const std::string& sampleName, const std::string& newAudioPath);
-void PatchAllXXXAudio(const std::string& xxxPath, const std::string& folderPath);
+struct PatchPlan;
+
+void ExtractXXX(const std::string& path, const ExtractOptions& options = ExtractOptions());
+// Folder a package is extracted into.
+std::string XXXOutputDir(const std::string& path);
+// Writes header.bin and data.bin of an opened package and returns the output
+// folder, or an empty string if the package is unusable. With a state, files
+// whose bytes did not change since the last run are left alone.
+std::string PrepareXXXExtraction(const XXXPackage& package, std::ostream& log, ExtractTotals& totals, ExtractState* state = nullptr);
+// Writes one bank of a package: its sample files, sliced straight from the
+// package, and optionally an audio_N.fsb copy. Banks are independent of each
+// other and may be extracted concurrently.
+void ExtractXXXBank(const XXXPackage& package, const FSBBank& bank, int bankIndex, const std::string& outDir,
+                    const ExtractOptions& options, std::ostream& log, ExtractTotals& totals, ExtractState* state = nullptr);
+// The patch functions rewrite the package in place, or with outPath write the
+// patched package there and leave the original untouched.
+// sampleName may also name a cue that plays a single sample. False if the
+// sample was not patched.
+bool PatchXXXAudio(const std::string& xxxPath, const std::string& sampleName, const std::string& newAudioPath,
+                   const std::string& outPath = std::string());
+void PatchAllXXXAudio(const std::string& xxxPath, const std::string& folderPath, const std::string& outPath = std::string());
+// Resolves every file of folderPath to a sample of the package the way
+// patchall does, without writing anything.
+bool PlanPatchAll(const XXXPackage& package, const std::string& folderPath, PatchPlan& plan);
+// Writes the patchall plan for a folder as JSON to planPath (stdout if empty).
+void PlanXXXAudio(const std::string& xxxPath, const std::string& folderPath, const std::string& planPath);
+// Applies a saved plan, provided the package and replacement files are unchanged.
+bool ApplyXXXPlan(const std::string& planPath, const std::string& outPath = std::string());
+// Replaces every sample of the package that has a namesake in the donor FSB4
+// bank, payload and sample header (lengths, loop points, mode, frequency and
+// channels) alike.
+void PatchXXXFromFSB(const std::string& xxxPath, const std::string& donorPath, const std::string& outPath = std::string());
 
 #endif
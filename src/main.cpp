@@ -1,17 +1,131 @@
 #include "XXX.h"
+#include "Batch.h"
+#include "Catalog.h"
+#include "Cues.h"
+#include "Journal.h"
+#include "Search.h"
+#include "Stats.h"
+#include "Store.h"
+#include <cstdlib>
 #include <iostream>
+#include <new>
 #include <string>
 
+// Counts heap allocations for --stats; a plain malloc otherwise.
+void* operator new(size_t size) {
+    CountAllocation();
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
 void PrintUsage() {
     std::cout << "MK9Tool for PS3 by Jules" << std::endl;
     std::cout << "Usage:" << std::endl;
     std::cout << "  Extraction: MK9Tool <file.xxx>" << std::endl;
     std::cout << "  Patch All:  MK9Tool patchall <xxx_file> <folder_with_bins>" << std::endl;
-    std::cout << "  Patching:   MK9Tool patch <xxx_file> <sample_name> <new_audio_bin>" << std::endl;
+    std::cout << "  Patching:   MK9Tool patch <xxx_file> <sample_name|cue_name> <new_audio_bin>" << std::endl;
+    std::cout << "  Plan:       MK9Tool plan <xxx_file> <folder_with_bins> [plan.json]" << std::endl;
+    std::cout << "  Apply:      MK9Tool apply <plan.json>" << std::endl;
+    std::cout << "  From FSB:   MK9Tool patchfromfsb <xxx_file> <donor_fsb>" << std::endl;
+    std::cout << "  Rollback:   MK9Tool rollback <xxx_file>" << std::endl;
+    std::cout << "  Verify:     MK9Tool verify <xxx_file>" << std::endl;
+    std::cout << "  Cues:       MK9Tool cues <xxx_file>" << std::endl;
     std::cout << "  Extr. FSB:  MK9Tool extractfsb <fsb_file>" << std::endl;
+    std::cout << "  Extr. All:  MK9Tool extractall <folder|file|pattern>..." << std::endl;
+    std::cout << "  Catalog:    MK9Tool catalog <folder|file|pattern>..." << std::endl;
+    std::cout << "  Lookup:     MK9Tool lookup <sample_name>" << std::endl;
+    std::cout << "  Find:       MK9Tool find <folder|file|pattern>... [filters]" << std::endl;
+    std::cout << "  Shared:     MK9Tool shared <store_dir> <sample_name|hash>" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --no-fsb-copy    Extract samples without writing audio_N.fsb bank copies" << std::endl;
+    std::cout << "  --stream <file>  Stream file holding the samples missing from a truncated bank" << std::endl;
+    std::cout << "  --wav            Also decode VAG samples to .wav files next to their .bin files" << std::endl;
+    std::cout << "  --incremental    Only rewrite extracted files whose source bytes changed since the last run" << std::endl;
+    std::cout << "  --store <dir>    Store each distinct sample once in <dir> and link the extracted files to it" << std::endl;
+    std::cout << "  --out <file>     Write the patched package to <file> and leave the original untouched" << std::endl;
+    std::cout << "  --journal        Keep an undo journal of each patch run for rollback and verify" << std::endl;
+    std::cout << "  --catalog <file> Catalog to build or consult (default " << DEFAULT_CATALOG_PATH << ")" << std::endl;
+    std::cout << "  --stats          Print time per phase and I/O and allocation counts when done" << std::endl;
+    std::cout << "  --trace <file>   Write a Chrome trace (chrome://tracing, Perfetto) of the run's phases" << std::endl;
+    std::cout << "Find filters:" << std::endl;
+    std::cout << "  --name <pattern> --regex <regex> --codec <format> --channels <n> --freq <hz>" << std::endl;
+    std::cout << "  --min-size <bytes> --max-size <bytes>" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
+    // Options may appear anywhere; strip them so the positional arguments
+    // below keep their places.
+    ExtractOptions extractOptions;
+    std::string catalogPath = DEFAULT_CATALOG_PATH;
+    std::string outPath;
+    SampleQuery query;
+    SampleStore store;
+    bool stats = false;
+    std::string tracePath;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--no-fsb-copy") {
+            extractOptions.writeFsbCopy = false;
+        } else if (arg == "--wav") {
+            extractOptions.writeWav = true;
+        } else if (arg == "--incremental") {
+            extractOptions.incremental = true;
+        } else if (arg == "--stream" && i + 1 < argc) {
+            extractOptions.streamPath = argv[++i];
+        } else if (arg == "--store" && i + 1 < argc) {
+            if (!store.Open(argv[++i])) {
+                std::cout << "Failed to open sample store " << argv[i] << std::endl;
+                return 1;
+            }
+            extractOptions.store = &store;
+        } else if (arg == "--out" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (arg == "--journal") {
+            SetPatchJournaling(true);
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--catalog" && i + 1 < argc) {
+            catalogPath = argv[++i];
+        } else if (arg == "--name" && i + 1 < argc) {
+            query.name = argv[++i];
+        } else if (arg == "--regex" && i + 1 < argc) {
+            query.regex = argv[++i];
+        } else if (arg == "--codec" && i + 1 < argc) {
+            query.codec = argv[++i];
+        } else if (arg == "--channels" && i + 1 < argc) {
+            query.channels = atoi(argv[++i]);
+        } else if (arg == "--freq" && i + 1 < argc) {
+            query.frequency = atoi(argv[++i]);
+        } else if (arg == "--min-size" && i + 1 < argc) {
+            query.minSize = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--max-size" && i + 1 < argc) {
+            query.maxSize = strtoull(argv[++i], nullptr, 0);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cout << "Unknown option " << arg << std::endl;
+            PrintUsage();
+            return 1;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    if (stats || !tracePath.empty()) {
+        EnableStats(stats, tracePath);
+        atexit(FinishStats);
+    }
+
     if (argc < 2) {
         PrintUsage();
         return 1;
@@ -19,24 +133,96 @@ int main(int argc, char* argv[]) {
 
     std::string arg1 = argv[1];
 
+    // An existing catalog spares extraction and patching the bank scan;
+    // packages it does not hold, or holds stale, are scanned as before.
+    if (arg1 != "catalog" && FileExists(catalogPath)) {
+        SetActiveCatalog(catalogPath);
+    }
+
     if (arg1 == "patch") {
         if (argc < 5) {
             PrintUsage();
             return 1;
         }
-        PatchXXXAudio(argv[2], argv[3], argv[4]);
+        if (!PatchXXXAudio(argv[2], argv[3], argv[4], outPath)) return 1;
     } else if (arg1 == "patchall" || arg1 == "all") {
         if (argc < 4) {
             PrintUsage();
             return 1;
         }
-        PatchAllXXXAudio(argv[2], argv[3]);
+        PatchAllXXXAudio(argv[2], argv[3], outPath);
+    } else if (arg1 == "plan") {
+        if (argc < 4) {
+            PrintUsage();
+            return 1;
+        }
+        PlanXXXAudio(argv[2], argv[3], argc > 4 ? argv[4] : "");
+    } else if (arg1 == "apply") {
+        if (argc < 3) {
+            PrintUsage();
+            return 1;
+        }
+        if (!ApplyXXXPlan(argv[2], outPath)) return 1;
+    } else if (arg1 == "patchfromfsb") {
+        if (argc < 4) {
+            PrintUsage();
+            return 1;
+        }
+        PatchXXXFromFSB(argv[2], argv[3], outPath);
+    } else if (arg1 == "rollback") {
+        if (argc < 3) {
+            PrintUsage();
+            return 1;
+        }
+        if (!RollbackPatch(argv[2])) return 1;
+    } else if (arg1 == "verify") {
+        if (argc < 3) {
+            PrintUsage();
+            return 1;
+        }
+        if (!VerifyPatch(argv[2])) return 1;
+    } else if (arg1 == "cues") {
+        if (argc < 3) {
+            PrintUsage();
+            return 1;
+        }
+        ListXXXCues(argv[2]);
     } else if (arg1 == "extractfsb") {
         if (argc < 3) {
             PrintUsage();
             return 1;
         }
-        ExtractFSB(argv[2]);
+        ExtractFSB(argv[2], extractOptions);
+    } else if (arg1 == "extractall") {
+        if (argc < 3) {
+            PrintUsage();
+            return 1;
+        }
+        ExtractBatch(std::vector<std::string>(argv + 2, argv + argc), extractOptions);
+    } else if (arg1 == "catalog") {
+        if (argc < 3) {
+            PrintUsage();
+            return 1;
+        }
+        BuildCatalog(std::vector<std::string>(argv + 2, argv + argc), catalogPath);
+    } else if (arg1 == "lookup") {
+        if (argc < 3) {
+            PrintUsage();
+            return 1;
+        }
+        LookupCatalogSample(argv[2], catalogPath);
+    } else if (arg1 == "find") {
+        if (argc < 3) {
+            PrintUsage();
+            return 1;
+        }
+        FindSamples(std::vector<std::string>(argv + 2, argv + argc), query);
+    } else if (arg1 == "shared") {
+        if (argc < 4) {
+            PrintUsage();
+            return 1;
+        }
+        FindSharedSamples(argv[2], argv[3]);
     } else if (argc == 2) {
         std::string input = argv[1];
         if (IsDirectory(input)) {
@@ -48,9 +234,9 @@ int main(int argc, char* argv[]) {
             }
             PatchAllXXXAudio(xxx_file, input);
         } else if (input.size() >= 4 && (input.substr(input.size() - 4) == ".xxx" || input.substr(input.size() - 4) == ".XXX")) {
-            ExtractXXX(input);
+            ExtractXXX(input, extractOptions);
         } else if (input.size() >= 4 && (input.substr(input.size() - 4) == ".fsb" || input.substr(input.size() - 4) == ".FSB")) {
-            ExtractFSB(input);
+            ExtractFSB(input, extractOptions);
         } else if (input.size() >= 8 && (input.substr(input.size() - 8) == ".wav.bin" || input.substr(input.size() - 8) == ".WAV.BIN")) {
             std::string xxx_file;
             std::cout << "Enter the .xxx file to inject into: ";